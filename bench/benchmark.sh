@@ -0,0 +1,138 @@
+#!/bin/bash
+# Benchmarks de targ10, con GNU tar como referencia
+#
+# USO
+#   bench/benchmark.sh [-s semilla] [-e escala] [-r repeticiones] [-d directorio] [-c]
+#
+#   -s, -e  semilla y escala del corpus (ver genera_corpus.c): los mismos
+#           valores dan el mismo corpus. Por defecto 1 y 1 (unos 850 MB
+#           aparentes, 30000 ficheros); -e 0.1 para una prueba rapida.
+#   -r      repeticiones de cada medida (se muestra la mas rapida), 3 por
+#           defecto
+#   -d      directorio de trabajo (corpus, tars y extracciones), por defecto
+#           ${TMPDIR:-/tmp}/targ10-bench. Se mide su sistema de ficheros.
+#   -c      vacia la cache de paginas antes de cada medida (solo root); si
+#           no, las medidas son con la cache caliente
+#
+#   TARG10_OPTS  opciones de targ10 en todas las medidas (p.ej. "-j 4 -u")
+#
+# Operaciones: crear el tar del corpus, añadir anexo.dat al tar, extraer un
+# solo miembro y extraer todo, con targ10 y con GNU tar. En
+# <directorio>/resultados.csv se escriben todas las repeticiones y en stdout
+# la mas rapida de cada operacion: segundos, MB/s, ficheros/s, RSS maximo,
+# llamadas al sistema (perf stat, si esta disponible) y las lecturas y
+# escrituras (syscr y syscw de /proc/<pid>/io, ver mide.c).
+
+SEMILLA=1
+ESCALA=1
+REPETICIONES=3
+TRABAJO=${TMPDIR:-/tmp}/targ10-bench
+VACIAR=0
+while getopts "s:e:r:d:c" opcion; do
+    case $opcion in
+    s) SEMILLA=$OPTARG ;;
+    e) ESCALA=$OPTARG ;;
+    r) REPETICIONES=$OPTARG ;;
+    d) TRABAJO=$OPTARG ;;
+    c) VACIAR=1 ;;
+    *)
+        echo "Uso: $0 [-s semilla] [-e escala] [-r repeticiones] [-d directorio] [-c]" >&2
+        exit 1
+        ;;
+    esac
+done
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+RAIZ=$(dirname "$BENCH")
+mkdir -p "$TRABAJO" && cd "$TRABAJO" || exit 1
+TRABAJO=$(pwd)
+
+# the same build as COMPILACION in create_mytar+inserta,extrae.c
+gcc -o targ10 "$RAIZ/create_mytar+inserta,extrae.c" "$RAIZ/mytarlib.c" -lpthread -lz || exit 1
+gcc -O2 -o genera_corpus "$BENCH/genera_corpus.c" || exit 1
+gcc -O2 -o mide "$BENCH/mide.c" || exit 1
+
+# corpus: generated again if the seed or the scale change
+if ! awk -F= -v s="$SEMILLA" -v e="$ESCALA" '$1 == "semilla" && $2 == s { a = 1 }
+                                             $1 == "escala" && $2 + 0 == e + 0 { b = 1 }
+                                             END { exit !(a && b) }' datos/corpus.info 2>/dev/null; then
+    rm -rf datos
+    ./genera_corpus -s "$SEMILLA" -e "$ESCALA" datos || exit 1
+fi
+. datos/corpus.info
+
+PERF=0
+if command -v perf >/dev/null 2>&1 && perf stat -x, -e raw_syscalls:sys_enter -o /dev/null true >/dev/null 2>&1; then
+    PERF=1
+fi
+
+echo "targ10 $TARG10_OPTS / $(tar --version | head -1)"
+echo "$(nproc) CPU, $(uname -sr), $(stat -f -c %T "$TRABAJO") en $TRABAJO"
+echo "corpus: semilla=$semilla escala=$escala, $ficheros ficheros, $bytes bytes"
+[ $PERF = 1 ] || echo "(sin perf: llamadas = -)"
+echo "herramienta,operacion,repeticion,segundos,mb_s,ficheros_s,maxrss_kb,llamadas,lecturas,escrituras,estado" >resultados.csv
+
+# mide herramienta operacion bytes ficheros repeticion directorio comando...
+# (the command runs in directorio; its stdout is discarded)
+mide() {
+    local herramienta=$1 operacion=$2 bytes=$3 nfich=$4 rep=$5 dir=$6 llamadas=-
+    shift 6
+    if [ $VACIAR = 1 ]; then
+        sync
+        echo 3 >/proc/sys/vm/drop_caches
+    fi
+    if [ $PERF = 1 ]; then
+        (cd "$dir" && perf stat -x, -e raw_syscalls:sys_enter -o "$TRABAJO/perf.txt" "$TRABAJO/mide" "$@" >/dev/null 2>"$TRABAJO/mide.txt")
+        llamadas=$(awk -F, '/raw_syscalls/ { print $1 }' "$TRABAJO/perf.txt")
+    else
+        (cd "$dir" && "$TRABAJO/mide" "$@" >/dev/null 2>"$TRABAJO/mide.txt")
+    fi
+    grep -v '^MIDE' "$TRABAJO/mide.txt" | head -5 >&2
+    grep '^MIDE' "$TRABAJO/mide.txt" |
+        awk -v h="$herramienta" -v o="$operacion" -v b="$bytes" -v f="$nfich" -v r="$rep" -v ll="$llamadas" '{
+            for (i = 2; i <= NF; i++) { split($i, kv, "="); v[kv[1]] = kv[2] }
+            s = (v["segundos"] > 0) ? v["segundos"] : 1e-9
+            printf "%s,%s,%d,%.6f,%.1f,%.1f,%s,%s,%s,%s,%s\n", h, o, r, v["segundos"], b / 1e6 / s, f / s,
+                   v["maxrss_kb"], ll, v["lecturas"], v["escrituras"], v["estado"]
+            if (v["estado"] != 0) printf "%s %s: estado %s\n", h, o, v["estado"] > "/dev/stderr"
+        }' >>resultados.csv
+}
+
+for rep in $(seq 1 "$REPETICIONES"); do
+    rm -f a_targ10.tar a_tar.tar
+    mide targ10 crear "$bytes" "$ficheros" "$rep" datos ../targ10 $TARG10_OPTS corpus ../a_targ10.tar
+    mide tar crear "$bytes" "$ficheros" "$rep" datos tar -S -cf ../a_tar.tar corpus
+
+    cp a_targ10.tar b_targ10.tar
+    cp a_tar.tar b_tar.tar
+    mide targ10 anexar "$bytes_anexo" 1 "$rep" datos ../targ10 $TARG10_OPTS anexo.dat ../b_targ10.tar
+    mide tar anexar "$bytes_anexo" 1 "$rep" datos tar -rf ../b_tar.tar anexo.dat
+
+    for h in targ10 tar; do
+        rm -rf "x_$h" && mkdir "x_$h"
+    done
+    mide targ10 extraer_uno "$bytes_miembro" 1 "$rep" x_targ10 ../targ10 $TARG10_OPTS -e "$miembro" ../a_targ10.tar
+    mide tar extraer_uno "$bytes_miembro" 1 "$rep" x_tar tar -xf ../a_tar.tar "$miembro"
+
+    for h in targ10 tar; do
+        rm -rf "x_$h" && mkdir "x_$h"
+    done
+    mide targ10 extraer_todo "$bytes" "$ficheros" "$rep" x_targ10 ../targ10 $TARG10_OPTS -x ../a_targ10.tar
+    mide tar extraer_todo "$bytes" "$ficheros" "$rep" x_tar tar -xf ../a_tar.tar
+done
+rm -rf x_targ10 x_tar b_targ10.tar b_tar.tar
+
+# the fastest repetition of each operation
+awk -F, 'NR > 1 {
+            k = $1 "," $2
+            if (!(k in mejor)) orden[n++] = k
+            if (!(k in mejor) || $4 < mejor[k]) { mejor[k] = $4; linea[k] = $0 }
+         }
+         END {
+            printf "%-8s %-13s %10s %9s %11s %10s %10s %10s %10s\n", "", "operacion", "segundos", "MB/s",
+                   "ficheros/s", "maxrss_KB", "llamadas", "lecturas", "escrituras"
+            for (i = 0; i < n; i++) {
+                split(linea[orden[i]], c, ",")
+                printf "%-8s %-13s %10.3f %9.1f %11.1f %10s %10s %10s %10s\n", c[1], c[2], c[4], c[5], c[6], c[7], c[8], c[9], c[10]
+            }
+         }' resultados.csv
@@ -0,0 +1,352 @@
+/* *
+ * * @file genera_corpus.c
+ * * @author ISO-2-G10
+ * * @date 16/10/2026
+ * * @brief Deterministic corpus for the benchmarks of targ10
+ * * @details The same seed and scale give the same names, sizes, contents,
+ * *          sparse maps and dates on every machine (see benchmark.sh)
+ * * */
+/*
+USO
+       genera_corpus [-s semilla] [-e escala] directorio
+
+       Crea en directorio (que no debe existir):
+       corpus/diminutos/dNN/fNNNNN   20000*escala ficheros de 0 a 4 KiB (casi
+                                     todos de menos de 1 KiB) en 100 directorios
+       corpus/enormes/e0.dat         128*escala MiB de bytes aleatorios
+       corpus/enormes/e1.dat         128*escala MiB de texto (comprimible)
+       corpus/profundo/p0/p1/...     arbol binario de 10 niveles, 2*escala
+                                     ficheros pequeños en cada directorio
+       corpus/enlaces/lNNNN          1000 enlaces simbolicos a ficheros de
+                                     diminutos (y 10 rotos)
+       corpus/dispersos/sN.dat       8 ficheros dispersos de 64*escala MiB con
+                                     16 regiones de datos de 64 KiB
+       anexo.dat                     16*escala MiB, para añadir al tar
+       corpus.info                   semilla, escala, numero de ficheros, bytes
+                                     y el miembro que se extrae solo (clave=valor)
+
+       Todos los nombres tienen menos de 100 caracteres y todas las fechas
+       de modificacion son FECHA_CORPUS.
+
+COMPILACION
+       gcc -O2 -o genera_corpus genera_corpus.c
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define FECHA_CORPUS (1679616000) // 24/03/2023
+#define TAM_BUFFER (1024 * 1024)
+#define DIRS_DIMINUTOS (100)
+#define NIVELES_PROFUNDO (10)
+#define NUM_ENLACES (1000)
+#define NUM_ROTOS (10)
+#define NUM_DISPERSOS (8)
+#define REGIONES_DISPERSAS (16)
+#define TAM_REGION (64 * 1024)
+#define MIB (1024ULL * 1024ULL)
+
+// xorshift64* (the generator of the whole corpus)
+unsigned long long Estado;
+
+unsigned long long Aleatorio(void)
+{
+    Estado ^= Estado >> 12;
+    Estado ^= Estado << 25;
+    Estado ^= Estado >> 27;
+    return Estado * 0x2545F4914F6CDD1DULL;
+}
+
+// totals written in corpus.info
+unsigned long NumFicheros = 0;
+unsigned long long NumBytes = 0;
+char *Buffer;
+
+// Fill n bytes of buff: random bytes, or lines of words (texto)
+void LlenaBuffer(char *buff, unsigned long n, int texto)
+{
+    static const char *palabras[] = {"tar", "cabecera", "bloque", "fichero", "directorio", "enlace",
+                                     "datos", "relleno", "indice", "hilo", "marco", "disperso"};
+    unsigned long long v = 0;
+    unsigned long i = 0;
+    const char *p;
+
+    if (!texto)
+    {
+        for (; i + 8 <= n; i += 8)
+        {
+            v = Aleatorio();
+            memcpy(buff + i, &v, 8);
+        }
+        for (v = Aleatorio(); i < n; i++, v >>= 8)
+            buff[i] = (char)v;
+        return;
+    }
+    while (i < n)
+    {
+        v = Aleatorio();
+        for (p = palabras[v % 12]; *p != '\0' && i < n; p++)
+            buff[i++] = *p;
+        if (i < n)
+            buff[i++] = ((v >> 8) % 10 == 0) ? '\n' : ' ';
+    }
+}
+
+int EscribeTodo(int fd, const char *buff, unsigned long n)
+{
+    ssize_t escritos;
+
+    while (n > 0)
+    {
+        if ((escritos = write(fd, buff, n)) <= 0)
+        {
+            if (escritos == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buff += escritos;
+        n -= escritos;
+    }
+    return 0;
+}
+
+void FijaFecha(const char *ruta)
+{
+    struct timespec fechas[2] = {{FECHA_CORPUS, 0}, {FECHA_CORPUS, 0}};
+
+    utimensat(AT_FDCWD, ruta, fechas, AT_SYMLINK_NOFOLLOW);
+}
+
+int CreaDirectorio(const char *ruta)
+{
+    if (mkdir(ruta, 0755) == -1 && errno != EEXIST)
+    {
+        fprintf(stderr, "No se puede crear el directorio %s\n", ruta);
+        return -1;
+    }
+    return 0;
+}
+
+// Regular file of tam bytes
+int CreaFichero(const char *ruta, unsigned long long tam, int texto)
+{
+    unsigned long n;
+    int fd;
+
+    if ((fd = open(ruta, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+    {
+        fprintf(stderr, "No se puede crear el fichero %s\n", ruta);
+        return -1;
+    }
+    NumFicheros++;
+    NumBytes += tam;
+    while (tam > 0)
+    {
+        n = (tam < TAM_BUFFER) ? tam : TAM_BUFFER;
+        LlenaBuffer(Buffer, n, texto);
+        if (EscribeTodo(fd, Buffer, n) != 0)
+        {
+            fprintf(stderr, "Error al escribir el fichero %s\n", ruta);
+            close(fd);
+            return -1;
+        }
+        tam -= n;
+    }
+    close(fd);
+    FijaFecha(ruta);
+    return 0;
+}
+
+// Sparse file of tam bytes with REGIONES_DISPERSAS data regions of
+// TAM_REGION bytes (4 KiB aligned, one in each slice of the file)
+int CreaDisperso(const char *ruta, unsigned long long tam)
+{
+    unsigned long long trozo = tam / REGIONES_DISPERSAS, offset;
+    int fd, i;
+
+    if ((fd = open(ruta, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+    {
+        fprintf(stderr, "No se puede crear el fichero %s\n", ruta);
+        return -1;
+    }
+    NumFicheros++;
+    NumBytes += tam;
+    for (i = 0; i < REGIONES_DISPERSAS && trozo > TAM_REGION; i++)
+    {
+        offset = i * trozo + ((Aleatorio() % (trozo - TAM_REGION)) & ~4095ULL);
+        LlenaBuffer(Buffer, TAM_REGION, 0);
+        if (lseek(fd, offset, SEEK_SET) == -1 || EscribeTodo(fd, Buffer, TAM_REGION) != 0)
+        {
+            fprintf(stderr, "Error al escribir el fichero %s\n", ruta);
+            close(fd);
+            return -1;
+        }
+    }
+    if (ftruncate(fd, tam) == -1)
+        fprintf(stderr, "Error al escribir el fichero %s\n", ruta);
+    close(fd);
+    FijaFecha(ruta);
+    return 0;
+}
+
+// Size of a small file: most below 1 KiB, some up to 4 KiB
+unsigned long TamPequenio(void)
+{
+    unsigned long long v = Aleatorio();
+
+    return (v % 4 == 0) ? (v >> 8) % 4097 : (v >> 8) % 1024;
+}
+
+// Binary tree of niveles levels under ruta with porDir files in each directory
+int CreaProfundo(char *ruta, int nivel, int niveles, unsigned long porDir)
+{
+    size_t lon = strlen(ruta);
+    unsigned long i;
+    int h;
+
+    if (CreaDirectorio(ruta) != 0)
+        return -1;
+    for (i = 0; i < porDir; i++)
+    {
+        snprintf(ruta + lon, PATH_MAX - lon, "/f%lu", i);
+        if (CreaFichero(ruta, TamPequenio(), 1) != 0)
+            return -1;
+    }
+    for (h = 0; nivel + 1 < niveles && h < 2; h++)
+    {
+        snprintf(ruta + lon, PATH_MAX - lon, "/p%d", h);
+        if (CreaProfundo(ruta, nivel + 1, niveles, porDir) != 0)
+            return -1;
+    }
+    ruta[lon] = '\0';
+    FijaFecha(ruta);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char ruta[PATH_MAX], destino[PATH_MAX], miembro[PATH_MAX] = "";
+    unsigned long long semilla = 1;
+    unsigned long i, numDiminutos, porDir, tam, tamMiembro = 0;
+    double escala = 1.0;
+    FILE *info;
+    int opcion;
+
+    while ((opcion = getopt(argc, argv, "s:e:")) != -1)
+    {
+        if (opcion == 's')
+            semilla = strtoull(optarg, NULL, 10);
+        else if (opcion == 'e')
+            escala = strtod(optarg, NULL);
+        else
+            break;
+    }
+    if (optind != argc - 1 || escala <= 0)
+    {
+        fprintf(stderr, "Uso: %s [-s semilla] [-e escala] directorio\n", argv[0]);
+        return 1;
+    }
+    if (mkdir(argv[optind], 0755) == -1 || chdir(argv[optind]) == -1)
+    {
+        fprintf(stderr, "No se puede crear el directorio %s\n", argv[optind]);
+        return 1;
+    }
+    if ((Buffer = malloc(TAM_BUFFER)) == NULL)
+        return 1;
+    Estado = semilla * 0x9E3779B97F4A7C15ULL + 1; // never 0
+    umask(022);
+
+    // many tiny files
+    numDiminutos = 20000 * escala;
+    if (CreaDirectorio("corpus") != 0 || CreaDirectorio("corpus/diminutos") != 0)
+        return 1;
+    for (i = 0; i < DIRS_DIMINUTOS; i++)
+    {
+        snprintf(ruta, sizeof(ruta), "corpus/diminutos/d%02lu", i);
+        if (CreaDirectorio(ruta) != 0)
+            return 1;
+    }
+    for (i = 0; i < numDiminutos; i++)
+    {
+        snprintf(ruta, sizeof(ruta), "corpus/diminutos/d%02lu/f%05lu", i % DIRS_DIMINUTOS, i);
+        tam = TamPequenio();
+        if (CreaFichero(ruta, tam, i % 2) != 0)
+            return 1;
+        if (i == numDiminutos / 2)
+        {
+            strcpy(miembro, ruta); // the member extracted alone
+            tamMiembro = tam;
+        }
+    }
+
+    // a few huge files
+    if (CreaDirectorio("corpus/enormes") != 0 ||
+        CreaFichero("corpus/enormes/e0.dat", (unsigned long long)(128 * escala) * MIB, 0) != 0 ||
+        CreaFichero("corpus/enormes/e1.dat", (unsigned long long)(128 * escala) * MIB, 1) != 0)
+        return 1;
+
+    // deep tree
+    porDir = 2 * escala;
+    strcpy(ruta, "corpus/profundo");
+    if (CreaProfundo(ruta, 0, NIVELES_PROFUNDO, porDir > 0 ? porDir : 1) != 0)
+        return 1;
+
+    // symbolic links (relative, and some to names that do not exist)
+    if (CreaDirectorio("corpus/enlaces") != 0)
+        return 1;
+    for (i = 0; i < NUM_ENLACES + NUM_ROTOS; i++)
+    {
+        if (i < NUM_ENLACES && numDiminutos > 0)
+        {
+            unsigned long f = Aleatorio() % numDiminutos;
+            snprintf(destino, sizeof(destino), "../diminutos/d%02lu/f%05lu", f % DIRS_DIMINUTOS, f);
+        }
+        else
+            snprintf(destino, sizeof(destino), "../no/existe%lu", i);
+        snprintf(ruta, sizeof(ruta), "corpus/enlaces/l%04lu", i);
+        if (symlink(destino, ruta) == -1)
+        {
+            fprintf(stderr, "No se puede crear el enlace %s\n", ruta);
+            return 1;
+        }
+        NumFicheros++;
+        FijaFecha(ruta);
+    }
+
+    // sparse files
+    if (CreaDirectorio("corpus/dispersos") != 0)
+        return 1;
+    for (i = 0; i < NUM_DISPERSOS; i++)
+    {
+        snprintf(ruta, sizeof(ruta), "corpus/dispersos/s%lu.dat", i);
+        if (CreaDisperso(ruta, (unsigned long long)(64 * escala) * MIB) != 0)
+            return 1;
+    }
+    FijaFecha("corpus/diminutos");
+    FijaFecha("corpus/enormes");
+    FijaFecha("corpus/enlaces");
+    FijaFecha("corpus/dispersos");
+    FijaFecha("corpus");
+
+    // outside the corpus: the file appended to the tar
+    i = NumFicheros;
+    if (CreaFichero("anexo.dat", (unsigned long long)(16 * escala) * MIB, 0) != 0)
+        return 1;
+    NumFicheros = i;
+    NumBytes -= (unsigned long long)(16 * escala) * MIB;
+
+    if ((info = fopen("corpus.info", "w")) == NULL)
+        return 1;
+    fprintf(info, "semilla=%llu\nescala=%g\nficheros=%lu\nbytes=%llu\nmiembro=%s\nbytes_miembro=%llu\nbytes_anexo=%llu\n",
+            semilla, escala, NumFicheros, NumBytes, miembro, (unsigned long long)tamMiembro, (unsigned long long)(16 * escala) * MIB);
+    fclose(info);
+    free(Buffer);
+    printf("corpus: %lu ficheros, %llu bytes\n", NumFicheros, NumBytes);
+    return 0;
+}
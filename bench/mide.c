@@ -0,0 +1,90 @@
+/* *
+ * * @file mide.c
+ * * @author ISO-2-G10
+ * * @date 16/10/2026
+ * * @brief Run a command and measure it (see benchmark.sh)
+ * * @details Wall time, peak RSS and system calls of a command (and its
+ * *          threads). The read and write system calls come from
+ * *          /proc/<pid>/io, read when the command has finished but before
+ * *          it is reaped (waitid with WNOWAIT), so no tracer is needed.
+ * * */
+/*
+USO
+       mide comando [argumentos...]
+
+       Escribe en stderr una linea:
+       MIDE segundos=S maxrss_kb=K lecturas=R escrituras=W estado=E
+       lecturas y escrituras son syscr y syscw de /proc/<pid>/io (-1 si no
+       se pueden leer) y estado el codigo de salida del comando.
+
+COMPILACION
+       gcc -O2 -o mide mide.c
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// syscr and syscw of /proc/pid/io
+void LeeIoProceso(pid_t pid, long long *lecturas, long long *escrituras)
+{
+    char ruta[64], linea[256];
+    FILE *io;
+
+    *lecturas = *escrituras = -1;
+    snprintf(ruta, sizeof(ruta), "/proc/%d/io", (int)pid);
+    if ((io = fopen(ruta, "r")) == NULL)
+        return;
+    while (fgets(linea, sizeof(linea), io) != NULL)
+    {
+        if (strncmp(linea, "syscr:", 6) == 0)
+            *lecturas = strtoll(linea + 6, NULL, 10);
+        else if (strncmp(linea, "syscw:", 6) == 0)
+            *escrituras = strtoll(linea + 6, NULL, 10);
+    }
+    fclose(io);
+}
+
+int main(int argc, char *argv[])
+{
+    struct timespec inicio, fin;
+    struct rusage uso;
+    long long lecturas, escrituras;
+    siginfo_t info;
+    pid_t pid;
+    int estado;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Uso: %s comando [argumentos...]\n", argv[0]);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    if ((pid = fork()) == -1)
+    {
+        fprintf(stderr, "No se puede crear el proceso\n");
+        return 1;
+    }
+    if (pid == 0)
+    {
+        execvp(argv[1], argv + 1);
+        fprintf(stderr, "No se puede ejecutar %s\n", argv[1]);
+        _exit(127);
+    }
+    // finished but not reaped: its /proc entry is still there
+    while (waitid(P_PID, pid, &info, WEXITED | WNOWAIT) == -1)
+        ;
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    LeeIoProceso(pid, &lecturas, &escrituras);
+    if (wait4(pid, &estado, 0, &uso) == -1)
+        return 1;
+    fprintf(stderr, "MIDE segundos=%.6f maxrss_kb=%ld lecturas=%lld escrituras=%lld estado=%d\n",
+            (fin.tv_sec - inicio.tv_sec) + (fin.tv_nsec - inicio.tv_nsec) / 1e9, uso.ru_maxrss,
+            lecturas, escrituras, WIFEXITED(estado) ? WEXITSTATUS(estado) : 128 + WTERMSIG(estado));
+    return WIFEXITED(estado) ? WEXITSTATUS(estado) : 1;
+}
@@ -0,0 +1,250 @@
+/* *
+ * * @file mide_cabeceras.c
+ * * @author ISO-2-G10
+ * * @date 16/10/2026
+ * * @brief Micro-benchmark and check of the header codec (s_mytarcodec.h)
+ * * @details Builds headers from random stat values in two ways: the
+ * *          previous one of ConstruyeCabeceraTar (sprintf of each field
+ * *          and a sum of the 512 bytes for the checksum) and the codec
+ * *          (CodificaNumero with the checksum added while the fields are
+ * *          filled). The headers have to be identical, valid
+ * *          (CabeceraValida) and decode back to their values; then both
+ * *          ways are timed (headers/s), as the decode of the size
+ * *          (sscanf / DecodificaNumero).
+ * * */
+/*
+USO
+       mide_cabeceras [-s semilla] [-n cabeceras]
+
+       -s  semilla del generador (1 por defecto)
+       -n  cabeceras de la comprobacion y de cada medida (1000000 por
+           defecto)
+
+       Termina con 1 si alguna cabecera no coincide.
+
+COMPILACION
+       gcc -O2 -o mide_cabeceras mide_cabeceras.c ../mytarlib.c -lpthread
+       (sin -O2 para medir la compilacion por defecto de targ10)
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "../s_mytarlib.h"
+#include "../s_mytarcodec.h"
+
+// the stat values of a header
+struct valores
+{
+    unsigned long modo, uid, gid;
+    unsigned long long tam, mtime, atime, ctime;
+    char tipo;
+};
+
+// xorshift64* (as genera_corpus.c)
+unsigned long long Estado;
+
+unsigned long long Aleatorio(void)
+{
+    Estado ^= Estado >> 12;
+    Estado ^= Estado << 25;
+    Estado ^= Estado >> 27;
+    return Estado * 0x2545F4914F6CDD1DULL;
+}
+
+// Random values that fit in the octal digits of each field (the sprintf
+// version does not write base-256). The sizes are often near a block.
+void GeneraValores(struct valores *v)
+{
+    v->modo = Aleatorio() & 07777;
+    v->uid = Aleatorio() % (1UL << 21);
+    v->gid = Aleatorio() % 70000;
+    switch (Aleatorio() % 4)
+    {
+    case 0:
+        v->tam = (1 + Aleatorio() % 4) * 512 + Aleatorio() % 3 - 1; // 511, 512, 513...
+        break;
+    case 1:
+        v->tam = Aleatorio() % 200000;
+        break;
+    default:
+        v->tam = Aleatorio() % (1ULL << 33);
+    }
+    v->mtime = Aleatorio() % (1ULL << 33);
+    v->atime = Aleatorio() % (1ULL << 33);
+    v->ctime = Aleatorio() % (1ULL << 33);
+    v->tipo = "0257"[Aleatorio() % 4];
+}
+
+// The previous ConstruyeCabeceraTar: sprintf and the sum of the 512 bytes
+void CabeceraSprintf(const struct valores *v, const char *nombre, struct c_header_gnu_tar *pTarHeader)
+{
+    unsigned char *pTarHeaderBytes;
+    unsigned int Checksum;
+    int i;
+
+    bzero(pTarHeader, sizeof(struct c_header_gnu_tar));
+    strcpy(pTarHeader->name, nombre);
+    sprintf(pTarHeader->mode, "%07lo", v->modo);
+    sprintf(pTarHeader->uid, "%07lo", v->uid);
+    sprintf(pTarHeader->gid, "%07lo", v->gid);
+    sprintf(pTarHeader->size, "%011llo", v->tam);
+    sprintf(pTarHeader->mtime, "%011llo", v->mtime);
+    pTarHeader->typeflag[0] = v->tipo;
+    memcpy(pTarHeader->magic, "ustar ", 6);
+    strcpy(pTarHeader->version, " ");
+    strcpy(pTarHeader->uname, "usuario");
+    strcpy(pTarHeader->gname, "grupo");
+    sprintf(pTarHeader->atime, "%011llo", v->atime);
+    sprintf(pTarHeader->ctime, "%011llo", v->ctime);
+
+    memset(pTarHeader->checksum, ' ', 8);
+    pTarHeaderBytes = (unsigned char *)pTarHeader;
+    for (i = 0, Checksum = 0; i < (int)sizeof(struct c_header_gnu_tar); i++)
+        Checksum = Checksum + pTarHeaderBytes[i];
+    sprintf(pTarHeader->checksum, "%06o", Checksum);
+}
+
+// ConstruyeCabeceraTar with the codec: the checksum while the fields are filled
+void CabeceraCodec(const struct valores *v, const char *nombre, struct c_header_gnu_tar *pTarHeader)
+{
+    unsigned int Checksum;
+
+    bzero(pTarHeader, sizeof(struct c_header_gnu_tar));
+    Checksum = CopiaCampo(pTarHeader->name, sizeof(pTarHeader->name), nombre);
+    Checksum += CodificaOctal(pTarHeader->mode, 7, v->modo);
+    Checksum += CodificaNumero(pTarHeader->uid, sizeof(pTarHeader->uid), v->uid);
+    Checksum += CodificaNumero(pTarHeader->gid, sizeof(pTarHeader->gid), v->gid);
+    Checksum += CodificaNumero(pTarHeader->size, sizeof(pTarHeader->size), v->tam);
+    Checksum += CodificaNumero(pTarHeader->mtime, sizeof(pTarHeader->mtime), v->mtime);
+    Checksum += 8 * ' ';
+    pTarHeader->typeflag[0] = v->tipo;
+    Checksum += (unsigned char)pTarHeader->typeflag[0];
+    Checksum += CopiaCampo(pTarHeader->magic, 6, "ustar ");
+    Checksum += CopiaCampo(pTarHeader->version, 2, " ");
+    Checksum += CopiaCampo(pTarHeader->uname, sizeof(pTarHeader->uname), "usuario");
+    Checksum += CopiaCampo(pTarHeader->gname, sizeof(pTarHeader->gname), "grupo");
+    Checksum += CodificaNumero(pTarHeader->atime, sizeof(pTarHeader->atime), v->atime);
+    Checksum += CodificaNumero(pTarHeader->ctime, sizeof(pTarHeader->ctime), v->ctime);
+    CodificaOctal(pTarHeader->checksum, 6, Checksum);
+    pTarHeader->checksum[7] = ' ';
+}
+
+double Segundos(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Check n headers. Return the number of errors.
+unsigned long Comprueba(unsigned long n)
+{
+    struct c_header_gnu_tar a, b;
+    struct valores v;
+    unsigned long long grande;
+    unsigned long i, errores = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        GeneraValores(&v);
+        CabeceraSprintf(&v, "dir/fichero.dat", &a);
+        CabeceraCodec(&v, "dir/fichero.dat", &b);
+        if (memcmp(&a, &b, sizeof(a)) != 0 || !CabeceraValida(&b) ||
+            DecodificaNumero(b.size, sizeof(b.size)) != v.tam ||
+            DecodificaNumero(b.mtime, sizeof(b.mtime)) != v.mtime ||
+            DecodificaNumero(b.uid, sizeof(b.uid)) != v.uid ||
+            DecodificaNumero(b.mode, sizeof(b.mode)) != v.modo)
+        {
+            if (errores++ < 5)
+                fprintf(stderr, "Cabecera distinta: modo=%lo uid=%lu tam=%llu mtime=%llu\n", v.modo, v.uid, v.tam, v.mtime);
+        }
+        // 8 GiB or more: base-256 (only the codec)
+        grande = (1ULL << 33) + (Aleatorio() % (1ULL << 40));
+        CodificaNumero(b.size, sizeof(b.size), grande);
+        if (DecodificaNumero(b.size, sizeof(b.size)) != grande)
+        {
+            if (errores++ < 5)
+                fprintf(stderr, "Tamanio base-256 distinto: %llu\n", grande);
+        }
+    }
+    return errores;
+}
+
+int main(int argc, char *argv[])
+{
+    struct c_header_gnu_tar cabecera;
+    struct valores *valores;
+    char (*campos)[sizeof(cabecera.size)];
+    unsigned long long semilla = 1, suma;
+    unsigned long i, n = 1000000, errores;
+    unsigned long tam;
+    double t, tSprintf, tCodec;
+    int opcion;
+
+    while ((opcion = getopt(argc, argv, "s:n:")) != -1)
+    {
+        if (opcion == 's')
+            semilla = strtoull(optarg, NULL, 10);
+        else if (opcion == 'n')
+            n = strtoul(optarg, NULL, 10);
+        else
+        {
+            fprintf(stderr, "Uso: %s [-s semilla] [-n cabeceras]\n", argv[0]);
+            return 1;
+        }
+    }
+    Estado = semilla * 0x9E3779B97F4A7C15ULL + 1;
+
+    errores = Comprueba(n);
+    printf("comprobacion: %lu cabeceras, %lu errores\n", n, errores);
+
+    // the same values for both ways
+    if ((valores = malloc(n * sizeof(struct valores))) == NULL)
+        return 1;
+    for (i = 0; i < n; i++)
+        GeneraValores(&valores[i]);
+    t = Segundos();
+    for (i = 0, suma = 0; i < n; i++)
+    {
+        CabeceraSprintf(&valores[i], "dir/fichero.dat", &cabecera);
+        suma += cabecera.checksum[5];
+    }
+    tSprintf = Segundos() - t;
+    t = Segundos();
+    for (i = 0; i < n; i++)
+    {
+        CabeceraCodec(&valores[i], "dir/fichero.dat", &cabecera);
+        suma -= cabecera.checksum[5];
+    }
+    tCodec = Segundos() - t;
+    printf("cabeceras/s: sprintf %.2f M, codec %.2f M (x%.1f)\n", n / tSprintf / 1e6, n / tCodec / 1e6, tSprintf / tCodec);
+
+    // decode of the size
+    if ((campos = malloc(n * sizeof(campos[0]))) == NULL)
+        return 1;
+    for (i = 0; i < n; i++)
+        CodificaNumero(campos[i], sizeof(campos[i]), valores[i].tam);
+    t = Segundos();
+    for (i = 0; i < n; i++)
+    {
+        sscanf(campos[i], "%011lo", &tam);
+        suma += tam;
+    }
+    tSprintf = Segundos() - t;
+    t = Segundos();
+    for (i = 0; i < n; i++)
+        suma -= DecodificaNumero(campos[i], sizeof(campos[i]));
+    tCodec = Segundos() - t;
+    printf("decodificar el tamanio: sscanf %.1f ns, DecodificaNumero %.1f ns\n", tSprintf / n * 1e9, tCodec / n * 1e9);
+    free(campos);
+    free(valores);
+    if (suma != 0)
+        fprintf(stderr, "Sumas distintas\n");
+    return (errores != 0 || suma != 0) ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+#!/bin/bash
+# Prueba de ida y vuelta de las cabeceras de targ10 contra GNU tar
+#
+# USO
+#   bench/prueba_cabeceras.sh [-s semilla] [-n ficheros] [-d directorio]
+#
+#   -s      semilla de los valores aleatorios (1 por defecto): la misma
+#           semilla da los mismos ficheros
+#   -n      ficheros (300 por defecto)
+#   -d      directorio de trabajo, por defecto ${TMPDIR:-/tmp}/cabeceras-prueba
+#
+# Crea ficheros con modos (incluidos setuid, setgid y sticky), tamanios (0
+# a 200 KB, muchos junto a un bloque de 512) y mtimes (hasta 2^33)
+# aleatorios, los archiva con targ10 y comprueba que targ10 -t coincide con
+# tar -tv y que tar -xp restaura el modo, el tamanio, el mtime y los datos.
+# Despues ejecuta mide_cabeceras (la comprobacion y la medida del codec de
+# s_mytarcodec.h). Termina con 0 si todo coincide.
+
+SEMILLA=1
+FICHEROS=300
+TRABAJO=${TMPDIR:-/tmp}/cabeceras-prueba
+while getopts "s:n:d:" opcion; do
+    case $opcion in
+    s) SEMILLA=$OPTARG ;;
+    n) FICHEROS=$OPTARG ;;
+    d) TRABAJO=$OPTARG ;;
+    *)
+        echo "Uso: $0 [-s semilla] [-n ficheros] [-d directorio]" >&2
+        exit 1
+        ;;
+    esac
+done
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+RAIZ=$(dirname "$BENCH")
+rm -rf "$TRABAJO" && mkdir -p "$TRABAJO" && cd "$TRABAJO" || exit 1
+
+# the same build as COMPILACION in create_mytar+inserta,extrae.c
+gcc -o targ10 "$RAIZ/create_mytar+inserta,extrae.c" "$RAIZ/mytarlib.c" -lpthread -lz || exit 1
+gcc -O2 -Wall -o mide_cabeceras "$BENCH/mide_cabeceras.c" "$RAIZ/mytarlib.c" -lpthread || exit 1
+
+FALLOS=0
+falla() {
+    echo "FALLO: $*"
+    FALLOS=$((FALLOS + 1))
+}
+
+# "nombre modo tamanio mtime" of each file (awk: the same values for the
+# same seed)
+awk -v s="$SEMILLA" -v n="$FICHEROS" 'BEGIN {
+    srand(s)
+    for (i = 0; i < n; i++) {
+        r = rand()
+        if (r < 0.1) tam = 0
+        else if (r < 0.5) tam = 512 * int(1 + rand() * 8) + int(rand() * 3) - 1
+        else tam = int(rand() * 200 * 1024)
+        # the owner can always read it (0400, to compare the data)
+        modo = int(rand() * 4096)
+        if (int(modo / 256) % 2 == 0) modo += 256
+        printf "f%04d %04o %d %.0f\n", i, modo, tam, int(rand() * 8589934591) # (%d is 32 bits in mawk)
+    }
+}' >valores.txt
+[ "$(wc -l <valores.txt)" = "$FICHEROS" ] || falla "valores.txt"
+
+mkdir origen
+while read -r nombre modo tam mtime; do
+    head -c "$tam" /dev/urandom >"origen/$nombre"
+    chmod "$modo" "origen/$nombre"
+    touch -d "@$mtime" "origen/$nombre"
+done <valores.txt
+
+./targ10 origen a.tar >/dev/null || falla "targ10 ($?)"
+./targ10 -t a.tar >t_targ10.txt || falla "targ10 -t ($?)"
+tar -tvf a.tar >t_tar.txt 2>errores.txt || falla "tar -tvf: $(head -1 errores.txt)"
+diff t_tar.txt t_targ10.txt >diferencias.txt || falla "targ10 -t distinto de tar -tv: $(head -3 diferencias.txt)"
+
+mkdir x && (cd x && tar -xpf ../a.tar) 2>errores.txt || falla "tar -xpf: $(head -1 errores.txt)"
+while read -r nombre modo tam mtime; do
+    [ "$(stat -c '%04a %s %Y' "x/origen/$nombre")" = "$modo $tam $mtime" ] ||
+        falla "$nombre: $(stat -c '%04a %s %Y' "x/origen/$nombre"), se esperaba $modo $tam $mtime"
+    cmp -s "origen/$nombre" "x/origen/$nombre" || falla "datos de $nombre"
+done <valores.txt
+
+./mide_cabeceras -s "$SEMILLA" || falla "mide_cabeceras"
+
+if [ $FALLOS = 0 ]; then
+    echo "OK: $FICHEROS ficheros, targ10 coincide con GNU tar"
+else
+    echo "$FALLOS fallos"
+fi
+[ $FALLOS = 0 ]
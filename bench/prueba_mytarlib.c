@@ -0,0 +1,170 @@
+/* *
+ * * @file prueba_mytarlib.c
+ * * @author ISO-2-G10
+ * * @date 16/10/2026
+ * * @brief Consumer of mytarlib.c (see prueba_mytarlib.sh)
+ * * @details Reads with the reader of the library a tar file written by
+ * *          GNU tar (prueba_mytarlib.sh) and checks the data of the buffers
+ * *          around the block sizes that it holds (written by "patron"). It
+ * *          also lists any tar file with the reader, to compare it with
+ * *          GNU tar.
+ * * */
+/*
+USO
+       prueba_mytarlib comprueba fichero.tar    ("-": la entrada estandar)
+       prueba_mytarlib lista fichero.tar
+       prueba_mytarlib cabeceras fichero.tar
+       prueba_mytarlib patron tam
+
+       comprueba  lee con el lector los buffers/b<tam> de fichero.tar (los
+                tamanios de TamaniosPrueba, con el contenido de "patron
+                tam") y comprueba sus datos; los demas miembros se saltan
+       lista    escribe "nombre tam" de cada miembro, con los bytes leidos
+                con DatosMytar
+       cabeceras  escribe el nombre de cada miembro (los datos se saltan,
+                como en targ10 -t)
+       patron   escribe en stdout los tam bytes de buffers/b<tam>
+
+       Termina con 0, o con el codigo de error de s_mytarheader.h.
+
+COMPILACION
+       gcc -O2 -o prueba_mytarlib prueba_mytarlib.c ../mytarlib.c -lpthread
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../s_mytarlib.h"
+
+// around a block (512), the blocking factor (10240) and a mapping piece
+static const unsigned long long TamaniosPrueba[] = {0, 1, 511, 512, 513, 10239, 10240, 10241, 1048576 + 7};
+#define NUM_TAMANIOS (sizeof(TamaniosPrueba) / sizeof(TamaniosPrueba[0]))
+
+// Bytes of buffers/b<tam>: not a repeated block, so a misplaced piece is seen
+void Patron(char *buff, unsigned long long tam)
+{
+    unsigned long long i;
+
+    for (i = 0; i < tam; i++)
+        buff[i] = (char)((i * 131 + tam) % 251);
+}
+
+// Check the data of the buffers/b<tam> members of f_mytar
+int Comprueba(char *f_mytar)
+{
+    struct lector_mytar lector;
+    const struct c_header_gnu_tar *pheaderData;
+    char *esperado;
+    const char *trozo;
+    unsigned long long tam, leidos;
+    unsigned int buffers = 0;
+    long n;
+    int fd = 0, ret = 0;
+
+    if ((esperado = malloc(TamaniosPrueba[NUM_TAMANIOS - 1])) == NULL)
+        return ERROR_OPEN_TAR_FILE;
+    if (strcmp(f_mytar, "-") != 0 && (fd = open(f_mytar, O_RDONLY)) == -1)
+    {
+        fprintf(stderr, "No se puede abrir el fichero tar %s\n", f_mytar);
+        free(esperado);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    if ((ret = AbreLectorMytar(&lector, fd, DEFAULT_BLOCKING_FACTOR)) != 0)
+    {
+        free(esperado);
+        return ret;
+    }
+    while ((pheaderData = SiguienteCabeceraMytar(&lector)) != NULL)
+    {
+        if (strncmp(pheaderData->name, "buffers/b", 9) != 0)
+            continue; // the data is skipped
+        tam = strtoull(pheaderData->name + 9, NULL, 10);
+        if (tam > TamaniosPrueba[NUM_TAMANIOS - 1])
+            continue;
+        Patron(esperado, tam);
+        for (leidos = 0; (n = DatosMytar(&lector, &trozo)) > 0; leidos += n)
+            if (leidos + n > tam || memcmp(trozo, esperado + leidos, n) != 0)
+                break;
+        if (n != 0 || leidos != tam)
+        {
+            fprintf(stderr, "Datos erroneos en %.100s (%llu bytes)\n", pheaderData->name, leidos);
+            ret = ERROR_BAD_HEADER;
+        }
+        buffers++;
+    }
+    if (ret == 0 && (ret = lector.error) == 0 && buffers != NUM_TAMANIOS)
+    {
+        fprintf(stderr, "%u buffers en %s, se esperaban %u\n", buffers, f_mytar, (unsigned int)NUM_TAMANIOS);
+        ret = ERROR_MEMBER_NOT_FOUND;
+    }
+    CierraLectorMytar(&lector);
+    if (fd != 0)
+        close(fd);
+    free(esperado);
+    if (ret == 0)
+        printf("OK: %s, %u buffers\n", f_mytar, buffers);
+    return ret;
+}
+
+// List f_mytar; with datos the data of each member is read and counted
+int Lista(char *f_mytar, int datos)
+{
+    struct lector_mytar lector;
+    const struct c_header_gnu_tar *pheaderData;
+    unsigned long long leidos;
+    const char *trozo;
+    long n;
+    int fd = 0, ret;
+
+    if (strcmp(f_mytar, "-") != 0 && (fd = open(f_mytar, O_RDONLY)) == -1)
+    {
+        fprintf(stderr, "No se puede abrir el fichero tar %s\n", f_mytar);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    if ((ret = AbreLectorMytar(&lector, fd, DEFAULT_BLOCKING_FACTOR)) != 0)
+        return ret;
+    while ((pheaderData = SiguienteCabeceraMytar(&lector)) != NULL)
+    {
+        if (!datos)
+        {
+            printf("%.100s\n", pheaderData->name);
+            continue;
+        }
+        for (leidos = 0; (n = DatosMytar(&lector, &trozo)) > 0; leidos += n)
+            ;
+        printf("%.100s %llu\n", pheaderData->name, leidos);
+    }
+    ret = lector.error;
+    CierraLectorMytar(&lector);
+    if (fd != 0)
+        close(fd);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long tam;
+    char *buff;
+
+    if (argc == 3 && strcmp(argv[1], "comprueba") == 0)
+        return Comprueba(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "lista") == 0)
+        return Lista(argv[2], 1);
+    if (argc == 3 && strcmp(argv[1], "cabeceras") == 0)
+        return Lista(argv[2], 0);
+    if (argc == 3 && strcmp(argv[1], "patron") == 0)
+    {
+        tam = strtoull(argv[2], NULL, 10);
+        if ((buff = malloc(tam + 1)) == NULL)
+            return 1;
+        Patron(buff, tam);
+        fwrite(buff, 1, tam, stdout);
+        free(buff);
+        return 0;
+    }
+    fprintf(stderr, "Uso: %s comprueba fichero.tar | lista fichero.tar | cabeceras fichero.tar | patron tam\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,72 @@
+#!/bin/bash
+# Prueba de mytarlib.c contra GNU tar
+#
+# USO
+#   bench/prueba_mytarlib.sh [-d directorio]
+#
+#   -d      directorio de trabajo, por defecto ${TMPDIR:-/tmp}/mytarlib-prueba
+#
+# Un tar de GNU tar (fichero y tuberia) se lista con el lector de la
+# biblioteca y se compara con tar -tv, y los datos de sus buffers (escritos
+# con prueba_mytarlib patron) se comprueban con el lector. Termina con 0 si
+# todo coincide.
+
+TRABAJO=${TMPDIR:-/tmp}/mytarlib-prueba
+while getopts "d:" opcion; do
+    case $opcion in
+    d) TRABAJO=$OPTARG ;;
+    *)
+        echo "Uso: $0 [-d directorio]" >&2
+        exit 1
+        ;;
+    esac
+done
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+RAIZ=$(dirname "$BENCH")
+rm -rf "$TRABAJO" && mkdir -p "$TRABAJO" && cd "$TRABAJO" || exit 1
+
+gcc -O2 -Wall -o prueba_mytarlib "$BENCH/prueba_mytarlib.c" "$RAIZ/mytarlib.c" -lpthread || exit 1
+
+FALLOS=0
+falla() {
+    echo "FALLO: $*"
+    FALLOS=$((FALLOS + 1))
+}
+
+# the sources: buffers around the block sizes, files, an empty one, a
+# directory and a symbolic link
+mkdir -p buffers origen/dir
+for tam in 0 1 511 512 513 10239 10240 10241 1048583; do
+    ./prueba_mytarlib patron $tam >buffers/b$tam
+done
+head -c 700 /dev/urandom >origen/f700
+head -c 20480 /dev/urandom >origen/f20480
+: >origen/vacio
+ln -s f700 origen/enlace
+
+# GNU tar -> reader (regular file, mapped, and pipe)
+tar -cf gnu.tar origen buffers
+tar -tvf gnu.tar | awk '{ print $6, ($1 ~ /^[dl]/) ? 0 : $3 }' >esperado.txt
+./prueba_mytarlib lista gnu.tar >leido.txt || falla "lista gnu.tar ($?)"
+cmp -s esperado.txt leido.txt || falla "lista gnu.tar distinta de tar -tv"
+cat gnu.tar | ./prueba_mytarlib lista - >leido.txt || falla "lista - ($?)"
+cmp -s esperado.txt leido.txt || falla "lista - distinta de tar -tv"
+./prueba_mytarlib comprueba gnu.tar || falla "comprueba gnu.tar ($?)"
+./prueba_mytarlib comprueba - <gnu.tar || falla "comprueba - ($?)"
+
+# a tar file truncated in the data of buffers/b1048583 is an error of the
+# reader, whether the data is read or skipped
+tar -cf grande.tar buffers/b1048583
+head -c 600000 grande.tar >truncado.tar
+for modo in lista cabeceras; do
+    ./prueba_mytarlib $modo truncado.tar >/dev/null && falla "$modo truncado.tar sin error"
+    ./prueba_mytarlib $modo - <truncado.tar >/dev/null && falla "$modo truncado.tar (tuberia) sin error"
+done
+
+if [ $FALLOS = 0 ]; then
+    echo "OK: mytarlib coincide con GNU tar"
+else
+    echo "$FALLOS fallos"
+fi
+[ $FALLOS = 0 ]
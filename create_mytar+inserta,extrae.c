@@ -10,11 +10,86 @@
 FUNCIONALIDAD PARA CREAR E INSERTAR
 USO
        inserta_fichero->crea un fichero del tar o inserta en uno.
-       targ10 fichero archivo.tar
+       targ10 [opciones] fichero archivo.tar
+
+       -i  crea (o actualiza) el indice de miembros archivo.tar.idx
+           (nombre -> offset de la cabecera, tamanio, typeflag). Si el
+           indice ya existe se actualiza siempre.
+       -b  factor de bloqueo: numero de bloques de 512 bytes que se agrupan en
+           cada escritura (y lectura al extraer). Debe ser multiplo de 20 (el
+           registro de 10KB del tar). Por defecto DEFAULT_BLOCKING_FACTOR.
+       -m  lee el fichero tar proyectandolo en memoria (mmap) en lugar de
+           read()+lseek: las cabeceras se recorren en el sitio y los datos
+           se extraen escribiendo directamente desde la proyeccion.
+       -j  numero de hilos que, si f_dat es un directorio, construyen las
+           cabeceras y leen los ficheros por adelantado mientras un unico
+           escritor los añade al tar en el orden de readdir. La memoria de
+           los ficheros leidos por adelantado esta limitada a
+           PREFETCH_MAX_MEMORY bytes.
+       -z  comprime el tar (solo al crearlo): el tar se corta en marcos de
+           GZIP_FRAME_SIZE bytes que se comprimen en paralelo (un hilo por
+           CPU, o -j hilos) como miembros gzip independientes. El resultado
+           se descomprime con gzip/tar -z, y al extraer solo se descomprimen
+           los marcos que contienen los elementos pedidos (en paralelo).
+       -g  archivo incremental: el fichero snapshot guarda el dispositivo,
+           inodo, fecha de modificacion y tamaño de cada nombre. Si existe,
+           solo se añaden los elementos nuevos o modificados (los
+           directorios siempre) y en el elemento f_dat/SNAPSHOT_DELETED_NAME
+           los nombres que ya no existen (uno por linea). Despues se guarda
+           el snapshot de esta ejecucion (ver c_snapshot_entry).
+       -u  E/S con io_uring: los ficheros regulares de hasta URING_MAX_FILE
+           bytes se leen (al añadir un directorio sin -j) o se crean y
+           escriben (al extraer) en lotes de URING_DEPTH ficheros, con
+           open + read/write + close enlazados en el anillo. Si el kernel
+           no tiene io_uring se usa la E/S sincrona.
+       -d  deduplica: el contenido de cada fichero regular se resume (hash
+           de 64 bits) mientras se escribe; si coincide con el de un fichero
+           anterior (y sus bytes son iguales) se guarda como enlace duro a
+           ese fichero (typeflag '1', sin datos). Se recuerdan como mucho
+           DEDUP_TABLE_ENTRIES ficheros y al final se indican los bytes
+           ahorrados.
+       -v  trazas (-v, -vv o -vvv: elementos, operaciones de cada elemento,
+           bloques de datos). Solo en un ejecutable compilado con -DTRAZAS;
+           sin TRAZAS las trazas no se compilan y -v no hace nada.
+       --stats[=texto|json]
+           al terminar se escriben en stderr, por fases (stat, cabecera,
+           datos, relleno, extraccion), el tiempo, los bytes, las llamadas
+           al sistema, los ficheros y los ficheros/s y MB/s. Con -j el
+           tiempo de una fase es la suma del de sus hilos. Vale tambien
+           con -e, -x y -t.
+       --io=normal|nocache|directo
+           politica de E/S al añadir, para no llenar la cache de paginas
+           (y echar de ella los datos de otros procesos) al archivar
+           muchos datos. nocache: los ficheros añadidos se leen con
+           posix_fadvise(SEQUENTIAL) y sus paginas se sueltan
+           (DONTNEED) al terminar cada uno; las paginas del tar se
+           escriben a disco (sync_file_range) y se sueltan cada buffer
+           de escritura; y el tar se preasigna con fallocate con la suma
+           de los tamaños de los elementos (un recorrido previo del arbol
+           si fichero es un directorio), lo que sobra se libera al final.
+           directo: ademas el tar se escribe con O_DIRECT desde el buffer
+           alineado (los bytes hasta el primer offset alineado a
+           BUFFER_ALIGNMENT y el ultimo trozo van por la cache); el buffer
+           (-b) debe ser de bastantes bloques de 4KB: con -b 20 cada
+           escritura directa es de 8KB. Con nocache y directo los datos
+           no se copian con copy_file_range: pasan por el buffer, para
+           soltar las paginas del fichero leido cada buffer. Solo con
+           un tar en disco (no -z ni "-"); si el sistema de ficheros no
+           admite O_DIRECT se usa nocache. Por defecto normal.
+
+       Si archivo.tar es "-" el tar nuevo se escribe en la salida estandar
+       (por ejemplo una tuberia: targ10 dir - | zstd > dir.tar.zst), solo
+       hacia delante, con el fin de archivo y el relleno a 10KB; los
+       mensajes van a stderr. No vale con -i, y con -d un fichero mayor que
+       el buffer de escritura no se puede sustituir por un enlace.
+
+COMPILACION
+       gcc -o targ10 create_mytar+inserta,extrae.c mytarlib.c -lpthread -lz
+       gcc -DTRAZAS -o targ10 create_mytar+inserta,extrae.c mytarlib.c -lpthread -lz   (con trazas, -v)
 
 SINOPSIS
       #include "s_mytarheader.h"
-      unsigned long inserta_fichero(int f_mytar, unsigned long tamano, char *filename);
+      unsigned long inserta_fichero(int f_mytar, unsigned long long tamano, char *filename);
 
 DESCRIPCIÓN
 
@@ -35,10 +110,19 @@ DESCRIPCIÓN
 
       Debe introducir primero un elemento de nombre f_dat pero sin datos. Es decir solo se
       añade la información de c_header_gnu_tar correspondiente a f_dat (no se añaden datos).
-      Seguido, la función debe introducir en f_mytar todos los fichero regulares
-      contenidos en el directorio f_dat (solo en el primer nivel del directorio f_dat)
-      Los nombres de los ficheros que se introduzcan tendrán el formato f_dat/xxx donde xxx
-      es el nombre de cada fichero regular encontrado.
+      Seguido, la función debe introducir en f_mytar todo el arbol contenido en el
+      directorio f_dat (recursivamente, cada directorio antes de su contenido).
+      Los nombres de los ficheros que se introduzcan tendrán el formato f_dat/xxx/yyy donde
+      xxx/yyy es la ruta de cada elemento encontrado. Los nombres de 100 caracteres o mas
+      no caben en c_header_gnu_tar y no se incluyen.
+      El arbol se recorre con getdents64 y openat/fstatat relativos al descriptor de
+      cada directorio (un solo stat por elemento).
+
+      Si un fichero regular tiene huecos (ocupa menos bloques que su tamaño), sus
+      regiones de datos se buscan con lseek SEEK_DATA/SEEK_HOLE y se guarda como
+      un elemento disperso de gnu tar (typeflag 'S', ver c_sparse_gnu_tar): solo
+      se guardan los datos y el mapa de regiones. Al extraerlo se vuelven a crear
+      los huecos.
 
       Si f_dat es un enlace simbolico:
 
@@ -60,14 +144,101 @@ ERRORES
         E_TARFORM (-3) 
            f_mytar no tiene el formato de gnu tar.
 
+FUNCIONALIDAD DE BORRAR Y REEMPLAZAR
+NOMBRE
+      borra_fichero->borra un elemento del tar
+      reemplaza_fichero->sustituye un elemento del tar por un fichero
+      targ10 [-i] [-b factor] --delete nombre archivo.tar
+      targ10 [-i] [-b factor] --replace nombre fichero archivo.tar
+
+SINOPSIS
+      #include "s_mytarheader.h"
+      int borra_fichero(char * f_mytar, char * name);
+      int reemplaza_fichero(char * f_mytar, char * name, char * f_dat);
+
+DESCRIPCIÓN
+      Se quita del tar, sin copiarlo, el primer elemento de nombre name
+      (cabecera y datos): si su tamaño es multiplo del bloque del sistema
+      de ficheros sus bloques se eliminan con
+      fallocate(FALLOC_FL_COLLAPSE_RANGE); si no (o el sistema de ficheros
+      no lo permite), lo que le sigue se mueve hacia atras en una sola
+      pasada con bloques de -b bloques. Despues se escriben de nuevo los
+      bloques de fin de archivo y el relleno a 10KB. reemplaza_fichero
+      añade f_dat (con el nombre name) al final del tar, antes del fin de
+      archivo. El indice, si existe, se actualiza. Un tar comprimido (-z)
+      no se puede modificar.
+
+ERRORES
+       ERROR_MEMBER_NOT_FOUND (6)
+           name no esta en f_mytar.
+
+FUNCIONALIDAD DE ORDENES POR LOTES
+NOMBRE
+      procesa_lote->ejecuta sobre el tar las ordenes de un fichero
+      targ10 [-i] [-d] [-u] [-g snapshot] [-j hilos] [-b factor] --batch ordenes|- archivo.tar
+
+SINOPSIS
+      #include "s_mytarheader.h"
+      int procesa_lote(char * f_mytar, char * f_ordenes);
+
+DESCRIPCIÓN
+      Lee de f_ordenes (o de la entrada estandar si es "-") una orden por
+      linea (las lineas vacias o que empiezan por # no cuentan):
+          add fichero       añade fichero (o el arbol de un directorio)
+          extract nombre    extrae el elemento nombre
+          list              lista los elementos, como -t
+      El tar se abre (o se crea) y su fin se busca una sola vez, la tabla de
+      elementos (el indice) se mantiene en memoria y los bloques de fin de
+      archivo y el relleno a 10KB se escriben una sola vez, tras la ultima
+      orden: 10000 add cuestan una pasada y no 10000. extract busca el
+      elemento en la tabla (el primero con ese nombre) y lo lee con otro
+      descriptor. El indice .idx se guarda si existia o con -i. No vale con
+      -z ni con un tar "-".
+
+VALOR DE RETORNO
+       Cero, o el error de la primera orden que falla (las siguientes se
+       ejecutan igualmente salvo que no se pueda escribir el tar).
+
+FUNCIONALIDAD DE LISTAR
+NOMBRE
+      lista_tar->lista los elementos del tar
+      targ10 -t archivo.tar
+
+SINOPSIS
+      #include "s_mytarheader.h"
+      int lista_tar(char * f_mytar);
+
+DESCRIPCIÓN
+      Recorre solo las cabeceras de f_mytar (proyectado en memoria, los datos se
+      saltan) e imprime de cada elemento el tipo y los permisos, usuario/grupo,
+      tamaño, fecha de modificacion y nombre, como tar -tv. Antes de usar una
+      cabecera se comprueba su magic y su checksum (la suma de los 512 bytes se
+      hace con SSE2 o AVX2 si la CPU lo permite).
+
+ERRORES
+       ERROR_BAD_HEADER (7)
+           Una cabecera no es de gnu tar o su checksum no es correcto.
+
 FUNCIONALIDAD DE EXTRAER
 NOMBRE
       extrae_fichero->extrae un fichero del tar
-      targ10 fichero archivo.tar
+      extrae_ficheros->extrae varios ficheros del tar en una sola pasada
+      targ10 [-m] [-u] [-j hilos] [-b factor] -e [-T lista] fichero... archivo.tar
+
+      Cada fichero puede ser un nombre o un patron con comodines (*, ? y [],
+      ver fnmatch). -T lista añade los nombres (o patrones) del fichero
+      lista, uno por linea.
+
+      Con -e, -x y -t, archivo.tar "-" es la entrada estandar. Si es una
+      tuberia (zstd -dc dir.tar.zst | targ10 -e x -) se lee como un flujo
+      en bloques de -b bloques: los datos que se saltan se leen y se
+      descartan, no se usa el indice y -x extrae con un solo hilo. Un tar
+      de -z se descomprime antes (gzip -dc).
 
 SINOPSIS
       #include "s_mytarheader.h"
       int extrae_fichero(char * f_mytar, char * f_dat);
+      int extrae_ficheros(char * f_mytar, struct seleccion_tar * sel);
 
 DESCRIPCIÓN
       La función extrae_fichero extrae un fichero (o directorio) del fichero 
@@ -100,11 +271,49 @@ VALOR DE RETORNO
        no creará el fichero a extraer (cualquier caso) y (en caso de error de apertura unicamente)retornará los errores 
        indicados en el apartado de ERRORES.
 
+      extrae_ficheros recorre f_mytar una sola vez: los nombres pedidos estan en
+      una tabla hash y se extraen todos los elementos cuyo nombre esta en ella
+      (solo el primero con cada nombre) o cumple algun patron. Si no hay
+      patrones, el recorrido termina al encontrar todos los nombres. Al final
+      se indican los nombres y patrones que no estan en f_mytar.
+
+INDICE
+       Si existe f_mytar.idx y se pide un solo nombre, extrae_fichero busca f_dat en su tabla hash y salta
+       directamente a la cabecera indicada. La cabecera leida se compara con la
+       entrada del indice; si no coincide (indice desactualizado) o f_dat no esta
+       en el indice, se recorre f_mytar desde el principio.
+
 ERRORES
        E_OPEN      (-1) 
            No se puede abrir f_mytar.
+       ERROR_MEMBER_NOT_FOUND (6)
+           Algun nombre o patron pedido no esta en f_mytar.
+
+FUNCIONALIDAD DE EXTRAER TODO
+NOMBRE
+      extrae_todo->extrae todos los elementos del tar
+      targ10 [-m] [-j hilos] [-b factor] -x archivo.tar
+
+SINOPSIS
+      #include "s_mytarheader.h"
+      int extrae_todo(char * f_mytar);
+
+DESCRIPCIÓN
+      Un lector recorre las cabeceras de f_mytar en orden y crea los
+      directorios (cada uno una sola vez, los padres antes que los hijos).
+      Los ficheros regulares, dispersos y enlaces simbolicos se reparten
+      entre -j hilos (1 por defecto), que copian sus datos desde su offset
+      en f_mytar (copy_file_range/pread, o la proyeccion con -m) y restauran
+      propietario y permisos. Los enlaces duros se crean cuando los hilos
+      terminan, y los permisos de los directorios creados al final. Si un
+      nombre se repite gana el ultimo elemento. Un tar comprimido (-z) se
+      extrae solo con el lector.
+
+VALOR DE RETORNO
+       Cero, o el primer error (ERROR_OPEN_TAR_FILE, ERROR_OPEN_DAT_FILE).
 
 */
+#define _GNU_SOURCE
 #include <dirent.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -116,8 +325,23 @@ ERRORES
 #include <strings.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <zlib.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 #include "s_mytarheader.h"
+#include "s_mytarcodec.h"
+#include "s_mytarlib.h"
 
 // #define ERROR_OPEN_DAT_FILE (2)
 // #define ERROR_OPEN_TAR_FILE (3)
@@ -127,608 +351,5941 @@ ERRORES
 // #define HEADER_OK (1)
 // #define HEADER_ERR (2)
 
-struct passwd *pws;
-struct group *grp;
-char *myDir;
+// ----------------------------------------------------------------
+// Traces. TRAZA(nivel, ...) is a printf only in a build with -DTRAZAS and
+// if -v was given at least nivel times (1: members, 2: operations of each
+// member, 3: blocks of data). Without TRAZAS it is compiled out (the
+// arguments are checked by the compiler but never evaluated).
+#ifdef TRAZAS
+int NivelTraza = 0; // -v, -vv, -vvv
+#define TRAZA_ACTIVA(nivel) (NivelTraza >= (nivel))
+#else
+#define TRAZA_ACTIVA(nivel) (0)
+#endif
+#define TRAZA(nivel, ...)            \
+    do                               \
+    {                                \
+        if (TRAZA_ACTIVA(nivel))     \
+            printf(__VA_ARGS__);     \
+    } while (0)
 
-char FileDataBlock[DATAFILE_BLOCK_SIZE];
+// ----------------------------------------------------------------
+// Performance counters (--stats): time, bytes, system calls and files of
+// each phase. The time of a phase is measured per thread between
+// EntraFase and SaleFase; a phase entered inside another one stops the
+// clock of the outer one, so no time is counted twice (with -j the times
+// of the threads are added). System calls are counted in the phase of
+// the thread that makes them.
+#define FASE_STAT (0)       // stat of the entries
+#define FASE_CABECERA (1)   // headers built and written to the buffer
+#define FASE_DATOS (2)      // data of the members to the tar file
+#define FASE_RELLENO (3)    // zeros: last block of a member, end of archive, 10KB record
+#define FASE_EXTRACCION (4) // members created from the tar file
+#define NUM_FASES (5)
 
-//-----------------------------------------------------------------------------
-// Return UserName (string) from uid (integer). See man 2 stat and man getpwuid
-char *getUserName(uid_t uid)
+static const char *NombreFase[NUM_FASES] = {"stat", "cabecera", "datos", "relleno", "extraccion"};
+
+struct contador_fase
 {
-    pws = getpwuid(uid);
-    return pws->pw_name;
-}
+    unsigned long long ns, bytes, llamadas, ficheros;
+};
+struct estadisticas_tar
+{
+    int activo;                 // --stats
+    int json;                   // --stats=json
+    unsigned long long inicio;  // clock at the start (ns)
+    struct contador_fase fases[NUM_FASES];
+};
+struct estadisticas_tar Estadisticas;
+__thread int FaseActual = -1;          // phase of this thread (-1: none)
+__thread unsigned long long InicioFase; // clock when FaseActual (re)started
 
-//------------------------------------------------------------------------------
-// Return GroupName (string) from gid (integer). See man 2 stat and man getgrgid
-char *getGroupName(gid_t gid)
+static inline unsigned long long RelojNs(void)
 {
-    grp = getgrgid(gid);
-    return grp->gr_name;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-//----------------------------------------
-// Return Mode type entry  (tar Mode type)
-char mode_tar(mode_t Mode)
+// Enter phase fase. Return the phase to go back to (see SaleFase)
+static inline int EntraFase(int fase)
 {
-    if (S_ISREG(Mode))
-        return '0';
+    int anterior = FaseActual;
+    unsigned long long t;
 
-    if (S_ISLNK(Mode))
-        return '2';
-    if (S_ISCHR(Mode))
-        return '3';
-    if (S_ISBLK(Mode))
-        return '4';
-    if (S_ISDIR(Mode))
-        return '5';
-    if (S_ISFIFO(Mode))
-        return '6';
-    if (S_ISSOCK(Mode))
-        return '7';
-    return '0';
+    if (!Estadisticas.activo)
+        return -1;
+    t = RelojNs();
+    if (anterior >= 0)
+        __atomic_add_fetch(&Estadisticas.fases[anterior].ns, t - InicioFase, __ATOMIC_RELAXED);
+    FaseActual = fase;
+    InicioFase = t;
+    return anterior;
 }
 
-unsigned long writeHeader(int fd_TarFile, struct c_header_gnu_tar *pheaderData)
+// Leave the current phase (bytes and files done in it) and go back to anterior
+static inline void SaleFase(int anterior, unsigned long long bytes, unsigned long ficheros)
 {
-    unsigned long NumWriteBytes;
-    int n = 0;
-    // write the data file (blocks of 512 bytes)
-    NumWriteBytes = 0;
-    printf("Datos Escritos en HEADER:"); // Traza
-    n = write(fd_TarFile, pheaderData, sizeof(struct c_header_gnu_tar));
-    NumWriteBytes = NumWriteBytes + sizeof(struct c_header_gnu_tar); // ojo!!!, no se escriben n
-    printf("--%d -", n);                                             // Traza
+    struct contador_fase *contador;
+    unsigned long long t;
 
-    printf("\n Total :Escritos %ld \n", NumWriteBytes); // Traza
-    return n;
+    if (!Estadisticas.activo || FaseActual < 0)
+        return;
+    t = RelojNs();
+    contador = &Estadisticas.fases[FaseActual];
+    __atomic_add_fetch(&contador->ns, t - InicioFase, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&contador->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&contador->ficheros, ficheros, __ATOMIC_RELAXED);
+    FaseActual = anterior;
+    InicioFase = t;
+}
+
+// n system calls in the current phase
+static inline void CuentaLlamadas(unsigned long n)
+{
+    if (Estadisticas.activo && FaseActual >= 0)
+        __atomic_add_fetch(&Estadisticas.fases[FaseActual].llamadas, n, __ATOMIC_RELAXED);
 }
+
+char *myDir;
+
+// Buffered writer of the tar file (see AbreEscritorTar)
+struct escritor_tar
+{
+    int fd;
+    struct compresor_tar *compresor; // -z: the buffer is compressed (see ComprimeDatosTar)
+    char *buffer;           // BUFFER_ALIGNMENT aligned
+    unsigned long tam;      // size of buffer (FactorBloqueo blocks)
+    unsigned long usados;   // bytes of buffer pending to write
+    unsigned long ceros;    // zero bytes pending to write after buffer
+    unsigned long long pos; // offset in the tar file (including pending bytes)
+    int truncar;            // bytes after pos were discarded (see RetrocedeEscritorTar)
+    int directo;            // --io=directo: aligned buffers written with O_DIRECT
+    int soltar;             // --io: written pages dropped from the page cache
+    unsigned long long iniciado, soltado; // offsets: writeback started, pages dropped
+    int error;              // a write failed: nothing else is written (see FallaEscritorTar)
+};
+struct escritor_tar EscritorTar;
+unsigned long FactorBloqueo = DEFAULT_BLOCKING_FACTOR;
+int CopiaDirecta = 1; // member data with copy_file_range/sendfile
+
+// I/O policy (--io)
+#define IO_NORMAL (0)  // page cache
+#define IO_NOCACHE (1) // sources and tar file dropped from the page cache, tar file preallocated
+#define IO_DIRECTO (2) // as IO_NOCACHE, and the tar file written with O_DIRECT
+int PoliticaIO = IO_NORMAL;
+int Deduplicar = 0;   // -d: identical files as hard links (see EnlazaDuplicado)
+
+// Reader of the tar file (see AbreLectorTar)
+#define LECTOR_READ (0)
+#define LECTOR_MMAP (1)
+#define LECTOR_GZIP (2)
+#define LECTOR_FLUJO (3)
+
+// Map of a sparse file (see s_mytarheader.h)
+struct entrada_dispersa
+{
+    unsigned long long offset, tam;
+};
+struct mapa_disperso
+{
+    struct entrada_dispersa *entradas;
+    unsigned long num, cap;
+    unsigned long long datos; // bytes of the data regions
+    unsigned long long real;  // size of the file
+};
+
+struct lector_tar
+{
+    int fd;
+    int modo;                         // LECTOR_READ, LECTOR_MMAP, LECTOR_GZIP or LECTOR_FLUJO
+    const char *mapa;                 // LECTOR_MMAP: the tar file
+    unsigned long long tam;           // LECTOR_MMAP: size of mapa
+    struct descompresor_tar *gz;      // LECTOR_GZIP: frames of the tar file
+    char *buffer;                     // LECTOR_FLUJO: bytes read from the pipe
+    unsigned long tamBuffer;          // LECTOR_FLUJO: size of buffer
+    unsigned long inicioBuffer;       // LECTOR_FLUJO: first byte of buffer not consumed
+    unsigned long finBuffer;          // LECTOR_FLUJO: bytes of buffer
+    unsigned long long pos;           // offset in the tar file
+    struct c_header_gnu_tar cabecera; // LECTOR_READ: last header read
+    struct mapa_disperso disperso;    // map of the last header if it is sparse ('S')
+};
+
+// Compression (-z): frames of the tar stream compressed by a pool of threads
+struct marco_tar
+{
+    char *entrada;               // GZIP_FRAME_SIZE bytes of the tar stream
+    unsigned long tamEntrada;
+    char *salida;                // gzip member
+    unsigned long tamSalida, capSalida;
+    int estado;                  // MARCO_LIBRE, MARCO_LLENO, MARCO_COMPRIMIDO, MARCO_ERROR
+};
+struct compresor_tar
+{
+    int fd;
+    struct marco_tar *marcos;    // ring of 2 frames per thread
+    unsigned int num;
+    unsigned long llenos;        // frames given to the threads
+    unsigned long tomados;       // frames taken by the threads
+    unsigned long escritos;      // frames written
+    unsigned long long bytesEntrada, bytesSalida;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t *hilos;
+    unsigned int numHilos, lanzados;
+    int fin;
+};
+struct compresor_tar CompresorTar;
+int Comprimir = 0; // -z
+
+// Decompression of a tar written with -z (LECTOR_GZIP)
+struct marco_gz
+{
+    unsigned long long coff, uoff; // offset of the frame in the file and in the tar stream
+    unsigned long csize, usize;
+};
+struct ranura_gz
+{
+    unsigned long marco;         // frame in the slot
+    int estado;                  // RANURA_VACIA, RANURA_EN_CURSO, RANURA_LISTA, RANURA_ERROR
+    char *datos;                 // decompressed frame
+    char *comprimido;
+};
+struct descompresor_tar
+{
+    int fd;
+    struct marco_gz *marcos;
+    unsigned long num, maxComprimido;
+    unsigned long long tam;      // size of the tar stream
+    struct ranura_gz *ranuras;   // frame k in ranuras[k % numRanuras]
+    unsigned int numRanuras;
+    unsigned long base;          // frame being read
+    unsigned long siguiente;     // next frame for the threads
+    unsigned long limite;        // the threads decompress frames < limite
+    unsigned int ocupados;       // frames being decompressed
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t *hilos;
+    unsigned int lanzados;
+    int fin;
+};
+int ModoLector = LECTOR_READ;
+unsigned int Hilos = 1;              // worker threads for directories (-j)
+pthread_mutex_t MutexNombres = PTHREAD_MUTEX_INITIALIZER; // caches of names, getpwuid/getgrgid
+
+// Cache of user/group names (see getUserName)
+struct entrada_cache
+{
+    unsigned int id;
+    char nombre[32]; // same size as uname/gname
+    char usado;      // slot in use
+    char conocido;   // the id (name) exists
+};
+struct cache_nombres
+{
+    struct entrada_cache *tabla; // open addressing hash table
+    unsigned long tam, num;
+    unsigned long aciertos, fallos;
+    int porNombre; // key: nombre (1) or id (0)
+};
+struct cache_nombres CacheUsuarios, CacheGrupos;
+struct cache_nombres CacheUids = {.porNombre = 1}, CacheGids = {.porNombre = 1};
+
+// Member index of the tar file being written (see s_mytarheader.h)
+struct indice_tar
+{
+    struct c_index_tar_entry *entradas;
+    unsigned long num, cap;
+    unsigned long *tabla; // hash table: position+1 of the entry (0 = free)
+    unsigned long tam_tabla;
+    unsigned long long fin; // offset of the end of archive entry
+    int activo;
+};
+struct indice_tar IndiceTar;
+
+// Deduplication (-d): hash of the contents of a file, computed while it is
+// written (see ActualizaHashDedup)
+struct hash_dedup
+{
+    unsigned long long h;
+    unsigned long long tam;  // bytes hashed
+    unsigned char resto[8];  // bytes that do not fill a word yet
+    unsigned int numResto;
+};
+// Files already stored, DEDUP_WAYS entries per slot of the hash
+struct entrada_dedup
+{
+    unsigned long long hash, tam;
+    char name[100];          // name of the member (as the header)
+    char usado;
+};
+struct tabla_dedup
+{
+    struct entrada_dedup *entradas; // DEDUP_TABLE_ENTRIES
+    unsigned long reemplazo;        // round robin of the entries replaced
+    unsigned long enlaces, descartados, distintos;
+    unsigned long long ahorrados;   // bytes of data not stored
+};
+struct tabla_dedup TablaDedup;
+
+// Incremental archive (-g): snapshot of the previous run (mapped, see
+// s_mytarheader.h) and entries of this run
+struct snapshot_tar
+{
+    const char *mapa;                          // previous snapshot (NULL if none)
+    size_t tamMapa;
+    const struct c_snapshot_entry *anteriores;
+    const char *nombresAnteriores;
+    unsigned long long numAnteriores;
+    unsigned char *vistos;                     // bitmap of the previous entries found
+    struct c_snapshot_entry *entradas;         // this run
+    unsigned long long num, cap;
+    char *nombres;
+    unsigned long long tamNombres, capNombres;
+    unsigned long cambiados, iguales, borrados;
+    pthread_mutex_t mutex;
+    int activo;
+};
+struct snapshot_tar Snapshot = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+// io_uring (-u): ring set up with the system calls (see AbreAnilloTar)
+struct anillo_tar
+{
+    int fd;
+    unsigned int *sqCabeza, *sqCola, *sqMascara, *sqArray;
+    unsigned int *cqCabeza, *cqCola, *cqMascara;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqMapa, *cqMapa;
+    size_t tamSqMapa, tamCqMapa, tamSqes;
+    unsigned int cola;      // next sqe (not published yet)
+    unsigned int pendientes; // sqes not submitted
+    unsigned int enVuelo;    // submitted without completion
+};
+// A file of a batch: open + read/write + close, linked in the ring
+struct op_uring
+{
+    struct c_header_gnu_tar cabecera;
+    char nombre[256];        // extraction: path of the file; insertion: name in dir
+    struct dir_ref *dir;     // insertion: directory of nombre
+    const char *datos;       // extraction: data of the file
+    char *buffer;            // URING_MAX_FILE bytes
+    unsigned long long tam;
+    int resAbre, resDatos;   // results of open and read/write
+};
+struct lote_uring
+{
+    struct anillo_tar anillo;
+    struct op_uring *ops;    // URING_DEPTH files (the fixed file i+1 is used by ops[i])
+    unsigned int num;
+    unsigned long ficheros, sincronos; // files of the batches, and redone by the synchronous path
+    int activo;              // the ring is available
+    mode_t mascara;          // umask (the mode of the new files)
+};
+struct lote_uring LoteUring;
+int UsarUring = 0; // -u
+
 // para evitar conflicto de tipos ¿?¿?¿?¿?
-unsigned long WriteFileDataBlocks(int x, int y);
-unsigned long WriteCompleteTarSize(unsigned long TarActualSize, int fd_TarFile);
+unsigned long long WriteFileDataBlocks(int x, int y, unsigned long long tam);
+unsigned long WriteCompleteTarSize(unsigned long long TarActualSize, int fd_TarFile);
+int VerifyCompleteTarSize(unsigned long long TarActualSize);
 unsigned long WriteEndTarArchive(int fd_TarFile);
+int IndiceAniade(struct indice_tar *indice, unsigned long long offset, const struct c_header_gnu_tar *pheaderData);
+struct c_index_tar_entry *IndiceBusca(struct indice_tar *indice, const char *name);
+void LiberaIndiceTar(struct indice_tar *indice);
+unsigned long long CopiaDatosDirecta(int fd_in, int fd_out, unsigned long long tam);
+int CargaIndiceTar(char *TarFileName, struct indice_tar *indice);
+int BuilTarHeader(char *FileName, struct c_header_gnu_tar *pTarHeader);
+unsigned long HashNombre(const char *name);
+int EscribeTodo(int fd, const char *buff, unsigned long long n);
+int ConstruyeCabeceraTar(const char *FileName, const struct stat *pStat, int dirfd, const char *LinkPath, struct c_header_gnu_tar *pTarHeader);
+int AniadeEntradaDispersa(struct mapa_disperso *mapa, unsigned long long offset, unsigned long long tam);
+void LiberaMapaDisperso(struct mapa_disperso *mapa);
+unsigned long long EscribeFicheroTar(int f_mytar, int f_dat, struct c_header_gnu_tar *pTarHeader, const struct stat *pStat);
+unsigned long long EscribeDatosFichero(int fd_DataFile, unsigned long long tam, struct hash_dedup *hash);
+unsigned long RellenaBloqueTar(unsigned long long tam);
+int CreaMiembro(struct lector_tar *lector, const struct c_header_gnu_tar *cabeceraTar, char *f_dat);
+void IniciaHashDedup(struct hash_dedup *hash);
+void ActualizaHashDedup(struct hash_dedup *hash, const char *datos, unsigned long n);
+int EnlazaDuplicado(int f_mytar, struct c_header_gnu_tar *pTarHeader, int f_dat, const char *datos,
+                    struct hash_dedup *hash, unsigned long long inicio);
+int CambiadoSnapshot(struct snapshot_tar *snap, const char *ruta, const struct stat *st);
+void CierraAnilloTar(struct anillo_tar *anillo);
+void CierraLoteUring(struct lote_uring *lote);
+int VaciaExtraccionUring(struct lote_uring *lote);
+int VaciaInsercionUring(struct lote_uring *lote, int f_mytar);
+int LeeDatosLector(struct lector_tar *lector, char *buff, unsigned long long tam);
+int CreaRutaPadre(const char *f_dat);
+void RestauraPropietario(const struct c_header_gnu_tar *pheaderData, const char *f_dat);
+int BorradosSnapshot(struct snapshot_tar *snap, int f_mytar, const char *raiz, const struct stat *stRaiz);
 
-unsigned long inserta_fichero(int f_mytar, unsigned long tamano, char *filename)
-{
-    int ret, f_dat, tam;
-    unsigned long tamanoEscrito, n;
-    long tamanio;
-    long ficheros = 0;
-    DIR *dir;
-    struct dirent *directoryData;
-    char entryNameAux[256];
-    char linkmode[1] = "2";
-    char linkvacio[100];
-    struct c_header_gnu_tar my_tardat;
-    tamanoEscrito = tamano;
-    struct stat stattest;
-    bzero(linkvacio, 100);
-    int val = 0;
+//-----------------------------------------------------------------------------
+// Caches of uid -> user name, gid -> group name and of the reverse
+// name -> id (to restore the owner when extracting). getpwuid & co. may go
+// through NSS (ldap, sssd...) and cost milliseconds, and a tree has only a
+// few owners. Unknown ids (or names) are cached too, with an empty name.
+// All the functions must be called with MutexNombres locked.
+unsigned long HashCache(struct cache_nombres *cache, unsigned int id, const char *nombre)
+{
+    if (cache->porNombre)
+        return HashNombre(nombre);
+    return id * 2654435761UL;
+}
 
-    // encontrar fin del fichero + mover apuntador
-    if (tamano != 0)
+// Return the entry of id (or nombre), adding an empty one if it is not in
+// the cache (*nueva = 1)
+struct entrada_cache *BuscaCache(struct cache_nombres *cache, unsigned int id, const char *nombre, int *nueva)
+{
+    struct entrada_cache *tabla, *entrada;
+    unsigned long i, pos, tam;
+
+    // grow the table (at most half full)
+    if (2 * (cache->num + 1) > cache->tam)
     {
-        while ((n = read(f_mytar, &my_tardat, sizeof(my_tardat))) > 0)
-        {
-            ficheros += sizeof(my_tardat);
-            sscanf(my_tardat.size, "%011lo", &tamanio);
-            if ((strcmp(my_tardat.magic, "ustar  ") != 0))
-            {
-                break;
-            }
-            else
-            {
-                val += 1;
-                if ((strcmp(my_tardat.typeflag, linkmode) != 0) && (strcmp(my_tardat.typeflag, "5") != 0))
-                {
-                    ficheros += tamanio;
-                    if (tamanio % 512 != 0)
-                    {
-
-                        tamanio += (512 - (tamanio % 512));
-                        ficheros += (tamanio % 512);
-                    }
-                    lseek(f_mytar, tamanio, 1);
-                }
-            }
-        }
-        lseek(f_mytar, (long)(-sizeof(my_tardat)), 1);
-        ficheros += (long)(-sizeof(my_tardat));
-        if (val == 0)
+        tam = (cache->tam == 0) ? 64 : 2 * cache->tam;
+        if ((tabla = calloc(tam, sizeof(struct entrada_cache))) == NULL)
+            return NULL;
+        for (i = 0; i < cache->tam; i++)
         {
-            fprintf(stderr, "Formato erroneo de: %i\n", my_tardat);
-            return -3;
+            if (!cache->tabla[i].usado)
+                continue;
+            pos = HashCache(cache, cache->tabla[i].id, cache->tabla[i].nombre) & (tam - 1);
+            while (tabla[pos].usado)
+                pos = (pos + 1) & (tam - 1);
+            tabla[pos] = cache->tabla[i];
         }
+        free(cache->tabla);
+        cache->tabla = tabla;
+        cache->tam = tam;
     }
-    if ((dir = opendir(filename)) != NULL)
-    {
-        BuilTarHeader(filename, &my_tardat);
-        n = writeHeader(f_mytar, &my_tardat);
-        ficheros += n;
-        while ((directoryData = readdir(dir)) != NULL)
-        {
-            if ((strcmp(directoryData->d_name, "..") != 0) && (strcmp(directoryData->d_name, ".") != 0))
-            {
-                sprintf(entryNameAux, "%s/%s", filename, directoryData->d_name);
-                BuilTarHeader(entryNameAux, &my_tardat);
 
-                ficheros += n;
-                printf("%s\n", entryNameAux);
-                lstat(entryNameAux, &stattest);
-                if (!(S_ISDIR(stattest.st_mode))) // mirar tipo con stat con en el struct dirent
-                {
-                    if (S_ISLNK(stattest.st_mode)) // comprobar si en enlace simbolico
-                    {
-                        n = writeHeader(f_mytar, &my_tardat);
-                    }
-                    else
-                    {
-                        n = writeHeader(f_mytar, &my_tardat);
-                        if ((f_dat = open(entryNameAux, O_RDONLY)) == -1)
-                        {
-                            fprintf(stderr, "No se puede abrir el fichero de datos %s\n", entryNameAux);
-                            return ERROR_OPEN_DAT_FILE;
-                        }
-                        n = WriteFileDataBlocks(f_dat, f_mytar);
-                        ficheros += n;
-                        close(f_dat);
-                    }
-                }
-                else
-                {
-                    n = writeHeader(f_mytar, &my_tardat);
-                    ficheros += n;
-                }
-            }
-        }
-    }
-    else
+    pos = HashCache(cache, id, nombre) & (cache->tam - 1);
+    for (entrada = &cache->tabla[pos]; entrada->usado; entrada = &cache->tabla[pos])
     {
-        // crear header + insertarlo
-        BuilTarHeader(filename, &my_tardat);
-        lstat(filename, &stattest);
-        if (S_ISLNK(stattest.st_mode)) // comprobar si en enlace simbolico
+        if (cache->porNombre ? (strncmp(entrada->nombre, nombre, sizeof(entrada->nombre)) == 0) : (entrada->id == id))
         {
-            n = writeHeader(f_mytar, &my_tardat);
-            ficheros += n;
-        }
-        else
-        {
-            if ((f_dat = open(filename, O_RDONLY)) == -1)
-            {
-                fprintf(stderr, "No se puede abrir el fichero de datos %s\n", filename);
-                return ERROR_OPEN_DAT_FILE;
-            }
-            n = writeHeader(f_mytar, &my_tardat);
-            ficheros += n;
-            // escribir archivo
-            n = WriteFileDataBlocks(f_dat, f_mytar);
-
-            ficheros += n;
-            // escribir final
-            close(f_dat);
+            cache->aciertos++;
+            *nueva = 0;
+            return entrada;
         }
+        pos = (pos + 1) & (cache->tam - 1);
     }
-    tam = WriteEndTarArchive(f_mytar);
+    cache->fallos++;
+    cache->num++;
+    entrada->usado = 1;
+    entrada->id = id;
+    if (cache->porNombre)
+        strncpy(entrada->nombre, nombre, sizeof(entrada->nombre) - 1);
+    *nueva = 1;
+    return entrada;
+}
+
+//-----------------------------------------------------------------------------
+// Copy in UserName (32 chars) the user name of uid (integer). See man 2 stat and man getpwuid
+void getUserName(uid_t uid, char *UserName)
+{
+    struct entrada_cache *entrada;
+    struct passwd *pws;
+    int nueva;
 
-    ficheros += (unsigned long)tam;
-    if (tamanoEscrito != 0)
+    if ((entrada = BuscaCache(&CacheUsuarios, uid, NULL, &nueva)) == NULL)
+        return;
+    if (nueva && (pws = getpwuid(uid)) != NULL)
     {
-        if (tamanoEscrito < ficheros)
-        {
-            tamanoEscrito = tamanoEscrito + (tamanoEscrito - ficheros);
-        }
+        entrada->conocido = 1;
+        strncpy(entrada->nombre, pws->pw_name, sizeof(entrada->nombre) - 1);
     }
-    else
+    strcpy(UserName, entrada->nombre);
+}
+
+//------------------------------------------------------------------------------
+// Copy in GroupName (32 chars) the group name of gid (integer). See man 2 stat and man getgrgid
+void getGroupName(gid_t gid, char *GroupName)
+{
+    struct entrada_cache *entrada;
+    struct group *grp;
+    int nueva;
+
+    if ((entrada = BuscaCache(&CacheGrupos, gid, NULL, &nueva)) == NULL)
+        return;
+    if (nueva && (grp = getgrgid(gid)) != NULL)
     {
-        tamanoEscrito = ficheros;
+        entrada->conocido = 1;
+        strncpy(entrada->nombre, grp->gr_name, sizeof(entrada->nombre) - 1);
     }
+    strcpy(GroupName, entrada->nombre);
+}
 
-    // completar final
-
-    tam = WriteCompleteTarSize(tamanoEscrito, f_mytar);
-    printf("------BBBBBBBBBBBB --> %ld \n", tam);
+//------------------------------------------------------------------------------
+// Return the uid of UserName (DefaultUid if the user does not exist). See man getpwnam
+uid_t getUserId(const char *UserName, uid_t DefaultUid)
+{
+    struct entrada_cache *entrada;
+    struct passwd *pws;
+    int nueva;
 
-    tamanoEscrito += (unsigned long)tam;
-    // comprobar tamaÃ±o
-    ret = VerifyCompleteTarSize((unsigned long)tamanoEscrito);
-    if (ret < 0)
+    if (UserName[0] == '\0' || (entrada = BuscaCache(&CacheUids, 0, UserName, &nueva)) == NULL)
+        return DefaultUid;
+    if (nueva && (pws = getpwnam(entrada->nombre)) != NULL)
     {
-        fprintf(stderr, "Error al generar el fichero tar %d. Tamanio erroneo %ld\n", f_mytar, tamanoEscrito);
-        close(f_dat);
-        close(f_mytar);
-        return ERROR_GENERATE_TAR_FILE2;
+        entrada->conocido = 1;
+        entrada->id = pws->pw_uid;
     }
+    return entrada->conocido ? entrada->id : DefaultUid;
+}
 
-    printf("OK: Generado el fichero tar %d (size=%ld) con el contenido del archivo %d. \n", f_mytar, tamanoEscrito, f_dat);
+//------------------------------------------------------------------------------
+// Return the gid of GroupName (DefaultGid if the group does not exist). See man getgrnam
+gid_t getGroupId(const char *GroupName, gid_t DefaultGid)
+{
+    struct entrada_cache *entrada;
+    struct group *grp;
+    int nueva;
 
-    close(f_mytar);
+    if (GroupName[0] == '\0' || (entrada = BuscaCache(&CacheGids, 0, GroupName, &nueva)) == NULL)
+        return DefaultGid;
+    if (nueva && (grp = getgrnam(entrada->nombre)) != NULL)
+    {
+        entrada->conocido = 1;
+        entrada->id = grp->gr_gid;
+    }
+    return entrada->conocido ? entrada->id : DefaultGid;
+}
 
-    return 0;
+// Hits and misses of the caches of names
+void ImprimeCacheNombres(FILE *salida)
+{
+    pthread_mutex_lock(&MutexNombres);
+    fprintf(salida, "Cache de nombres: uid->usuario %lu aciertos %lu fallos, gid->grupo %lu aciertos %lu fallos, "
+                    "usuario->uid %lu aciertos %lu fallos, grupo->gid %lu aciertos %lu fallos\n",
+            CacheUsuarios.aciertos, CacheUsuarios.fallos, CacheGrupos.aciertos, CacheGrupos.fallos,
+            CacheUids.aciertos, CacheUids.fallos, CacheGids.aciertos, CacheGids.fallos);
+    pthread_mutex_unlock(&MutexNombres);
 }
 
-// ------------------------------------------------------------------------
-// (1.0) Build my_tardat structure with FileName stat info (See man 2 stat)
-int BuilTarHeader(char *FileName, struct c_header_gnu_tar *pTarHeader)
+//----------------------------------------
+// Return Mode type entry  (tar Mode type)
+char mode_tar(mode_t Mode)
 {
-    struct stat stat_file;
+    if (S_ISREG(Mode))
+        return '0';
 
-    ssize_t Symlink_Size;
-    int n, i;
-    char *pTarHeaderBytes;
-    unsigned int Checksum;
+    if (S_ISLNK(Mode))
+        return '2';
+    if (S_ISCHR(Mode))
+        return '3';
+    if (S_ISBLK(Mode))
+        return '4';
+    if (S_ISDIR(Mode))
+        return '5';
+    if (S_ISFIFO(Mode))
+        return '6';
+    if (S_ISSOCK(Mode))
+        return '7';
+    return '0';
+}
 
-    bzero(pTarHeader, sizeof(struct c_header_gnu_tar));
+// Threads to compress or decompress: -j, or one per CPU
+unsigned int NumHilosCompresion(void)
+{
+    long cpus;
 
-    if (lstat(FileName, &stat_file) == -1)
-        return HEADER_ERR;
+    if (Hilos > 1)
+        return Hilos;
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 1) ? cpus : 1;
+}
 
-    strcpy(pTarHeader->name, FileName);
-    sprintf(pTarHeader->mode, "%07o", stat_file.st_mode & 07777);                 // Only  the least significant 12 bits
-    printf("st_mode del archivo %s %07o\n", FileName, stat_file.st_mode & 07777); // Only  the least significant 12 bits
-    sprintf(pTarHeader->uid, "%07o", stat_file.st_uid);
-    sprintf(pTarHeader->gid, "%07o", stat_file.st_gid);
-    sprintf(pTarHeader->size, "%011lo", stat_file.st_size);
-    sprintf(pTarHeader->mtime, "%011lo", stat_file.st_mtime);
-    // checksum  the last     sprintf(pTarHeader->checksum, "%06o", Checksum);
+//----------------------------------------------------------------------------
+// Compression of the tar file (-z). The writer hands its buffer to the
+// compressor, which cuts the tar stream in frames of GZIP_FRAME_SIZE bytes.
+// Each frame is deflated by a pool of threads as an independent gzip member
+// (see s_mytarheader.h) and the members are written in order.
+#define MARCO_LIBRE (0)      // being filled by the writer
+#define MARCO_LLENO (1)      // waiting for a thread
+#define MARCO_COMPRIMIDO (2) // ready to be written
+#define MARCO_ERROR (3)
 
-    pTarHeader->typeflag[0] = mode_tar(stat_file.st_mode);
+// Put the little endian value v in n bytes of p
+void PonLE(unsigned char *p, unsigned long v, int n)
+{
+    int i;
 
-    //  linkname
-    if (S_ISLNK(stat_file.st_mode))
-        Symlink_Size = readlink(FileName, pTarHeader->linkname, 100);
+    for (i = 0; i < n; i++, v >>= 8)
+        p[i] = v & 0xff;
+}
 
-    strncpy(pTarHeader->magic, "ustar ", 6); // "ustar" followed by a space (without null char)
-    strcpy(pTarHeader->version, " ");        //   space character followed by a null char.
-    strcpy(pTarHeader->uname, getUserName(stat_file.st_uid));
-    strcpy(pTarHeader->gname, getGroupName(stat_file.st_gid));
-    //  devmayor (not used)
-    //  devminor (not used)
-    sprintf(pTarHeader->atime, "%011lo", stat_file.st_atime);
-    sprintf(pTarHeader->ctime, "%011lo", stat_file.st_ctime);
-    //  offset (not used)
-    //  longnames (not used)
-    //  unused (not used)
-    //  sparse (not used)
-    //  isextended (not used)
-    //  realsize (not used)
-    //  pad (not used)
+unsigned long LeeLE(const unsigned char *p, int n)
+{
+    unsigned long v = 0;
 
-    // compute checksum (the last)
-    memset(pTarHeader->checksum, ' ', 8); // Initialize to blanc spaces
-    pTarHeaderBytes = (unsigned char *)pTarHeader;
+    while (n-- > 0)
+        v = (v << 8) | p[n];
+    return v;
+}
 
-    for (i = 0, Checksum = 0; i < sizeof(struct c_header_gnu_tar); i++)
-        Checksum = Checksum + pTarHeaderBytes[i];
+// Compress marco (entrada) as a gzip member (salida)
+int ComprimeMarco(z_stream *z, struct marco_tar *marco)
+{
+    unsigned char *salida = (unsigned char *)marco->salida;
+    unsigned long tam;
 
-    sprintf(pTarHeader->checksum, "%06o", Checksum); // six octal digits followed by a null and a space character
+    z->next_in = (unsigned char *)marco->entrada;
+    z->avail_in = marco->tamEntrada;
+    z->next_out = salida + GZIP_FRAME_HEADER;
+    z->avail_out = marco->capSalida - GZIP_FRAME_HEADER - GZIP_FRAME_TRAILER;
+    if (deflateReset(z) != Z_OK || deflate(z, Z_FINISH) != Z_STREAM_END)
+        return -1;
+    tam = GZIP_FRAME_HEADER + z->total_out + GZIP_FRAME_TRAILER;
 
-    return HEADER_OK;
+    // gzip header with the extra field of the frame (total and uncompressed size)
+    bzero(salida, GZIP_FRAME_HEADER);
+    salida[0] = 0x1f;
+    salida[1] = 0x8b;
+    salida[2] = 8;    // deflate
+    salida[3] = 4;    // FEXTRA
+    salida[9] = 3;    // unix
+    PonLE(salida + 10, 12, 2);
+    salida[12] = GZIP_FRAME_SI1;
+    salida[13] = GZIP_FRAME_SI2;
+    PonLE(salida + 14, 8, 2);
+    PonLE(salida + 16, tam, 4);
+    PonLE(salida + 20, marco->tamEntrada, 4);
+    // trailer
+    PonLE(salida + tam - GZIP_FRAME_TRAILER, crc32(crc32(0L, Z_NULL, 0), (unsigned char *)marco->entrada, marco->tamEntrada), 4);
+    PonLE(salida + tam - 4, marco->tamEntrada, 4);
+    marco->tamSalida = tam;
+    return 0;
 }
 
-// ----------------------------------------------------------------
-// (1.2) write the data file (blocks of 512 bytes)
-unsigned long WriteFileDataBlocks(int fd_DataFile, int fd_TarFile)
+void *TrabajadorCompresion(void *arg)
 {
-    unsigned long NumWriteBytes;
-    int Tam, n;
+    struct compresor_tar *comp = arg;
+    struct marco_tar *marco;
+    z_stream z;
+    int ok;
 
-    // write the data file (blocks of 512 bytes)
-    NumWriteBytes = 0;
-    printf("Datos Escritos :"); // Traza
-    bzero(FileDataBlock, sizeof(FileDataBlock));
-    // memset(FileDataBlock, '\0', sizeof(FileDataBlock));  // Similar a bzero(...)
-    while ((n = read(fd_DataFile, FileDataBlock, sizeof(FileDataBlock))) > 0)
+    bzero(&z, sizeof(z));
+    ok = (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    pthread_mutex_lock(&comp->mutex);
+    for (;;)
     {
-        write(fd_TarFile, FileDataBlock, sizeof(FileDataBlock));
-        NumWriteBytes = NumWriteBytes + sizeof(FileDataBlock); // ojo!!!, no se escriben n
-        printf("--%d -\n", n);
-        printf("%c%c%c%c\n", FileDataBlock[0], FileDataBlock[1], FileDataBlock[2], FileDataBlock[3]); // Traza
-        // NumWriteBytes = NumWriteBytes + DATAFILE_BLOCK_SIZE;
-        bzero(FileDataBlock, sizeof(FileDataBlock));
+        while (comp->tomados == comp->llenos && !comp->fin)
+            pthread_cond_wait(&comp->cond, &comp->mutex);
+        if (comp->tomados == comp->llenos)
+            break;
+        marco = &comp->marcos[comp->tomados++ % comp->num];
+        pthread_mutex_unlock(&comp->mutex);
+        ok = ok && (ComprimeMarco(&z, marco) == 0);
+        pthread_mutex_lock(&comp->mutex);
+        marco->estado = ok ? MARCO_COMPRIMIDO : MARCO_ERROR;
+        pthread_cond_broadcast(&comp->cond);
     }
-
-    printf("\n Total :Escritos %ld \n", NumWriteBytes); // Traza
-    return NumWriteBytes;
+    pthread_mutex_unlock(&comp->mutex);
+    if (ok)
+        deflateEnd(&z);
+    return NULL;
 }
 
-// ----------------------------------------------------------------
-// (2.1)Write end tar archive entry (2x512 bytes with zeros)
-unsigned long WriteEndTarArchive(int fd_TarFile)
+int AbreCompresorTar(struct compresor_tar *comp, int fd_TarFile, unsigned int hilos)
 {
-    unsigned long NumWriteBytes;
-    int n;
-
-    // write end tar archive entry (2x512 bytes with zeros)
-    NumWriteBytes = 0;
-    // To Do...
-    bzero(FileDataBlock, sizeof(FileDataBlock));
-
-    write(fd_TarFile, FileDataBlock, sizeof(FileDataBlock));
-    NumWriteBytes += sizeof(FileDataBlock);
+    unsigned int i;
 
-    write(fd_TarFile, FileDataBlock, sizeof(FileDataBlock));
-    NumWriteBytes += sizeof(FileDataBlock);
+    bzero(comp, sizeof(struct compresor_tar));
+    comp->fd = fd_TarFile;
+    comp->numHilos = hilos;
+    comp->num = 2 * hilos;
+    pthread_mutex_init(&comp->mutex, NULL);
+    pthread_cond_init(&comp->cond, NULL);
+    if ((comp->marcos = calloc(comp->num, sizeof(struct marco_tar))) == NULL ||
+        (comp->hilos = calloc(hilos, sizeof(pthread_t))) == NULL)
+        return -1;
+    for (i = 0; i < comp->num; i++)
+    {
+        comp->marcos[i].capSalida = GZIP_FRAME_HEADER + compressBound(GZIP_FRAME_SIZE) + GZIP_FRAME_TRAILER;
+        if ((comp->marcos[i].entrada = malloc(GZIP_FRAME_SIZE)) == NULL ||
+            (comp->marcos[i].salida = malloc(comp->marcos[i].capSalida)) == NULL)
+            return -1;
+    }
+    for (i = 0; i < hilos; i++)
+    {
+        if (pthread_create(&comp->hilos[i], NULL, TrabajadorCompresion, comp) != 0)
+            return -1;
+        comp->lanzados++;
+    }
+    return 0;
+}
 
-    printf(" Escritos (End block)%d total %ld\n", n, NumWriteBytes); // Traza
+// Write the oldest frame (waiting for its thread)
+int EscribeMarcoTar(struct compresor_tar *comp)
+{
+    struct marco_tar *marco = &comp->marcos[comp->escritos % comp->num];
+    int ret;
 
-    return NumWriteBytes;
+    pthread_mutex_lock(&comp->mutex);
+    while (marco->estado == MARCO_LLENO)
+        pthread_cond_wait(&comp->cond, &comp->mutex);
+    pthread_mutex_unlock(&comp->mutex);
+    if (marco->estado == MARCO_ERROR)
+    {
+        fprintf(stderr, "Error al comprimir el fichero tar\n");
+        return -1;
+    }
+    if ((ret = EscribeTodo(comp->fd, marco->salida, marco->tamSalida)) != 0)
+        fprintf(stderr, "Error al escribir el fichero tar\n");
+    comp->bytesEntrada += marco->tamEntrada;
+    comp->bytesSalida += marco->tamSalida;
+    marco->tamEntrada = 0;
+    marco->estado = MARCO_LIBRE;
+    comp->escritos++;
+    return ret;
+}
+
+// Give the frame being filled to the threads
+int EntregaMarcoTar(struct compresor_tar *comp)
+{
+    pthread_mutex_lock(&comp->mutex);
+    comp->marcos[comp->llenos % comp->num].estado = MARCO_LLENO;
+    comp->llenos++;
+    pthread_cond_broadcast(&comp->cond);
+    pthread_mutex_unlock(&comp->mutex);
+    // the next frame to fill has to be written
+    if (comp->llenos - comp->escritos == comp->num)
+        return EscribeMarcoTar(comp);
+    return 0;
+}
+
+// Add n bytes of datos (zeros if datos is NULL) to the tar stream
+int ComprimeDatosTar(struct compresor_tar *comp, const char *datos, unsigned long n)
+{
+    struct marco_tar *marco;
+    unsigned long tam;
+
+    while (n > 0)
+    {
+        marco = &comp->marcos[comp->llenos % comp->num];
+        tam = GZIP_FRAME_SIZE - marco->tamEntrada;
+        if (n < tam)
+            tam = n;
+        if (datos != NULL)
+        {
+            memcpy(marco->entrada + marco->tamEntrada, datos, tam);
+            datos += tam;
+        }
+        else
+            memset(marco->entrada + marco->tamEntrada, 0, tam);
+        marco->tamEntrada += tam;
+        n -= tam;
+        if (marco->tamEntrada == GZIP_FRAME_SIZE && EntregaMarcoTar(comp) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Compress the last frame, write all the frames and stop the threads
+int CierraCompresorTar(struct compresor_tar *comp)
+{
+    unsigned int i;
+    int ret = 0;
+
+    if (comp->marcos != NULL && comp->marcos[comp->llenos % comp->num].tamEntrada > 0)
+        ret = EntregaMarcoTar(comp);
+    while (ret == 0 && comp->escritos < comp->llenos)
+        ret = EscribeMarcoTar(comp);
+    pthread_mutex_lock(&comp->mutex);
+    comp->fin = 1;
+    pthread_cond_broadcast(&comp->cond);
+    pthread_mutex_unlock(&comp->mutex);
+    for (i = 0; i < comp->lanzados; i++)
+        pthread_join(comp->hilos[i], NULL);
+    for (i = 0; comp->marcos != NULL && i < comp->num; i++)
+    {
+        free(comp->marcos[i].entrada);
+        free(comp->marcos[i].salida);
+    }
+    free(comp->marcos);
+    free(comp->hilos);
+    if (comp->bytesEntrada > 0)
+        TRAZA(1, "comprimido: %llu -> %llu bytes en %llu marcos\n", comp->bytesEntrada, comp->bytesSalida, (unsigned long long)comp->escritos);
+    bzero(comp, sizeof(struct compresor_tar));
+    return ret;
+}
+
+//----------------------------------------------------------------------------
+// Buffered writer of the tar file. Headers, data and padding are grouped in
+// a buffer of FactorBloqueo blocks of 512 bytes (a multiple of the 10KB tar
+// record), so the tar file is written with one syscall per buffer.
+// Zero bytes (padding, end of archive) are not copied to the buffer: they are
+// kept as a counter and written with writev from a static block of zeros
+// (except with --io=directo, see EscribeAlineadoEscritorTar).
+static const char BloqueCeros[TAR_FILE_BLOCK_SIZE];
+
+int AbreEscritorTar(struct escritor_tar *escritor, int fd_TarFile, unsigned long long pos)
+{
+    struct stat sb;
+
+    bzero(escritor, sizeof(struct escritor_tar));
+    escritor->tam = FactorBloqueo * DATAFILE_BLOCK_SIZE;
+    if (posix_memalign((void **)&escritor->buffer, BUFFER_ALIGNMENT, escritor->tam) != 0)
+    {
+        fprintf(stderr, "No se puede reservar el buffer de escritura (%lu bytes)\n", escritor->tam);
+        return -1;
+    }
+    escritor->fd = fd_TarFile;
+    escritor->pos = pos;
+    if (Comprimir)
+    {
+        if (AbreCompresorTar(&CompresorTar, fd_TarFile, NumHilosCompresion()) != 0)
+        {
+            fprintf(stderr, "No se puede iniciar la compresion del fichero tar\n");
+            CierraCompresorTar(&CompresorTar);
+            return -1;
+        }
+        escritor->compresor = &CompresorTar;
+    }
+    // --io: only a tar file on disk (not a pipe, not compressed)
+    if (PoliticaIO != IO_NORMAL && !Comprimir && fstat(fd_TarFile, &sb) == 0 && S_ISREG(sb.st_mode))
+    {
+        escritor->soltar = 1;
+        escritor->directo = (PoliticaIO == IO_DIRECTO);
+        escritor->iniciado = escritor->soltado = pos;
+    }
+    return 0;
+}
+
+// A write of the tar file failed: the error is kept and the pending bytes are
+// discarded, so the callers stop instead of waiting for free space
+int FallaEscritorTar(struct escritor_tar *escritor)
+{
+    escritor->error = 1;
+    escritor->usados = 0;
+    escritor->ceros = 0;
+    return -1;
+}
+
+// --io: the pages of the tar file already written are dropped from the
+// page cache, so a big archive does not evict the pages of the other
+// processes. Every tam bytes the writeback of the new pages is started
+// and the pages started by the previous call (written back by now, or
+// waited for) are dropped; with todo (at the end) all of them.
+void SueltaCacheTar(struct escritor_tar *escritor, int todo)
+{
+    unsigned long long escrito = escritor->pos - escritor->usados - escritor->ceros;
+    unsigned long long desde, hasta;
+
+    // (RetrocedeEscritorTar may have moved the writer back)
+    if (escritor->iniciado > escrito)
+        escritor->iniciado = escrito;
+    if (escritor->soltado > escritor->iniciado)
+        escritor->soltado = escritor->iniciado;
+    if (!todo && escrito - escritor->iniciado < escritor->tam)
+        return;
+    desde = escritor->soltado & ~(unsigned long long)(BUFFER_ALIGNMENT - 1); // the page cut by the previous call
+    hasta = todo ? escrito : escritor->iniciado;
+    if (!todo)
+    {
+        CuentaLlamadas(1);
+        sync_file_range(escritor->fd, escritor->iniciado, escrito - escritor->iniciado, SYNC_FILE_RANGE_WRITE);
+    }
+    escritor->iniciado = escrito;
+    if (hasta > desde)
+    {
+        CuentaLlamadas(2);
+        sync_file_range(escritor->fd, desde, hasta - desde,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(escritor->fd, desde, hasta - desde, POSIX_FADV_DONTNEED);
+        escritor->soltado = hasta;
+    }
+}
+
+// --io=directo: the part of the buffer between the first and the last
+// BUFFER_ALIGNMENT offsets of the tar file is written with O_DIRECT (the
+// buffer is aligned in memory). The bytes before it go through the page
+// cache and the bytes after it are kept at the start of the buffer, so
+// the next buffers start aligned. O_DIRECT is set only during the write.
+// If the file system does not allow it, directo is cleared and the bytes
+// are written as usual.
+int EscribeAlineadoEscritorTar(struct escritor_tar *escritor)
+{
+    unsigned long long offset = escritor->pos - escritor->usados;
+    unsigned long cabeza, n, hecho = 0;
+    ssize_t r = 0;
+    int flags, ret = 0;
+
+    if (escritor->ceros > 0) // (the zeros are in the buffer with directo)
+        return 0;
+    cabeza = (BUFFER_ALIGNMENT - offset % BUFFER_ALIGNMENT) % BUFFER_ALIGNMENT;
+    if (cabeza >= escritor->usados)
+        return 0;
+    if ((n = (escritor->usados - cabeza) & ~(unsigned long)(BUFFER_ALIGNMENT - 1)) == 0)
+        return 0;
+    if (cabeza > 0)
+    {
+        if (EscribeTodo(escritor->fd, escritor->buffer, cabeza) != 0)
+            return -1;
+        memmove(escritor->buffer, escritor->buffer + cabeza, escritor->usados - cabeza);
+        escritor->usados -= cabeza;
+    }
+    CuentaLlamadas(2);
+    if ((flags = fcntl(escritor->fd, F_GETFL)) == -1 || fcntl(escritor->fd, F_SETFL, flags | O_DIRECT) == -1)
+    {
+        TRAZA(1, "sin O_DIRECT en el fichero tar: %s\n", strerror(errno));
+        escritor->directo = 0;
+        ret = EscribeTodo(escritor->fd, escritor->buffer, n);
+    }
+    else
+    {
+        while (hecho < n)
+        {
+            CuentaLlamadas(1);
+            if ((r = write(escritor->fd, escritor->buffer + hecho, n - hecho)) <= 0)
+            {
+                if (r == -1 && errno == EINTR)
+                    continue;
+                break;
+            }
+            hecho += r;
+        }
+        CuentaLlamadas(1);
+        fcntl(escritor->fd, F_SETFL, flags);
+        TRAZA(3, "O_DIRECT: %lu de %lu bytes en el offset %llu\n", hecho, n, offset);
+        if (hecho < n && r == -1 && errno == EINVAL)
+        {
+            TRAZA(1, "O_DIRECT rechazado en el offset %llu\n", offset + hecho);
+            escritor->directo = 0;
+            ret = EscribeTodo(escritor->fd, escritor->buffer + hecho, n - hecho);
+        }
+        else if (hecho < n)
+            ret = -1;
+    }
+    memmove(escritor->buffer, escritor->buffer + n, escritor->usados - n);
+    escritor->usados -= n;
+    SueltaCacheTar(escritor, 0);
+    return ret;
+}
+
+// write the buffer and the pending zero bytes
+int VaciaEscritorTar(struct escritor_tar *escritor)
+{
+    struct iovec iov[IOV_MAX];
+    unsigned long ceros = escritor->ceros;
+    ssize_t n;
+    int i, cnt = 0, primero = 0;
+
+    if (escritor->error)
+        return FallaEscritorTar(escritor);
+    if (escritor->compresor != NULL)
+    {
+        if (ComprimeDatosTar(escritor->compresor, escritor->buffer, escritor->usados) != 0 ||
+            ComprimeDatosTar(escritor->compresor, NULL, escritor->ceros) != 0)
+            return FallaEscritorTar(escritor);
+        escritor->usados = 0;
+        escritor->ceros = 0;
+        return 0;
+    }
+    // the aligned part with O_DIRECT, the rest below
+    if (escritor->directo && EscribeAlineadoEscritorTar(escritor) != 0)
+    {
+        fprintf(stderr, "Error al escribir el fichero tar\n");
+        return FallaEscritorTar(escritor);
+    }
+    if (escritor->usados > 0)
+    {
+        iov[cnt].iov_base = escritor->buffer;
+        iov[cnt++].iov_len = escritor->usados;
+    }
+    while (ceros > 0 || cnt > 0)
+    {
+        while (ceros > 0 && cnt < IOV_MAX)
+        {
+            iov[cnt].iov_base = (void *)BloqueCeros;
+            iov[cnt].iov_len = (ceros < sizeof(BloqueCeros)) ? ceros : sizeof(BloqueCeros);
+            ceros -= iov[cnt++].iov_len;
+        }
+        while (primero < cnt)
+        {
+            CuentaLlamadas(1);
+            if ((n = writev(escritor->fd, &iov[primero], cnt - primero)) == -1)
+            {
+                fprintf(stderr, "Error al escribir el fichero tar\n");
+                return FallaEscritorTar(escritor);
+            }
+            // partial write: skip the iovecs already written
+            for (i = primero; i < cnt && n >= (ssize_t)iov[i].iov_len; i++)
+            {
+                n -= iov[i].iov_len;
+                primero++;
+            }
+            if (primero < cnt)
+            {
+                iov[primero].iov_base = (char *)iov[primero].iov_base + n;
+                iov[primero].iov_len -= n;
+            }
+        }
+        cnt = primero = 0;
+    }
+    escritor->usados = 0;
+    escritor->ceros = 0;
+    if (escritor->soltar)
+        SueltaCacheTar(escritor, 0);
+    return 0;
+}
+
+// Return the free space of the buffer (flushing it if it is full), NULL
+// (and *libre 0) after a write error
+char *EspacioEscritorTar(struct escritor_tar *escritor, unsigned long *libre)
+{
+    if (escritor->directo && escritor->usados == escritor->tam && !escritor->error)
+    {
+        // (the unaligned tail stays in the buffer)
+        if (EscribeAlineadoEscritorTar(escritor) != 0)
+        {
+            fprintf(stderr, "Error al escribir el fichero tar\n");
+            FallaEscritorTar(escritor);
+        }
+    }
+    else if (escritor->ceros > 0 || escritor->usados == escritor->tam)
+        VaciaEscritorTar(escritor);
+    if (escritor->error)
+    {
+        *libre = 0;
+        return NULL;
+    }
+    *libre = escritor->tam - escritor->usados;
+    return escritor->buffer + escritor->usados;
+}
+
+// n bytes have been stored in the space returned by EspacioEscritorTar
+void AvanzaEscritorTar(struct escritor_tar *escritor, unsigned long n)
+{
+    escritor->usados += n;
+    escritor->pos += n;
+}
+
+int EscribeEscritorTar(struct escritor_tar *escritor, const void *datos, unsigned long n)
+{
+    unsigned long libre, tam;
+    char *espacio;
+
+    while (n > 0)
+    {
+        if ((espacio = EspacioEscritorTar(escritor, &libre)) == NULL)
+            return -1;
+        tam = (n < libre) ? n : libre;
+        memcpy(espacio, datos, tam);
+        AvanzaEscritorTar(escritor, tam);
+        datos = (const char *)datos + tam;
+        n -= tam;
+    }
+    return 0;
+}
+
+int EscribeCerosEscritorTar(struct escritor_tar *escritor, unsigned long n)
+{
+    unsigned long libre, tam;
+    char *espacio;
+
+    // directo: in the buffer, so it is written in aligned blocks
+    while (escritor->directo && n > 0)
+    {
+        if ((espacio = EspacioEscritorTar(escritor, &libre)) == NULL)
+            return -1;
+        tam = (n < libre) ? n : libre;
+        memset(espacio, 0, tam);
+        AvanzaEscritorTar(escritor, tam);
+        n -= tam;
+    }
+    if (escritor->error)
+        return -1;
+    escritor->ceros += n;
+    escritor->pos += n;
+    return 0;
+}
+
+// Discard the bytes written after offset pos (a member replaced by a hard
+// link, see EnlazaDuplicado). The bytes still in the buffer are dropped;
+// the ones already written are overwritten by the next members and the
+// tar file is truncated when it is closed. Return -1 if they can not be
+// discarded (already compressed).
+int RetrocedeEscritorTar(struct escritor_tar *escritor, unsigned long long pos)
+{
+    unsigned long long sobran = escritor->pos - pos;
+    unsigned long ceros;
+
+    if (sobran <= escritor->usados + escritor->ceros)
+    {
+        // the pending zeros are after the buffer
+        ceros = (sobran < escritor->ceros) ? sobran : escritor->ceros;
+        escritor->ceros -= ceros;
+        escritor->usados -= sobran - ceros;
+        escritor->pos = pos;
+        return 0;
+    }
+    if (escritor->compresor != NULL || VaciaEscritorTar(escritor) != 0 ||
+        lseek(escritor->fd, (off_t)pos, SEEK_SET) == -1)
+        return -1;
+    escritor->pos = pos;
+    escritor->truncar = 1;
+    return 0;
+}
+
+int CierraEscritorTar(struct escritor_tar *escritor)
+{
+    int ret = 0;
+
+    if (escritor->buffer != NULL)
+    {
+        ret = VaciaEscritorTar(escritor);
+        if (escritor->truncar && ftruncate(escritor->fd, (off_t)escritor->pos) == -1)
+            ret = -1;
+        if (escritor->soltar)
+            SueltaCacheTar(escritor, 1);
+        free(escritor->buffer);
+        escritor->buffer = NULL;
+    }
+    if (escritor->compresor != NULL)
+    {
+        if (CierraCompresorTar(escritor->compresor) != 0)
+            ret = -1;
+        escritor->compresor = NULL;
+    }
+    return ret;
+}
+
+//----------------------------------------------------------------------------
+// io_uring (-u). Small files are extracted (and inserted) in batches of
+// URING_DEPTH files: every file is an openat into a fixed file slot, a
+// write (read) of that slot and a close of the slot, linked in the ring
+// (IOSQE_IO_HARDLINK: the close is done even if the write fails), so a
+// batch is one io_uring_enter instead of 3 system calls per file. The ring
+// is set up with the system calls (no liburing); if the kernel does not
+// have io_uring the synchronous path is used.
+int AbreAnilloTar(struct anillo_tar *anillo, unsigned int entradas, unsigned int ficheros)
+{
+    struct io_uring_params params;
+    int *fds;
+    unsigned int i;
+
+    bzero(anillo, sizeof(struct anillo_tar));
+    bzero(&params, sizeof(params));
+    if ((anillo->fd = syscall(__NR_io_uring_setup, entradas, &params)) < 0)
+        return -1;
+    anillo->tamSqMapa = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    anillo->tamCqMapa = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (anillo->tamCqMapa > anillo->tamSqMapa)
+            anillo->tamSqMapa = anillo->tamCqMapa;
+        anillo->tamCqMapa = 0;
+    }
+    anillo->tamSqes = params.sq_entries * sizeof(struct io_uring_sqe);
+    anillo->sqMapa = mmap(NULL, anillo->tamSqMapa, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, anillo->fd, IORING_OFF_SQ_RING);
+    anillo->cqMapa = anillo->sqMapa;
+    if (anillo->sqMapa != MAP_FAILED && anillo->tamCqMapa != 0)
+        anillo->cqMapa = mmap(NULL, anillo->tamCqMapa, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, anillo->fd, IORING_OFF_CQ_RING);
+    anillo->sqes = mmap(NULL, anillo->tamSqes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, anillo->fd, IORING_OFF_SQES);
+    if (anillo->sqMapa == MAP_FAILED || anillo->cqMapa == MAP_FAILED || anillo->sqes == MAP_FAILED)
+    {
+        CierraAnilloTar(anillo);
+        return -1;
+    }
+    anillo->sqCabeza = (unsigned int *)((char *)anillo->sqMapa + params.sq_off.head);
+    anillo->sqCola = (unsigned int *)((char *)anillo->sqMapa + params.sq_off.tail);
+    anillo->sqMascara = (unsigned int *)((char *)anillo->sqMapa + params.sq_off.ring_mask);
+    anillo->sqArray = (unsigned int *)((char *)anillo->sqMapa + params.sq_off.array);
+    anillo->cqCabeza = (unsigned int *)((char *)anillo->cqMapa + params.cq_off.head);
+    anillo->cqCola = (unsigned int *)((char *)anillo->cqMapa + params.cq_off.tail);
+    anillo->cqMascara = (unsigned int *)((char *)anillo->cqMapa + params.cq_off.ring_mask);
+    anillo->cqes = (struct io_uring_cqe *)((char *)anillo->cqMapa + params.cq_off.cqes);
+    anillo->cola = *anillo->sqCola;
+
+    // empty table of fixed files (-1: free slot)
+    if ((fds = malloc(ficheros * sizeof(int))) == NULL)
+    {
+        CierraAnilloTar(anillo);
+        return -1;
+    }
+    for (i = 0; i < ficheros; i++)
+        fds[i] = -1;
+    if (syscall(__NR_io_uring_register, anillo->fd, IORING_REGISTER_FILES, fds, ficheros) < 0)
+    {
+        free(fds);
+        CierraAnilloTar(anillo);
+        return -1;
+    }
+    free(fds);
+    return 0;
+}
+
+void CierraAnilloTar(struct anillo_tar *anillo)
+{
+    if (anillo->sqes != NULL && anillo->sqes != MAP_FAILED)
+        munmap(anillo->sqes, anillo->tamSqes);
+    if (anillo->cqMapa != NULL && anillo->cqMapa != MAP_FAILED && anillo->cqMapa != anillo->sqMapa)
+        munmap(anillo->cqMapa, anillo->tamCqMapa);
+    if (anillo->sqMapa != NULL && anillo->sqMapa != MAP_FAILED)
+        munmap(anillo->sqMapa, anillo->tamSqMapa);
+    if (anillo->fd >= 0)
+        close(anillo->fd);
+    bzero(anillo, sizeof(struct anillo_tar));
+    anillo->fd = -1;
+}
+
+// Next free sqe (zeroed). The caller does not queue more sqes than the
+// ring has.
+struct io_uring_sqe *SqeAnilloTar(struct anillo_tar *anillo)
+{
+    unsigned int i = anillo->cola & *anillo->sqMascara;
+
+    anillo->sqArray[i] = i;
+    anillo->cola++;
+    anillo->pendientes++;
+    bzero(&anillo->sqes[i], sizeof(struct io_uring_sqe));
+    return &anillo->sqes[i];
+}
+
+// Submit the queued sqes and wait for all the operations in flight:
+// procesa(ctx, user_data, res) for every completion
+int EsperaAnilloTar(struct anillo_tar *anillo, void (*procesa)(void *ctx, unsigned long long dato, int res), void *ctx)
+{
+    struct io_uring_cqe *cqe;
+    unsigned int cabeza;
+    int n;
+
+    __atomic_store_n(anillo->sqCola, anillo->cola, __ATOMIC_RELEASE);
+    while (anillo->pendientes > 0 || anillo->enVuelo > 0)
+    {
+        CuentaLlamadas(1);
+        n = syscall(__NR_io_uring_enter, anillo->fd, anillo->pendientes, anillo->enVuelo + anillo->pendientes > 0 ? 1 : 0,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return -1;
+        if (n > 0)
+        {
+            anillo->pendientes -= n;
+            anillo->enVuelo += n;
+        }
+        cabeza = *anillo->cqCabeza;
+        while (cabeza != __atomic_load_n(anillo->cqCola, __ATOMIC_ACQUIRE))
+        {
+            cqe = &anillo->cqes[cabeza & *anillo->cqMascara];
+            procesa(ctx, cqe->user_data, cqe->res);
+            cabeza++;
+            anillo->enVuelo--;
+        }
+        __atomic_store_n(anillo->cqCabeza, cabeza, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// Results of the operations of a batch: user_data = 4 * file + operation
+// (0 open, 1 read/write, 2 close)
+void ResultadoUring(void *ctx, unsigned long long dato, int res)
+{
+    struct lote_uring *lote = ctx;
+
+    if (dato % 4 == 0)
+        lote->ops[dato / 4].resAbre = res;
+    else if (dato % 4 == 1)
+        lote->ops[dato / 4].resDatos = res;
+}
+
+// Set up the ring of the batches (-u). Without io_uring the synchronous
+// path is used.
+void AbreLoteUring(struct lote_uring *lote)
+{
+    unsigned int i;
+
+    bzero(lote, sizeof(struct lote_uring));
+    if ((lote->ops = calloc(URING_DEPTH, sizeof(struct op_uring))) == NULL ||
+        AbreAnilloTar(&lote->anillo, 3 * URING_DEPTH, URING_DEPTH) != 0)
+    {
+        fprintf(stderr, "io_uring no disponible, se usa E/S sincrona\n");
+        free(lote->ops);
+        lote->ops = NULL;
+        return;
+    }
+    for (i = 0; i < URING_DEPTH; i++)
+        if ((lote->ops[i].buffer = malloc(URING_MAX_FILE)) == NULL)
+            break;
+    if (i < URING_DEPTH)
+    {
+        CierraLoteUring(lote);
+        return;
+    }
+    lote->mascara = umask(0);
+    umask(lote->mascara);
+    lote->activo = 1;
+}
+
+void CierraLoteUring(struct lote_uring *lote)
+{
+    unsigned int i;
+
+    if (lote->activo)
+        TRAZA(1, "io_uring: %lu ficheros (%lu por la E/S sincrona)\n", lote->ficheros, lote->sincronos);
+    if (lote->ops != NULL)
+    {
+        for (i = 0; i < URING_DEPTH; i++)
+            free(lote->ops[i].buffer);
+        free(lote->ops);
+        CierraAnilloTar(&lote->anillo);
+    }
+    bzero(lote, sizeof(struct lote_uring));
+}
+
+// Queue open (fixed file i+1) + read/write (IORING_OP_READ or
+// IORING_OP_WRITE) + close of ops[i]. The fixed files are not in the table
+// of descriptors of the process (and O_CLOEXEC is not allowed).
+void EncolaOpUring(struct lote_uring *lote, unsigned int i, int dirfd, int flags, mode_t modo, int operacion, void *datos)
+{
+    struct op_uring *op = &lote->ops[i];
+    struct io_uring_sqe *sqe;
+
+    op->resAbre = op->resDatos = -ECANCELED;
+    sqe = SqeAnilloTar(&lote->anillo);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe->fd = dirfd;
+    sqe->addr = (uintptr_t)op->nombre;
+    sqe->len = modo;
+    sqe->open_flags = flags;
+    sqe->file_index = i + 1;
+    sqe->user_data = 4 * i;
+
+    sqe = SqeAnilloTar(&lote->anillo);
+    sqe->opcode = operacion;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->fd = i;
+    sqe->addr = (uintptr_t)datos;
+    sqe->len = op->tam;
+    sqe->off = 0;
+    sqe->user_data = 4 * i + 1;
+
+    sqe = SqeAnilloTar(&lote->anillo);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = i + 1;
+    sqe->user_data = 4 * i + 2;
+}
+
+//----------------------------------------------------------------------------
+// Decompression of a tar file written with -z. The frames are found reading
+// only their gzip headers (total and uncompressed size in the extra field),
+// so the reader can go to any offset of the tar stream decompressing only
+// the frame that holds it. A pool of threads decompresses the frames that
+// follow the one being read (at most 2 per thread).
+#define RANURA_VACIA (0)
+#define RANURA_EN_CURSO (1)
+#define RANURA_LISTA (2)
+#define RANURA_ERROR (3)
+
+// Read the table of frames of the file. Return -1 if it is not a tar
+// written with -z
+int LeeMarcosGz(struct descompresor_tar *gz)
+{
+    unsigned char cabecera[GZIP_FRAME_HEADER];
+    unsigned long long coff = 0, uoff = 0;
+    struct marco_gz *marcos;
+    unsigned long cap = 0;
+    ssize_t n;
+
+    while ((n = pread(gz->fd, cabecera, sizeof(cabecera), coff)) != 0)
+    {
+        if (n != sizeof(cabecera) || cabecera[0] != 0x1f || cabecera[1] != 0x8b || cabecera[2] != 8 ||
+            cabecera[3] != 4 || LeeLE(cabecera + 10, 2) != 12 || cabecera[12] != GZIP_FRAME_SI1 ||
+            cabecera[13] != GZIP_FRAME_SI2 || LeeLE(cabecera + 14, 2) != 8 ||
+            LeeLE(cabecera + 16, 4) < GZIP_FRAME_HEADER + GZIP_FRAME_TRAILER || LeeLE(cabecera + 20, 4) > GZIP_FRAME_SIZE)
+            return -1;
+        if (gz->num == cap)
+        {
+            cap = (cap == 0) ? 256 : 2 * cap;
+            if ((marcos = realloc(gz->marcos, cap * sizeof(struct marco_gz))) == NULL)
+                return -1;
+            gz->marcos = marcos;
+        }
+        gz->marcos[gz->num].coff = coff;
+        gz->marcos[gz->num].uoff = uoff;
+        gz->marcos[gz->num].csize = LeeLE(cabecera + 16, 4);
+        gz->marcos[gz->num].usize = LeeLE(cabecera + 20, 4);
+        if (gz->marcos[gz->num].csize > gz->maxComprimido)
+            gz->maxComprimido = gz->marcos[gz->num].csize;
+        coff += gz->marcos[gz->num].csize;
+        uoff += gz->marcos[gz->num].usize;
+        gz->num++;
+    }
+    gz->tam = uoff;
+    return 0;
+}
+
+int DescomprimeMarco(struct descompresor_tar *gz, z_stream *z, struct ranura_gz *ranura)
+{
+    struct marco_gz *marco = &gz->marcos[ranura->marco];
+    const unsigned char *fin;
+
+    if (pread(gz->fd, ranura->comprimido, marco->csize, marco->coff) != (ssize_t)marco->csize)
+        return -1;
+    z->next_in = (unsigned char *)ranura->comprimido + GZIP_FRAME_HEADER;
+    z->avail_in = marco->csize - GZIP_FRAME_HEADER - GZIP_FRAME_TRAILER;
+    z->next_out = (unsigned char *)ranura->datos;
+    z->avail_out = marco->usize;
+    if (inflateReset(z) != Z_OK || inflate(z, Z_FINISH) != Z_STREAM_END || z->total_out != marco->usize)
+        return -1;
+    fin = (const unsigned char *)ranura->comprimido + marco->csize - GZIP_FRAME_TRAILER;
+    if (LeeLE(fin, 4) != crc32(crc32(0L, Z_NULL, 0), (unsigned char *)ranura->datos, marco->usize) ||
+        LeeLE(fin + 4, 4) != marco->usize)
+        return -1;
+    return 0;
+}
+
+void *TrabajadorDescompresion(void *arg)
+{
+    struct descompresor_tar *gz = arg;
+    struct ranura_gz *ranura;
+    z_stream z;
+    int ok;
+
+    bzero(&z, sizeof(z));
+    ok = (inflateInit2(&z, -15) == Z_OK);
+    pthread_mutex_lock(&gz->mutex);
+    for (;;)
+    {
+        // the slot of the next frame may still be in use (the reader went
+        // past its frame before it was decompressed)
+        while (!gz->fin && (gz->siguiente >= gz->limite ||
+                            gz->ranuras[gz->siguiente % gz->numRanuras].estado == RANURA_EN_CURSO))
+            pthread_cond_wait(&gz->cond, &gz->mutex);
+        if (gz->fin)
+            break;
+        ranura = &gz->ranuras[gz->siguiente % gz->numRanuras];
+        ranura->marco = gz->siguiente++;
+        ranura->estado = RANURA_EN_CURSO;
+        gz->ocupados++;
+        pthread_mutex_unlock(&gz->mutex);
+        ok = ok && (DescomprimeMarco(gz, &z, ranura) == 0);
+        pthread_mutex_lock(&gz->mutex);
+        ranura->estado = ok ? RANURA_LISTA : RANURA_ERROR;
+        gz->ocupados--;
+        pthread_cond_broadcast(&gz->cond);
+    }
+    pthread_mutex_unlock(&gz->mutex);
+    if (ok)
+        inflateEnd(&z);
+    return NULL;
+}
+
+int AbreDescompresorTar(struct descompresor_tar *gz, int fd_TarFile, unsigned int hilos)
+{
+    unsigned int i;
+
+    bzero(gz, sizeof(struct descompresor_tar));
+    gz->fd = fd_TarFile;
+    pthread_mutex_init(&gz->mutex, NULL);
+    pthread_cond_init(&gz->cond, NULL);
+    if (LeeMarcosGz(gz) != 0)
+    {
+        fprintf(stderr, "Formato comprimido erroneo (solo tar creados con -z)\n");
+        return -1;
+    }
+    gz->numRanuras = 2 * hilos;
+    if ((gz->ranuras = calloc(gz->numRanuras, sizeof(struct ranura_gz))) == NULL ||
+        (gz->hilos = calloc(hilos, sizeof(pthread_t))) == NULL)
+        return -1;
+    for (i = 0; i < gz->numRanuras; i++)
+    {
+        gz->ranuras[i].marco = ULONG_MAX;
+        if ((gz->ranuras[i].datos = malloc(GZIP_FRAME_SIZE)) == NULL ||
+            (gz->ranuras[i].comprimido = malloc(gz->maxComprimido)) == NULL)
+            return -1;
+    }
+    for (i = 0; i < hilos; i++)
+    {
+        if (pthread_create(&gz->hilos[i], NULL, TrabajadorDescompresion, gz) != 0)
+            return -1;
+        gz->lanzados++;
+    }
+    return 0;
+}
+
+void CierraDescompresorTar(struct descompresor_tar *gz)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&gz->mutex);
+    gz->fin = 1;
+    pthread_cond_broadcast(&gz->cond);
+    pthread_mutex_unlock(&gz->mutex);
+    for (i = 0; i < gz->lanzados; i++)
+        pthread_join(gz->hilos[i], NULL);
+    for (i = 0; gz->ranuras != NULL && i < gz->numRanuras; i++)
+    {
+        free(gz->ranuras[i].datos);
+        free(gz->ranuras[i].comprimido);
+    }
+    free(gz->ranuras);
+    free(gz->hilos);
+    free(gz->marcos);
+    bzero(gz, sizeof(struct descompresor_tar));
+}
+
+// Return the decompressed frame k (NULL on error). The data is valid until
+// the next call.
+struct ranura_gz *ObtenMarcoGz(struct descompresor_tar *gz, unsigned long k)
+{
+    struct ranura_gz *ranura = &gz->ranuras[k % gz->numRanuras];
+    unsigned int i;
+
+    pthread_mutex_lock(&gz->mutex);
+    if (k < gz->base || k >= gz->base + gz->numRanuras)
+    {
+        // out of the window (a jump): start again from frame k
+        while (gz->ocupados > 0)
+            pthread_cond_wait(&gz->cond, &gz->mutex);
+        for (i = 0; i < gz->numRanuras; i++)
+        {
+            gz->ranuras[i].marco = ULONG_MAX;
+            gz->ranuras[i].estado = RANURA_VACIA;
+        }
+        gz->siguiente = k;
+    }
+    else if (gz->siguiente < k)
+        gz->siguiente = k; // a jump forward: the frames before k are skipped
+    // the frames before k are not needed any more
+    gz->base = k;
+    gz->limite = (k + gz->numRanuras < gz->num) ? k + gz->numRanuras : gz->num;
+    pthread_cond_broadcast(&gz->cond);
+    while (ranura->marco != k || ranura->estado == RANURA_EN_CURSO)
+        pthread_cond_wait(&gz->cond, &gz->mutex);
+    pthread_mutex_unlock(&gz->mutex);
+    if (ranura->estado == RANURA_ERROR)
+    {
+        fprintf(stderr, "Error al descomprimir el marco %lu del fichero tar\n", k);
+        return NULL;
+    }
+    return ranura;
+}
+
+// Frame that holds the offset pos of the tar stream
+unsigned long BuscaMarcoGz(struct descompresor_tar *gz, unsigned long long pos)
+{
+    unsigned long izq = 0, der = gz->num;
+
+    while (der - izq > 1)
+    {
+        unsigned long medio = (izq + der) / 2;
+        if (gz->marcos[medio].uoff <= pos)
+            izq = medio;
+        else
+            der = medio;
+    }
+    return izq;
+}
+
+// Copy n bytes of the tar stream at the position of the reader to buff (or
+// to the file fd_DatFile if buff is NULL). Return the bytes copied.
+unsigned long long LeeLectorGz(struct lector_tar *lector, char *buff, int fd_DatFile, unsigned long long n)
+{
+    struct descompresor_tar *gz = lector->gz;
+    struct ranura_gz *ranura;
+    unsigned long long copiados = 0, tam, desp;
+    unsigned long k;
+
+    while (copiados < n && lector->pos < gz->tam)
+    {
+        k = BuscaMarcoGz(gz, lector->pos);
+        if ((ranura = ObtenMarcoGz(gz, k)) == NULL)
+            break;
+        desp = lector->pos - gz->marcos[k].uoff;
+        tam = gz->marcos[k].usize - desp;
+        if (tam > n - copiados)
+            tam = n - copiados;
+        if (buff != NULL)
+            memcpy(buff + copiados, ranura->datos + desp, tam);
+        else if (EscribeTodo(fd_DatFile, ranura->datos + desp, tam) != 0)
+            break;
+        copiados += tam;
+        lector->pos += tam;
+    }
+    return copiados;
+}
+
+// Return 1 if the tar file is compressed (gzip)
+int EsTarComprimido(int fd_TarFile)
+{
+    unsigned char magic[2];
+
+    return pread(fd_TarFile, magic, 2, 0) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+// A pipe (the tar file is "-") holds tam bytes, so a read of the buffer of
+// the reader or a write of the writer is not cut in pieces of 64KB. Only
+// a hint: the size may be over the limit of /proc/sys/fs/pipe-max-size.
+void AgrandaTuberia(int fd, unsigned long tam)
+{
+    struct stat sb;
+
+    if (fstat(fd, &sb) == 0 && S_ISFIFO(sb.st_mode))
+        fcntl(fd, F_SETPIPE_SZ, (int)tam);
+}
+
+// LECTOR_FLUJO: consume the next n bytes of the stream, copying them to
+// buff, or writing them to fd_DatFile, or nowhere (buff NULL and
+// fd_DatFile -1: data skipped). The stream is read in blocks of
+// lector->tamBuffer bytes. Return the bytes consumed.
+unsigned long long LeeFlujoTar(struct lector_tar *lector, char *buff, int fd_DatFile, unsigned long long n)
+{
+    unsigned long long hechos = 0;
+    unsigned long tam;
+    ssize_t leidos;
+
+    while (hechos < n)
+    {
+        if (lector->inicioBuffer == lector->finBuffer)
+        {
+            CuentaLlamadas(1);
+            if ((leidos = read(lector->fd, lector->buffer, lector->tamBuffer)) <= 0)
+            {
+                if (leidos == -1 && errno == EINTR)
+                    continue;
+                break;
+            }
+            lector->inicioBuffer = 0;
+            lector->finBuffer = leidos;
+        }
+        tam = lector->finBuffer - lector->inicioBuffer;
+        if (n - hechos < tam)
+            tam = n - hechos;
+        if (buff != NULL)
+            memcpy(buff + hechos, lector->buffer + lector->inicioBuffer, tam);
+        else if (fd_DatFile != -1 && EscribeTodo(fd_DatFile, lector->buffer + lector->inicioBuffer, tam) != 0)
+            break;
+        lector->inicioBuffer += tam;
+        lector->pos += tam;
+        hechos += tam;
+    }
+    return hechos;
+}
+
+//----------------------------------------------------------------------------
+// Reader of the tar file. Two backends, selected with -m:
+//   LECTOR_READ: headers are read() into lector->cabecera and data is
+//                skipped with lseek.
+//   LECTOR_MMAP: the tar file is mapped and headers are used in place.
+// A compressed tar file (-z) is always read by frames (LECTOR_GZIP), and
+// the offsets are in the decompressed tar stream. A tar file that can not
+// be seeked (a pipe) is read as a stream (LECTOR_FLUJO): blocks of
+// FactorBloqueo blocks are read into a buffer and skipped data is read
+// and discarded.
+int AbreLectorTar(struct lector_tar *lector, int fd_TarFile, int modo)
+{
+    struct stat sb;
+    ssize_t leidos;
+    void *mapa;
+
+    bzero(lector, sizeof(struct lector_tar));
+    lector->fd = fd_TarFile;
+    lector->modo = LECTOR_READ;
+    lector->pos = lseek(fd_TarFile, 0, SEEK_CUR);
+    if (lector->pos == (unsigned long long)-1 && errno == ESPIPE)
+    {
+        lector->pos = 0;
+        lector->tamBuffer = FactorBloqueo * DATAFILE_BLOCK_SIZE;
+        if (posix_memalign((void **)&lector->buffer, BUFFER_ALIGNMENT, lector->tamBuffer) != 0)
+        {
+            fprintf(stderr, "No se puede reservar el buffer de lectura (%lu bytes)\n", lector->tamBuffer);
+            lector->buffer = NULL;
+            return -1;
+        }
+        lector->modo = LECTOR_FLUJO;
+        AgrandaTuberia(fd_TarFile, lector->tamBuffer);
+        // the frames of -z are found by their offsets: gzip -d before
+        CuentaLlamadas(1);
+        if ((leidos = read(fd_TarFile, lector->buffer, lector->tamBuffer)) > 0)
+            lector->finBuffer = leidos;
+        if (lector->finBuffer >= 2 && (unsigned char)lector->buffer[0] == 0x1f && (unsigned char)lector->buffer[1] == 0x8b)
+        {
+            fprintf(stderr, "Un tar comprimido no se puede leer de una tuberia (descomprimalo antes con gzip -d)\n");
+            free(lector->buffer);
+            lector->buffer = NULL;
+            return -1;
+        }
+        return 0;
+    }
+    if (EsTarComprimido(fd_TarFile))
+    {
+        if ((lector->gz = malloc(sizeof(struct descompresor_tar))) == NULL ||
+            AbreDescompresorTar(lector->gz, fd_TarFile, NumHilosCompresion()) != 0)
+        {
+            if (lector->gz != NULL)
+                CierraDescompresorTar(lector->gz);
+            free(lector->gz);
+            lector->gz = NULL;
+            lector->modo = LECTOR_MMAP; // nothing to read
+            return -1;
+        }
+        lector->modo = LECTOR_GZIP;
+        lector->tam = lector->gz->tam;
+        lector->pos = 0;
+        return 0;
+    }
+    if (modo == LECTOR_MMAP && fstat(fd_TarFile, &sb) == 0 && sb.st_size > 0)
+    {
+        if ((mapa = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd_TarFile, 0)) == MAP_FAILED)
+        {
+            fprintf(stderr, "No se puede proyectar el fichero tar, se usa read()\n");
+            return 0;
+        }
+        madvise(mapa, sb.st_size, MADV_SEQUENTIAL);
+        lector->mapa = mapa;
+        lector->tam = sb.st_size;
+        lector->modo = LECTOR_MMAP;
+    }
+    return 0;
+}
+
+void CierraLectorTar(struct lector_tar *lector)
+{
+    if (lector->modo == LECTOR_FLUJO)
+    {
+        // the rest of the pipe is read, so its writer does not get SIGPIPE
+        LeeFlujoTar(lector, NULL, -1, ULLONG_MAX);
+        free(lector->buffer);
+        lector->buffer = NULL;
+    }
+    if (lector->mapa != NULL)
+        munmap((void *)lector->mapa, lector->tam);
+    lector->mapa = NULL;
+    if (lector->gz != NULL)
+    {
+        CierraDescompresorTar(lector->gz);
+        free(lector->gz);
+        lector->gz = NULL;
+    }
+    LiberaMapaDisperso(&lector->disperso);
+}
+
+// Add the entries of a sparse map (of the header or of an extended header)
+// to lector->disperso (the unused entries are zeros)
+void LeeEntradasDispersas(struct lector_tar *lector, const char (*campos)[24], int num)
+{
+    int i;
+
+    for (i = 0; i < num && campos[i][0] != '\0'; i++)
+        AniadeEntradaDispersa(&lector->disperso, DecodificaNumero(campos[i], 12), DecodificaNumero(campos[i] + 12, 12));
+}
+
+// Read the map of a sparse member: the entries of the header and of the
+// extended headers that follow it (the reader is left at the data)
+void LeeMapaDispersoTar(struct lector_tar *lector, const struct c_header_gnu_tar *pheaderData)
+{
+    struct c_sparse_gnu_tar extension;
+    int extendido = pheaderData->isextended[0];
+
+    lector->disperso.real = DecodificaNumero(pheaderData->realsize, sizeof(pheaderData->realsize));
+    LeeEntradasDispersas(lector, (const char (*)[24])pheaderData->sparse, SPARSE_HEADER_ENTRIES);
+    while (extendido)
+    {
+        if (lector->modo == LECTOR_MMAP)
+        {
+            if (lector->pos + sizeof(extension) > lector->tam)
+                break;
+            memcpy(&extension, lector->mapa + lector->pos, sizeof(extension));
+            lector->pos += sizeof(extension);
+        }
+        else if (lector->modo == LECTOR_GZIP)
+        {
+            if (LeeLectorGz(lector, (char *)&extension, -1, sizeof(extension)) != sizeof(extension))
+                break;
+        }
+        else if (lector->modo == LECTOR_FLUJO)
+        {
+            if (LeeFlujoTar(lector, (char *)&extension, -1, sizeof(extension)) != sizeof(extension))
+                break;
+        }
+        else
+        {
+            if (read(lector->fd, &extension, sizeof(extension)) != sizeof(extension))
+                break;
+            lector->pos += sizeof(extension);
+        }
+        LeeEntradasDispersas(lector, (const char (*)[24])extension.sparse, SPARSE_EXT_ENTRIES);
+        extendido = extension.isextended[0];
+    }
+}
+
+// Return the next header (NULL at the end of the file). The header is not
+// validated. The extended headers of a sparse member are read too, with
+// its map in lector->disperso.
+const struct c_header_gnu_tar *SiguienteCabeceraTar(struct lector_tar *lector)
+{
+    const struct c_header_gnu_tar *pheaderData;
+
+    if (lector->modo == LECTOR_MMAP)
+    {
+        if (lector->pos + sizeof(struct c_header_gnu_tar) > lector->tam)
+            return NULL;
+        pheaderData = (const struct c_header_gnu_tar *)(lector->mapa + lector->pos);
+        lector->pos += sizeof(struct c_header_gnu_tar);
+    }
+    else if (lector->modo == LECTOR_GZIP)
+    {
+        // (LeeLectorGz moves the reader)
+        if (LeeLectorGz(lector, (char *)&lector->cabecera, -1, sizeof(struct c_header_gnu_tar)) != sizeof(struct c_header_gnu_tar))
+            return NULL;
+        pheaderData = &lector->cabecera;
+    }
+    else if (lector->modo == LECTOR_FLUJO)
+    {
+        if (LeeFlujoTar(lector, (char *)&lector->cabecera, -1, sizeof(struct c_header_gnu_tar)) != sizeof(struct c_header_gnu_tar))
+            return NULL;
+        pheaderData = &lector->cabecera;
+    }
+    else
+    {
+        if (read(lector->fd, &lector->cabecera, sizeof(struct c_header_gnu_tar)) != sizeof(struct c_header_gnu_tar))
+            return NULL;
+        pheaderData = &lector->cabecera;
+        lector->pos += sizeof(struct c_header_gnu_tar);
+    }
+    lector->disperso.num = 0;
+    lector->disperso.datos = lector->disperso.real = 0;
+    if (pheaderData->typeflag[0] == 'S' && strcmp(pheaderData->magic, "ustar  ") == 0)
+        LeeMapaDispersoTar(lector, pheaderData);
+    return pheaderData;
+}
+
+// Move the reader to offset pos of the tar file (a stream only forwards)
+void SituaLectorTar(struct lector_tar *lector, unsigned long long pos)
+{
+    if (lector->modo == LECTOR_FLUJO)
+    {
+        if (pos < lector->pos)
+            fprintf(stderr, "No se puede volver atras en una tuberia (offset %llu)\n", pos);
+        else
+            LeeFlujoTar(lector, NULL, -1, pos - lector->pos);
+        return;
+    }
+    if (lector->modo == LECTOR_READ)
+        lseek(lector->fd, (off_t)pos, SEEK_SET);
+    lector->pos = pos;
+}
+
+void SaltaDatosTar(struct lector_tar *lector, unsigned long long n)
+{
+    SituaLectorTar(lector, lector->pos + n);
+}
+
+// Bytes of data (including the padding of the last block) after a header
+unsigned long long TamanioDatosTar(const struct c_header_gnu_tar *pheaderData)
+{
+    unsigned long long tamanio = 0;
+
+    if ((strncmp(pheaderData->typeflag, "5", 1) == 0) || (strncmp(pheaderData->typeflag, "2", 1) == 0))
+        return 0;
+    tamanio = DecodificaNumero(pheaderData->size, sizeof(pheaderData->size));
+    if (tamanio % DATAFILE_BLOCK_SIZE != 0)
+        tamanio += (DATAFILE_BLOCK_SIZE - (tamanio % DATAFILE_BLOCK_SIZE));
+    return tamanio;
+}
+
+// write n bytes of buff (write may write less bytes than requested)
+int EscribeTodo(int fd, const char *buff, unsigned long long n)
+{
+    ssize_t escritos;
+
+    while (n > 0)
+    {
+        CuentaLlamadas(1);
+        if ((escritos = write(fd, buff, (n > 0x40000000ULL) ? 0x40000000 : (size_t)n)) <= 0)
+        {
+            if (escritos == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buff += escritos;
+        n -= escritos;
+    }
+    return 0;
+}
+
+// pwrite of n bytes of buff at offset
+int EscribeTodoOffset(int fd, const char *buff, unsigned long long n, unsigned long long offset)
+{
+    ssize_t escritos;
+
+    while (n > 0)
+    {
+        CuentaLlamadas(1);
+        if ((escritos = pwrite(fd, buff, (n > 0x40000000ULL) ? 0x40000000 : (size_t)n, (off_t)offset)) <= 0)
+        {
+            if (escritos == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buff += escritos;
+        offset += escritos;
+        n -= escritos;
+    }
+    return 0;
+}
+
+// --io: a source file is read sequentially (more read-ahead) and its pages
+// are dropped from the page cache when it has been written to the tar file
+void AvisaFuente(int fd)
+{
+    if (PoliticaIO == IO_NORMAL)
+        return;
+    CuentaLlamadas(1);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+void CierraFuente(int fd)
+{
+    if (PoliticaIO != IO_NORMAL)
+    {
+        CuentaLlamadas(1);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    close(fd);
+}
+
+// Copy the next tam bytes of the reader (member data) to fd_DatFile
+int CopiaDatosLector(struct lector_tar *lector, int fd_DatFile, unsigned long long tam)
+{
+    unsigned long long pendientes = tam;
+    unsigned long tamBuff = FactorBloqueo * DATAFILE_BLOCK_SIZE;
+    uintptr_t inicio;
+    ssize_t leidos;
+    char *buff = NULL;
+    int ret = 0;
+
+    if (lector->modo == LECTOR_MMAP)
+    {
+        // write straight from the mapped tar file
+        if (lector->pos + tam > lector->tam)
+            return -1;
+        inicio = (uintptr_t)(lector->mapa + lector->pos) & ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+        madvise((void *)inicio, (uintptr_t)(lector->mapa + lector->pos + tam) - inicio, MADV_WILLNEED);
+        ret = EscribeTodo(fd_DatFile, lector->mapa + lector->pos, tam);
+        lector->pos += tam;
+        return ret;
+    }
+    if (lector->modo == LECTOR_GZIP)
+        return (LeeLectorGz(lector, NULL, fd_DatFile, tam) == tam) ? 0 : -1;
+    if (lector->modo == LECTOR_FLUJO)
+        return (LeeFlujoTar(lector, NULL, fd_DatFile, tam) == tam) ? 0 : -1;
+
+    // copy the data with a buffer of FactorBloqueo blocks
+    if (CopiaDirecta && pendientes >= tamBuff)
+        pendientes -= CopiaDatosDirecta(lector->fd, fd_DatFile, pendientes);
+    if (pendientes > 0 && posix_memalign((void **)&buff, BUFFER_ALIGNMENT, tamBuff) != 0)
+        return -1;
+    while (pendientes > 0)
+    {
+        CuentaLlamadas(1);
+        if ((leidos = read(lector->fd, buff, (pendientes < tamBuff) ? pendientes : tamBuff)) <= 0)
+        {
+            ret = -1;
+            break;
+        }
+        pendientes -= leidos;
+        if (EscribeTodo(fd_DatFile, buff, leidos) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    free(buff);
+    lector->pos = lseek(lector->fd, 0, SEEK_CUR);
+    return ret;
+}
+
+// Read tam bytes of data of the reader into buff
+int LeeDatosLector(struct lector_tar *lector, char *buff, unsigned long long tam)
+{
+    unsigned long long leidos = 0;
+    ssize_t n;
+
+    if (lector->modo == LECTOR_MMAP)
+    {
+        if (lector->pos + tam > lector->tam)
+            return -1;
+        memcpy(buff, lector->mapa + lector->pos, tam);
+        lector->pos += tam;
+        return 0;
+    }
+    if (lector->modo == LECTOR_GZIP)
+        return (LeeLectorGz(lector, buff, -1, tam) == tam) ? 0 : -1;
+    if (lector->modo == LECTOR_FLUJO)
+        return (LeeFlujoTar(lector, buff, -1, tam) == tam) ? 0 : -1;
+    while (leidos < tam && (n = read(lector->fd, buff + leidos, tam - leidos)) > 0)
+        leidos += n;
+    lector->pos += leidos;
+    return (leidos == tam) ? 0 : -1;
+}
+
+unsigned long writeHeader(int fd_TarFile, struct c_header_gnu_tar *pheaderData)
+{
+    unsigned long NumWriteBytes;
+    int n = 0, fase = EntraFase(FASE_CABECERA);
+    // write the data file (blocks of 512 bytes)
+    NumWriteBytes = 0;
+    if (IndiceTar.activo)
+        IndiceAniade(&IndiceTar, EscritorTar.pos, pheaderData);
+    if (EscribeEscritorTar(&EscritorTar, pheaderData, sizeof(struct c_header_gnu_tar)) == 0)
+        n = sizeof(struct c_header_gnu_tar);
+    NumWriteBytes = NumWriteBytes + sizeof(struct c_header_gnu_tar); // ojo!!!, no se escriben n
+    TRAZA(2, "Datos Escritos en HEADER: %d, Total :Escritos %ld\n", n, NumWriteBytes);
+    SaleFase(fase, n, 0);
+    return n;
+}
+// ----------------------------------------------------------------
+// Walk of a directory tree with openat/fstatat relative to the directory
+// fds, so the kernel resolves one name per entry and not the whole path.
+// The entries are read with getdents64 and d_type tells which entries are
+// directories without a stat (only DT_UNKNOWN entries are stat'ed here).
+// Every entry is passed to visita in depth first order (a directory
+// before its contents).
+
+// Directory open by the walker. The entries keep a reference, so the
+// workers of -j can still use fd after the walker has moved on.
+struct dir_ref
+{
+    int fd;
+    int refs;
+};
+
+struct dir_ref *AbreDirRef(int dirfd, const char *nombre)
+{
+    struct dir_ref *dir;
+    int fd;
+
+    if ((fd = openat(dirfd, nombre, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) == -1)
+        return NULL;
+    if ((dir = malloc(sizeof(struct dir_ref))) == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    dir->fd = fd;
+    dir->refs = 1;
+    return dir;
+}
+
+void RetieneDirRef(struct dir_ref *dir)
+{
+    __atomic_add_fetch(&dir->refs, 1, __ATOMIC_RELAXED);
+}
+
+void LiberaDirRef(struct dir_ref *dir)
+{
+    if (dir != NULL && __atomic_sub_fetch(&dir->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        close(dir->fd);
+        free(dir);
+    }
+}
+
+// fstatat of an entry (without following a symbolic link), in FASE_STAT
+int StatEntrada(int dirfd, const char *nombre, struct stat *st)
+{
+    int fase = EntraFase(FASE_STAT), ret;
+
+    ret = fstatat(dirfd, nombre, st, AT_SYMLINK_NOFOLLOW);
+    CuentaLlamadas(1);
+    SaleFase(fase, 0, 1);
+    return ret;
+}
+
+// visita(ctx, dir, name in dir, name in the tar, d_type). A return value
+// other than 0 stops the walk.
+typedef int (*visita_arbol)(void *ctx, struct dir_ref *dir, const char *nombre, const char *ruta, unsigned char d_type);
+
+int RecorreArbol(struct dir_ref *dir, const char *ruta, visita_arbol visita, void *ctx)
+{
+    struct dirent64 *entrada;
+    struct dir_ref *subdir;
+    struct stat st;
+    char hijo[PATH_MAX];
+    unsigned char d_type;
+    char *buffer;
+    ssize_t n, i;
+    int ret = 0;
+    size_t lon = strlen(ruta);
+
+    if ((buffer = malloc(GETDENTS_BUFFER_SIZE)) == NULL)
+        return ERROR_GENERATE_TAR_FILE;
+    while (ret == 0 && (n = getdents64(dir->fd, buffer, GETDENTS_BUFFER_SIZE)) > 0)
+    {
+        for (i = 0; ret == 0 && i < n; i += entrada->d_reclen)
+        {
+            entrada = (struct dirent64 *)(buffer + i);
+            if ((strcmp(entrada->d_name, "..") == 0) || (strcmp(entrada->d_name, ".") == 0))
+                continue;
+            snprintf(hijo, sizeof(hijo), "%s%s%s", ruta, (lon > 0 && ruta[lon - 1] == '/') ? "" : "/", entrada->d_name);
+            if (strlen(hijo) >= sizeof(((struct c_header_gnu_tar *)0)->name))
+            {
+                fprintf(stderr, "Nombre demasiado largo, no se incluye: %s\n", hijo);
+                continue;
+            }
+            d_type = entrada->d_type;
+            if (d_type == DT_UNKNOWN) // the file system does not fill d_type
+            {
+                if (StatEntrada(dir->fd, entrada->d_name, &st) == -1)
+                    continue;
+                d_type = IFTODT(st.st_mode);
+            }
+            if ((ret = visita(ctx, dir, entrada->d_name, hijo, d_type)) != 0)
+                break;
+            if (d_type == DT_DIR)
+            {
+                if ((subdir = AbreDirRef(dir->fd, entrada->d_name)) == NULL)
+                {
+                    fprintf(stderr, "No se puede abrir el directorio %s\n", hijo);
+                    continue;
+                }
+                ret = RecorreArbol(subdir, hijo, visita, ctx);
+                LiberaDirRef(subdir);
+            }
+        }
+    }
+    // (-1 is an error of the directory, not its end)
+    if (ret == 0 && n == -1)
+    {
+        fprintf(stderr, "No se puede leer el directorio %s\n", ruta);
+        ret = ERROR_OPEN_DAT_FILE;
+    }
+    free(buffer);
+    return ret;
+}
+
+// Insertion of small regular files with io_uring (-u): the file nombre of
+// dir is added to the batch (its member is written by VaciaInsercionUring,
+// in order). Return -1 if it has to be written by the synchronous path
+// (after VaciaInsercionUring).
+int EncolaInsercionUring(struct lote_uring *lote, int f_mytar, struct dir_ref *dir, const char *nombre,
+                         const struct c_header_gnu_tar *pTarHeader, const struct stat *st)
+{
+    struct op_uring *op;
+    int ret = 0;
+
+    // sparse files go through LeeMapaDisperso
+    if (!lote->activo || !S_ISREG(st->st_mode) || st->st_size > URING_MAX_FILE ||
+        (unsigned long long)st->st_blocks * 512 < (unsigned long long)st->st_size || strlen(nombre) >= sizeof(op->nombre))
+        return -1;
+    // (an error stops the walk: the entry is not queued)
+    if (lote->num == URING_DEPTH && (ret = VaciaInsercionUring(lote, f_mytar)) != 0)
+        return ret;
+    op = &lote->ops[lote->num];
+    op->cabecera = *pTarHeader;
+    strcpy(op->nombre, nombre);
+    op->dir = dir;
+    RetieneDirRef(dir);
+    op->tam = st->st_size;
+    EncolaOpUring(lote, lote->num, dir->fd, O_RDONLY | O_NOFOLLOW, 0, IORING_OP_READ, op->buffer);
+    lote->num++;
+    return ret;
+}
+
+// Run the batch and write its members in order
+int VaciaInsercionUring(struct lote_uring *lote, int f_mytar)
+{
+    struct hash_dedup hash;
+    struct op_uring *op;
+    unsigned int i;
+    int ret = 0, fase, fd;
+    ssize_t n;
+
+    if (lote->num == 0)
+        return 0;
+    fase = EntraFase(FASE_DATOS);
+    if (EsperaAnilloTar(&lote->anillo, ResultadoUring, lote) != 0)
+    {
+        // the results are not known: all the batch by the synchronous path
+        fprintf(stderr, "Error de io_uring al leer los ficheros\n");
+        for (i = 0; i < lote->num; i++)
+            lote->ops[i].resAbre = -ECANCELED;
+    }
+    for (i = 0; i < lote->num; i++)
+    {
+        op = &lote->ops[i];
+        if (op->resAbre < 0 && !EscritorTar.error)
+        {
+            lote->sincronos++;
+            CuentaLlamadas(3); // openat, read, close
+            if ((fd = openat(op->dir->fd, op->nombre, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) != -1)
+            {
+                op->resAbre = 0;
+                for (op->resDatos = 0; op->resDatos < (int)op->tam; op->resDatos += n)
+                    if ((n = read(fd, op->buffer + op->resDatos, op->tam - op->resDatos)) <= 0)
+                        break;
+                close(fd);
+            }
+        }
+        LiberaDirRef(op->dir);
+        op->dir = NULL;
+    }
+    SaleFase(fase, 0, 0);
+    for (i = 0; i < lote->num; i++)
+    {
+        op = &lote->ops[i];
+        lote->ficheros++;
+        // a write error of the tar file stops the batch
+        if (EscritorTar.error)
+        {
+            ret = ERROR_GENERATE_TAR_FILE;
+            break;
+        }
+        // a file that can not be opened stops the walk, as in
+        // VisitaSecuencial: the members after it are not written
+        if (op->resAbre < 0)
+        {
+            fprintf(stderr, "No se puede abrir el fichero de datos %.100s\n", op->cabecera.name);
+            ret = ERROR_OPEN_DAT_FILE;
+            break;
+        }
+        // a file shorter than its header is completed with zeros
+        if (op->resDatos < (int)op->tam)
+            bzero(op->buffer + (op->resDatos > 0 ? op->resDatos : 0), op->tam - (op->resDatos > 0 ? op->resDatos : 0));
+        if (Deduplicar && op->tam > 0)
+        {
+            IniciaHashDedup(&hash);
+            ActualizaHashDedup(&hash, op->buffer, op->tam);
+            if (EnlazaDuplicado(f_mytar, &op->cabecera, -1, op->buffer, &hash, EscritorTar.pos))
+                continue;
+        }
+        writeHeader(f_mytar, &op->cabecera);
+        fase = EntraFase(FASE_DATOS);
+        EscribeEscritorTar(&EscritorTar, op->buffer, op->tam);
+        SaleFase(fase, op->tam, 1);
+        RellenaBloqueTar(op->tam);
+    }
+    lote->num = 0;
+    if (EscritorTar.error)
+        ret = ERROR_GENERATE_TAR_FILE;
+    return ret;
+}
+
+// Sequential ingestion: write the entry now
+int VisitaSecuencial(void *ctx, struct dir_ref *dir, const char *nombre, const char *ruta, unsigned char d_type)
+{
+    int f_mytar = *(int *)ctx;
+    struct c_header_gnu_tar my_tardat;
+    struct stat stattest;
+    int f_dat, ret, fase;
+
+    TRAZA(1, "%s\n", ruta);
+    // one stat per entry, for the type and for the header
+    if ((StatEntrada(dir->fd, nombre, &stattest) == -1) ||
+        (ConstruyeCabeceraTar(ruta, &stattest, dir->fd, nombre, &my_tardat) != HEADER_OK))
+    {
+        fprintf(stderr, "No se puede abrir el fichero de datos %s\n", ruta);
+        return ERROR_OPEN_DAT_FILE;
+    }
+    if (!CambiadoSnapshot(&Snapshot, ruta, &stattest))
+    {
+        TRAZA(1, "sin cambios: %s\n", ruta);
+        return 0;
+    }
+    // small files in batches (-u); the batch is written before any other member
+    if ((ret = EncolaInsercionUring(&LoteUring, f_mytar, dir, nombre, &my_tardat, &stattest)) != -1)
+        return ret;
+    if ((ret = VaciaInsercionUring(&LoteUring, f_mytar)) != 0)
+        return ret;
+    if (S_ISDIR(stattest.st_mode) || S_ISLNK(stattest.st_mode))
+    {
+        writeHeader(f_mytar, &my_tardat);
+        return EscritorTar.error ? ERROR_GENERATE_TAR_FILE : 0;
+    }
+    fase = EntraFase(FASE_DATOS); // open and close of the file
+    CuentaLlamadas(1);
+    if ((f_dat = openat(dir->fd, nombre, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1)
+    {
+        fprintf(stderr, "No se puede abrir el fichero de datos %s\n", ruta);
+        SaleFase(fase, 0, 0);
+        return ERROR_OPEN_DAT_FILE;
+    }
+    EscribeFicheroTar(f_mytar, f_dat, &my_tardat, &stattest);
+    CierraFuente(f_dat);
+    CuentaLlamadas(1);
+    SaleFase(fase, 0, 0);
+    // a write error of the tar file stops the walk
+    return EscritorTar.error ? ERROR_GENERATE_TAR_FILE : 0;
+}
+
+// ----------------------------------------------------------------
+// Directory ingestion with -j N threads. A walker thread lists the tree,
+// the workers stat the entries, build the headers and read the files
+// (prefetch) while the writer (the caller) appends the members to the tar
+// file in the order of the walk. At most VENTANA_INGESTA members are in
+// flight and at most PREFETCH_MAX_MEMORY bytes are prefetched; files bigger
+// than PREFETCH_MAX_FILE are only opened by the workers and copied by the
+// writer.
+#define MIEMBRO_PENDIENTE (0)
+#define MIEMBRO_LISTO (1)
+#define MIEMBRO_ERROR (2)
+
+struct miembro_tar
+{
+    char *ruta;          // name in the tar
+    const char *nombre;  // name in dir (end of ruta)
+    struct dir_ref *dir; // directory of the entry
+    struct c_header_gnu_tar cabecera;
+    char *datos;       // prefetched data (NULL if none)
+    unsigned long tam; // bytes of datos (file size)
+    int fd;            // big files: open file (-1 if none)
+    int omitir;        // unchanged since the snapshot (-g): not written
+    int estado;        // MIEMBRO_PENDIENTE, MIEMBRO_LISTO or MIEMBRO_ERROR
+};
+
+struct ingesta_tar
+{
+    struct dir_ref *raiz;       // directory to insert
+    const char *nombreRaiz;     // its name in the tar
+    struct miembro_tar *huecos; // VENTANA_INGESTA slots (member i in i % VENTANA_INGESTA)
+    unsigned long num;          // members found by the walker
+    unsigned long siguiente;    // next member for a worker
+    unsigned long escrito;      // next member for the writer
+    unsigned long memoria;      // bytes prefetched and not written yet
+    int finRecorrido;           // the walker has finished
+    int errorRecorrido;         // what RecorreArbol returned (0: the whole tree)
+    int abortar;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+// Walker: add the entry to the slots (waits for a free slot)
+int VisitaIngesta(void *ctx, struct dir_ref *dir, const char *nombre, const char *ruta, unsigned char d_type)
+{
+    struct ingesta_tar *ingesta = ctx;
+    struct miembro_tar *miembro;
+    char *copia;
+
+    if ((copia = strdup(ruta)) == NULL)
+        return ERROR_GENERATE_TAR_FILE;
+    pthread_mutex_lock(&ingesta->mutex);
+    while (!ingesta->abortar && ingesta->num >= ingesta->escrito + VENTANA_INGESTA)
+        pthread_cond_wait(&ingesta->cond, &ingesta->mutex);
+    if (ingesta->abortar)
+    {
+        pthread_mutex_unlock(&ingesta->mutex);
+        free(copia);
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    miembro = &ingesta->huecos[ingesta->num % VENTANA_INGESTA];
+    miembro->ruta = copia;
+    miembro->nombre = copia + strlen(copia) - strlen(nombre);
+    miembro->dir = dir;
+    miembro->datos = NULL;
+    miembro->tam = 0;
+    miembro->fd = -1;
+    miembro->omitir = 0;
+    miembro->estado = MIEMBRO_PENDIENTE;
+    RetieneDirRef(dir);
+    ingesta->num++;
+    pthread_cond_broadcast(&ingesta->cond);
+    pthread_mutex_unlock(&ingesta->mutex);
+    return 0;
+}
+
+void *RecorredorIngesta(void *arg)
+{
+    struct ingesta_tar *ingesta = arg;
+    int ret;
+
+    ret = RecorreArbol(ingesta->raiz, ingesta->nombreRaiz, VisitaIngesta, ingesta);
+    pthread_mutex_lock(&ingesta->mutex);
+    ingesta->errorRecorrido = ret;
+    ingesta->finRecorrido = 1;
+    pthread_cond_broadcast(&ingesta->cond);
+    pthread_mutex_unlock(&ingesta->mutex);
+    return NULL;
+}
+
+// Build the header of member i and open or read its data
+void PreparaMiembro(struct ingesta_tar *ingesta, unsigned long i)
+{
+    struct miembro_tar *miembro = &ingesta->huecos[i % VENTANA_INGESTA];
+    unsigned long leidos = 0;
+    struct stat st;
+    ssize_t n;
+    int fd = -1, fase;
+
+    miembro->datos = NULL;
+    miembro->tam = 0;
+    miembro->fd = -1;
+    miembro->omitir = 0;
+    // an unchanged file (-g) is not opened
+    if ((StatEntrada(miembro->dir->fd, miembro->nombre, &st) == -1) ||
+        (ConstruyeCabeceraTar(miembro->ruta, &st, miembro->dir->fd, miembro->nombre, &miembro->cabecera) != HEADER_OK) ||
+        (!(miembro->omitir = !CambiadoSnapshot(&Snapshot, miembro->ruta, &st)) &&
+         !S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode) &&
+         (fd = openat(miembro->dir->fd, miembro->nombre, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1))
+    {
+        fprintf(stderr, "No se puede abrir el fichero de datos %s\n", miembro->ruta);
+        miembro->estado = MIEMBRO_ERROR;
+    }
+    LiberaDirRef(miembro->dir);
+    miembro->dir = NULL;
+    if (fd == -1)
+        return;
+    fase = EntraFase(FASE_DATOS); // the bytes are counted by the writer
+    CuentaLlamadas(1);            // openat
+    SaleFase(fase, 0, 0);
+
+    miembro->tam = DecodificaNumero(miembro->cabecera.size, sizeof(miembro->cabecera.size));
+    if (miembro->tam > PREFETCH_MAX_FILE)
+    {
+        miembro->fd = fd;
+        miembro->tam = 0;
+        return;
+    }
+
+    // back-pressure: wait for memory (the next member of the writer never waits)
+    pthread_mutex_lock(&ingesta->mutex);
+    while (!ingesta->abortar && i != ingesta->escrito && ingesta->memoria + miembro->tam > PREFETCH_MAX_MEMORY)
+        pthread_cond_wait(&ingesta->cond, &ingesta->mutex);
+    ingesta->memoria += miembro->tam;
+    pthread_mutex_unlock(&ingesta->mutex);
+
+    // a file shorter than its header is completed with zeros
+    if ((miembro->datos = calloc(1, miembro->tam + 1)) == NULL)
+    {
+        close(fd);
+        miembro->estado = MIEMBRO_ERROR;
+        return;
+    }
+    fase = EntraFase(FASE_DATOS);
+    while (leidos < miembro->tam && (n = read(fd, miembro->datos + leidos, miembro->tam - leidos)) > 0)
+    {
+        CuentaLlamadas(1);
+        leidos += n;
+    }
+    CierraFuente(fd);
+    CuentaLlamadas(1);
+    SaleFase(fase, 0, 0);
+}
+
+void *TrabajadorIngesta(void *arg)
+{
+    struct ingesta_tar *ingesta = arg;
+    unsigned long i;
+
+    pthread_mutex_lock(&ingesta->mutex);
+    while (1)
+    {
+        while (!ingesta->abortar && ingesta->siguiente >= ingesta->num && !ingesta->finRecorrido)
+            pthread_cond_wait(&ingesta->cond, &ingesta->mutex);
+        if (ingesta->abortar || ingesta->siguiente >= ingesta->num)
+            break;
+        i = ingesta->siguiente++;
+        pthread_mutex_unlock(&ingesta->mutex);
+
+        PreparaMiembro(ingesta, i);
+
+        pthread_mutex_lock(&ingesta->mutex);
+        if (ingesta->huecos[i % VENTANA_INGESTA].estado == MIEMBRO_PENDIENTE)
+            ingesta->huecos[i % VENTANA_INGESTA].estado = MIEMBRO_LISTO;
+        pthread_cond_broadcast(&ingesta->cond);
+    }
+    pthread_mutex_unlock(&ingesta->mutex);
+    return NULL;
+}
+
+// Write the tree of dir (named filename in the tar) with Hilos worker threads
+int inserta_directorio_hilos(int f_mytar, struct dir_ref *dir, char *filename)
+{
+    struct ingesta_tar ingesta;
+    struct miembro_tar *miembro;
+    pthread_t recorredor, *hilos;
+    unsigned long i;
+    unsigned int h, creados = 0;
+    struct hash_dedup hash;
+    struct stat st;
+    int ret = 0, recorredorCreado = 0, fin, fase;
+
+    bzero(&ingesta, sizeof(ingesta));
+    ingesta.raiz = dir;
+    ingesta.nombreRaiz = filename;
+    ingesta.huecos = calloc(VENTANA_INGESTA, sizeof(struct miembro_tar));
+    hilos = calloc(Hilos, sizeof(pthread_t));
+    if (ingesta.huecos == NULL || hilos == NULL)
+    {
+        free(ingesta.huecos);
+        free(hilos);
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    pthread_mutex_init(&ingesta.mutex, NULL);
+    pthread_cond_init(&ingesta.cond, NULL);
+    if (pthread_create(&recorredor, NULL, RecorredorIngesta, &ingesta) != 0)
+        ret = ERROR_GENERATE_TAR_FILE;
+    else
+        recorredorCreado = 1;
+    for (h = 0; ret == 0 && h < Hilos; h++)
+    {
+        if (pthread_create(&hilos[h], NULL, TrabajadorIngesta, &ingesta) != 0)
+            break;
+        creados++;
+    }
+    if (ret == 0 && creados == 0)
+        ret = ERROR_GENERATE_TAR_FILE;
+
+    // writer: members in order
+    for (i = 0; ret == 0; i++)
+    {
+        miembro = &ingesta.huecos[i % VENTANA_INGESTA];
+        pthread_mutex_lock(&ingesta.mutex);
+        while (!(i < ingesta.siguiente && miembro->estado != MIEMBRO_PENDIENTE) &&
+               !(ingesta.finRecorrido && i >= ingesta.num))
+            pthread_cond_wait(&ingesta.cond, &ingesta.mutex);
+        fin = (i >= ingesta.num); // end of the walk
+        pthread_mutex_unlock(&ingesta.mutex);
+        if (fin)
+            break;
+
+        TRAZA(1, "%s\n", miembro->ruta);
+        if (miembro->estado == MIEMBRO_ERROR)
+        {
+            ret = ERROR_OPEN_DAT_FILE;
+            break;
+        }
+        if (miembro->omitir)
+            TRAZA(1, "sin cambios: %s\n", miembro->ruta);
+        else if (miembro->fd != -1 && fstat(miembro->fd, &st) == 0)
+        {
+            // big file (not read by the worker): may be sparse
+            EscribeFicheroTar(f_mytar, miembro->fd, &miembro->cabecera, &st);
+            CierraFuente(miembro->fd);
+            miembro->fd = -1;
+        }
+        else if (miembro->datos != NULL && Deduplicar && miembro->tam > 0)
+        {
+            // prefetched: hashed before it is written
+            IniciaHashDedup(&hash);
+            ActualizaHashDedup(&hash, miembro->datos, miembro->tam);
+            if (EnlazaDuplicado(f_mytar, &miembro->cabecera, -1, miembro->datos, &hash, EscritorTar.pos))
+            {
+                free(miembro->datos);
+                miembro->datos = NULL;
+            }
+            else
+                writeHeader(f_mytar, &miembro->cabecera);
+        }
+        else
+            writeHeader(f_mytar, &miembro->cabecera);
+        if (miembro->datos != NULL)
+        {
+            fase = EntraFase(FASE_DATOS);
+            EscribeEscritorTar(&EscritorTar, miembro->datos, miembro->tam);
+            SaleFase(fase, miembro->tam, 1);
+            RellenaBloqueTar(miembro->tam);
+            free(miembro->datos);
+            miembro->datos = NULL;
+        }
+        else if (miembro->fd != -1)
+        {
+            WriteFileDataBlocks(miembro->fd, f_mytar, DecodificaNumero(miembro->cabecera.size, sizeof(miembro->cabecera.size)));
+            CierraFuente(miembro->fd);
+            miembro->fd = -1;
+        }
+        free(miembro->ruta);
+        miembro->ruta = NULL;
+
+        pthread_mutex_lock(&ingesta.mutex);
+        ingesta.memoria -= miembro->tam;
+        ingesta.escrito = i + 1;
+        pthread_cond_broadcast(&ingesta.cond);
+        pthread_mutex_unlock(&ingesta.mutex);
+        // a write error of the tar file stops the workers
+        if (EscritorTar.error)
+            ret = ERROR_GENERATE_TAR_FILE;
+    }
+
+    pthread_mutex_lock(&ingesta.mutex);
+    ingesta.abortar = 1;
+    pthread_cond_broadcast(&ingesta.cond);
+    pthread_mutex_unlock(&ingesta.mutex);
+    for (h = 0; h < creados; h++)
+        pthread_join(hilos[h], NULL);
+    if (recorredorCreado)
+        pthread_join(recorredor, NULL);
+    // a walk that stopped early: the members found before are written,
+    // as in the sequential walk, and its error is returned
+    if (ret == 0)
+        ret = ingesta.errorRecorrido;
+
+    // members found but not written (error)
+    for (i = ingesta.escrito; i < ingesta.num; i++)
+    {
+        miembro = &ingesta.huecos[i % VENTANA_INGESTA];
+        free(miembro->ruta);
+        free(miembro->datos);
+        if (miembro->fd != -1)
+            close(miembro->fd);
+        LiberaDirRef(miembro->dir);
+    }
+    free(ingesta.huecos);
+    free(hilos);
+    pthread_mutex_destroy(&ingesta.mutex);
+    pthread_cond_destroy(&ingesta.cond);
+    return ret;
+}
+
+// Return 1 if the bytes of [desde, hasta) of the tar file are zeros
+int SonCerosTar(int f_mytar, unsigned long long desde, unsigned long long hasta)
+{
+    char buffer[TAR_FILE_BLOCK_SIZE];
+    unsigned long long tam;
+    ssize_t n;
+
+    while (desde < hasta)
+    {
+        tam = (hasta - desde < sizeof(buffer)) ? hasta - desde : sizeof(buffer);
+        if ((n = pread(f_mytar, buffer, tam, desde)) <= 0)
+            return 0;
+        if (buffer[0] != 0 || memcmp(buffer, buffer + 1, n - 1) != 0)
+            return 0;
+        desde += n;
+    }
+    return 1;
+}
+
+// Number of extended headers of the sparse member whose header is at
+// offset (-1 if they can not be read)
+long ExtensionesDispersasTar(int f_mytar, unsigned long long offset, const struct c_header_gnu_tar *pheaderData)
+{
+    struct c_sparse_gnu_tar extension;
+    int extendido = (pheaderData->typeflag[0] == 'S') && pheaderData->isextended[0];
+    long n = 0;
+
+    while (extendido)
+    {
+        n++;
+        if (pread(f_mytar, &extension, sizeof(extension), offset + n * DATAFILE_BLOCK_SIZE) != sizeof(extension))
+            return -1;
+        extendido = extension.isextended[0];
+    }
+    return n;
+}
+
+// End of the archive using the member index: the last entry has to be the
+// last header of the tar file and only zeros after its data
+int FinIndiceTar(int f_mytar, unsigned long tamano, unsigned long long *fin)
+{
+    struct c_index_tar_entry *ultima = &IndiceTar.entradas[IndiceTar.num - 1];
+    struct c_header_gnu_tar cabecera;
+    long ext;
+
+    if ((IndiceTar.fin + END_TAR_ARCHIVE_ENTRY_SIZE > tamano) ||
+        (tamano - IndiceTar.fin > END_TAR_ARCHIVE_ENTRY_SIZE + TAR_FILE_BLOCK_SIZE) ||
+        (pread(f_mytar, &cabecera, sizeof(cabecera), ultima->offset) != sizeof(cabecera)) ||
+        !CabeceraValida(&cabecera) ||
+        (strncmp(cabecera.name, ultima->name, sizeof(cabecera.name)) != 0) ||
+        ((ext = ExtensionesDispersasTar(f_mytar, ultima->offset, &cabecera)) < 0) ||
+        (ultima->offset + (1 + ext) * sizeof(cabecera) + TamanioDatosTar(&cabecera) != IndiceTar.fin) ||
+        !SonCerosTar(f_mytar, IndiceTar.fin, tamano))
+        return 1;
+    *fin = IndiceTar.fin;
+    return 0;
+}
+
+// Check that the header at candidato starts a member: walk the headers
+// from the first member (offset 0) skipping their data, the ones at or
+// after inicio from buffer (the tail already read). Return 1 if the walk
+// does not land on candidato, e.g. the candidate is in the data of a tar
+// file stored in the archive and the header of that member is before the
+// window.
+int CadenaTar(int f_mytar, unsigned long long candidato, const char *buffer, unsigned long long inicio)
+{
+    struct c_header_gnu_tar cabecera;
+    const struct c_header_gnu_tar *pCabecera;
+    unsigned long long offset = 0;
+    long ext;
+
+    while (offset < candidato)
+    {
+        if (offset >= inicio)
+            pCabecera = (const struct c_header_gnu_tar *)(buffer + (offset - inicio));
+        else if (pread(f_mytar, &cabecera, sizeof(cabecera), offset) == sizeof(cabecera))
+            pCabecera = &cabecera;
+        else
+            return 1;
+        if (!CabeceraValida(pCabecera) || (ext = ExtensionesDispersasTar(f_mytar, offset, pCabecera)) < 0)
+            return 1;
+        offset += (1 + ext) * DATAFILE_BLOCK_SIZE + TamanioDatosTar(pCabecera);
+    }
+    return offset != candidato;
+}
+
+// End of the archive from the tail of the file: skip the zeros of the end
+// of archive blocks and of the padding to find the last block with data,
+// then look backwards (at most TAIL_SCAN_WINDOW bytes) for the header whose
+// data includes that block. The candidate is taken only if the headers
+// from the first member lead to it (CadenaTar); with a member index
+// FinIndiceTar is used instead. Return 1 if the tail is ambiguous:
+//  - no zero blocks or more than a tar record of zeros (other writer, or
+//    the data of the last member ends with zeros)
+//  - no valid header in the window
+//  - another header before it whose data would include it (e.g. the last
+//    member is itself a tar file)
+//  - the candidate is not on the chain of headers
+int FinColaTar(int f_mytar, unsigned long tamano, unsigned long long *fin)
+{
+    struct c_header_gnu_tar *pCabecera;
+    unsigned long long inicio, ultimo, candidato = 0, fin_candidato = 0, fin_bloque;
+    unsigned long tam, bloque, i, ext;
+    char *buffer;
+    int ret = 1, extendido;
+
+    if (tamano % DATAFILE_BLOCK_SIZE != 0 || tamano < FILE_HEADER_SIZE + END_TAR_ARCHIVE_ENTRY_SIZE)
+        return 1;
+    tam = (tamano < TAIL_SCAN_WINDOW) ? tamano : TAIL_SCAN_WINDOW;
+    inicio = tamano - tam;
+    if ((buffer = malloc(tam)) == NULL)
+        return 1;
+    if (pread(f_mytar, buffer, tam, inicio) != (ssize_t)tam)
+    {
+        free(buffer);
+        return 1;
+    }
+
+    // last block with data
+    for (bloque = tam / DATAFILE_BLOCK_SIZE; bloque > 0; bloque--)
+    {
+        char *p = buffer + (bloque - 1) * DATAFILE_BLOCK_SIZE;
+        if (p[0] != 0 || memcmp(p, p + 1, DATAFILE_BLOCK_SIZE - 1) != 0)
+            break;
+    }
+    if (bloque == 0)
+    {
+        free(buffer);
+        return 1;
+    }
+    ultimo = inicio + bloque * DATAFILE_BLOCK_SIZE; // end of the last block with data
+    if (tamano - ultimo < END_TAR_ARCHIVE_ENTRY_SIZE ||
+        tamano - ultimo > END_TAR_ARCHIVE_ENTRY_SIZE + TAR_FILE_BLOCK_SIZE)
+    {
+        free(buffer);
+        return 1;
+    }
+
+    // headers, backwards
+    for (i = bloque; i > 0; i--)
+    {
+        pCabecera = (struct c_header_gnu_tar *)(buffer + (i - 1) * DATAFILE_BLOCK_SIZE);
+        if (!CabeceraValida(pCabecera))
+            continue;
+        // the extended headers of a sparse member are before its data
+        for (ext = 0, extendido = (pCabecera->typeflag[0] == 'S') && pCabecera->isextended[0]; extendido; )
+        {
+            if (i + ext >= tam / DATAFILE_BLOCK_SIZE)
+                break;
+            extendido = ((struct c_sparse_gnu_tar *)(buffer + (i + ext) * DATAFILE_BLOCK_SIZE))->isextended[0];
+            ext++;
+        }
+        if (extendido)
+        {
+            ret = 1; // the map goes beyond the window
+            break;
+        }
+        fin_bloque = inicio + (i + ext) * DATAFILE_BLOCK_SIZE + TamanioDatosTar(pCabecera);
+        if (fin_candidato == 0)
+        {
+            // the last member: its data ends after the last block with data
+            // and before the end of archive blocks
+            if (fin_bloque >= ultimo && fin_bloque + END_TAR_ARCHIVE_ENTRY_SIZE <= tamano)
+            {
+                candidato = inicio + (i - 1) * DATAFILE_BLOCK_SIZE;
+                fin_candidato = fin_bloque;
+                ret = 0;
+            }
+        }
+        else if (fin_bloque > candidato)
+        {
+            // the candidate is in the data of this member
+            TRAZA(2, "cola ambigua: cabecera en %llu dentro de %llu\n", candidato, inicio + (i - 1) * DATAFILE_BLOCK_SIZE);
+            ret = 1;
+            break;
+        }
+    }
+    if (ret == 0 && CadenaTar(f_mytar, candidato, buffer, inicio) != 0)
+    {
+        TRAZA(2, "cola ambigua: la cabecera en %llu no sigue a las anteriores\n", candidato);
+        ret = 1;
+    }
+    free(buffer);
+    if (ret == 0)
+    {
+        TRAZA(2, "fin del tar desde la cola: ultima cabecera en %llu, fin en %llu\n", candidato, fin_candidato);
+        *fin = fin_candidato;
+    }
+    return ret;
+}
+
+// End of the archive (offset of the end of archive blocks) without reading
+// all the headers: from the member index if it is loaded, or from the tail
+// of the file. Return 1 if the forward scan is needed.
+int BuscaFinTar(int f_mytar, unsigned long tamano, unsigned long long *fin)
+{
+    if (IndiceTar.num > 0)
+    {
+        if (FinIndiceTar(f_mytar, tamano, fin) == 0)
+            return 0;
+        // rebuild the index with the forward scan
+        fprintf(stderr, "Indice desactualizado, se recorre el tar\n");
+        LiberaIndiceTar(&IndiceTar);
+        IndiceTar.activo = 1;
+        return 1;
+    }
+    if (IndiceTar.activo) // new index: all the headers are needed
+        return 1;
+    return FinColaTar(f_mytar, tamano, fin);
+}
+
+// Open the writer at the end of the archive: after the last member of
+// f_mytar (tamano bytes, 0 for a new tar file), where the end of archive
+// blocks start
+int AbreFinTar(int f_mytar, unsigned long long tamano)
+{
+    const struct c_header_gnu_tar *pCabecera;
+    struct lector_tar lector;
+    unsigned long long fin = 0, inicio;
+    int val = 0;
+
+    // the last frame of a compressed tar would have to be compressed again
+    if (tamano != 0 && (Comprimir || EsTarComprimido(f_mytar)))
+    {
+        fprintf(stderr, "No se puede añadir a un tar comprimido (-z solo al crear el tar)\n");
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    // encontrar fin del fichero + mover apuntador
+    if (tamano != 0 && BuscaFinTar(f_mytar, tamano, &fin) == 0)
+    {
+        lseek(f_mytar, (off_t)fin, SEEK_SET);
+    }
+    else if (tamano != 0)
+    {
+        AbreLectorTar(&lector, f_mytar, ModoLector);
+        while ((inicio = lector.pos, pCabecera = SiguienteCabeceraTar(&lector)) != NULL)
+        {
+            if ((strcmp(pCabecera->magic, "ustar  ") != 0))
+            {
+                break;
+            }
+            else
+            {
+                val += 1;
+                if (IndiceTar.activo)
+                    IndiceAniade(&IndiceTar, inicio, pCabecera);
+                SaltaDatosTar(&lector, TamanioDatosTar(pCabecera));
+                fin = lector.pos;
+            }
+        }
+        CierraLectorTar(&lector);
+        if (val == 0)
+        {
+            fprintf(stderr, "Formato erroneo de: %i\n", f_mytar);
+            return -3;
+        }
+        lseek(f_mytar, (off_t)fin, SEEK_SET);
+    }
+    // (fin: 0 for a new tar file, that may be a pipe)
+    if (AbreEscritorTar(&EscritorTar, f_mytar, fin) != 0)
+        return ERROR_GENERATE_TAR_FILE;
+    return 0;
+}
+
+// --io: the tar file is preallocated (fallocate) for the members of
+// filename, with their sizes summed before they are written (a walk of
+// the tree for a directory), so it does not grow (and fragment) buffer by
+// buffer. The space not used (unchanged files of -g, hard links of -d) is
+// released when the writer truncates the tar file at the end.
+
+// Bytes of data of a regular file in the tar file (a sparse file only
+// stores its allocated blocks)
+unsigned long long TamanioPreasigna(const struct stat *st)
+{
+    unsigned long long tam = st->st_size;
+
+    if ((unsigned long long)st->st_blocks * 512 < tam)
+        tam = (unsigned long long)st->st_blocks * 512;
+    return (tam + DATAFILE_BLOCK_SIZE - 1) / DATAFILE_BLOCK_SIZE * DATAFILE_BLOCK_SIZE;
+}
+
+int VisitaPreasigna(void *ctx, struct dir_ref *dir, const char *nombre, const char *ruta, unsigned char d_type)
+{
+    unsigned long long *total = ctx;
+    struct stat st;
+
+    *total += FILE_HEADER_SIZE;
+    if (d_type == DT_REG && StatEntrada(dir->fd, nombre, &st) == 0)
+        *total += TamanioPreasigna(&st);
+    return 0;
+}
+
+void PreasignaTar(int f_mytar, const char *filename, const struct stat *st)
+{
+    unsigned long long total = FILE_HEADER_SIZE + END_TAR_ARCHIVE_ENTRY_SIZE + TAR_FILE_BLOCK_SIZE;
+    struct dir_ref *dir;
+
+    if (!EscritorTar.soltar)
+        return;
+    if (S_ISREG(st->st_mode))
+        total += TamanioPreasigna(st);
+    else if (S_ISDIR(st->st_mode) && (dir = AbreDirRef(AT_FDCWD, filename)) != NULL)
+    {
+        RecorreArbol(dir, filename, VisitaPreasigna, &total);
+        LiberaDirRef(dir);
+    }
+    CuentaLlamadas(1);
+    if (fallocate(f_mytar, 0, (off_t)EscritorTar.pos, (off_t)total) == 0)
+    {
+        TRAZA(2, "preasignados %llu bytes desde %llu\n", total, EscritorTar.pos);
+        EscritorTar.truncar = 1; // the tar file ends at pos when it is closed
+    }
+    else
+        TRAZA(1, "sin fallocate en el fichero tar: %s\n", strerror(errno));
+}
+
+// Add filename (a file, or a directory with all its tree, or a symbolic
+// link) to the writer. On error the writer is left open.
+int AniadeRutaTar(int f_mytar, char *filename)
+{
+    int ret, f_dat, fase;
+    unsigned long long n;
+    struct dir_ref *dir;
+    struct c_header_gnu_tar my_tardat;
+    struct stat stattest;
+
+    // one lstat of filename, for the type and for the header
+    if ((StatEntrada(AT_FDCWD, filename, &stattest) == -1) ||
+        (ConstruyeCabeceraTar(filename, &stattest, AT_FDCWD, filename, &my_tardat) != HEADER_OK))
+    {
+        fprintf(stderr, "No se puede abrir el fichero de datos %s\n", filename);
+        return ERROR_OPEN_DAT_FILE;
+    }
+    PreasignaTar(f_mytar, filename, &stattest);
+    if (!CambiadoSnapshot(&Snapshot, filename, &stattest))
+    {
+        TRAZA(1, "sin cambios: %s\n", filename);
+    }
+    else if (S_ISDIR(stattest.st_mode))
+    {
+        if ((dir = AbreDirRef(AT_FDCWD, filename)) == NULL)
+        {
+            fprintf(stderr, "No se puede abrir el directorio %s\n", filename);
+            return ERROR_OPEN_DAT_FILE;
+        }
+        n = writeHeader(f_mytar, &my_tardat);
+        // all the tree of filename
+        if (Hilos > 1)
+            ret = inserta_directorio_hilos(f_mytar, dir, filename);
+        else
+            ret = RecorreArbol(dir, filename, VisitaSecuencial, &f_mytar);
+        if ((n = VaciaInsercionUring(&LoteUring, f_mytar)) != 0 && ret == 0)
+            ret = n;
+        LiberaDirRef(dir);
+        if (ret != 0)
+            return ret;
+    }
+    else if (S_ISLNK(stattest.st_mode)) // comprobar si en enlace simbolico
+    {
+        n = writeHeader(f_mytar, &my_tardat);
+    }
+    else
+    {
+        fase = EntraFase(FASE_DATOS); // open and close of the file
+        CuentaLlamadas(2);
+        if ((f_dat = open(filename, O_RDONLY)) == -1)
+        {
+            fprintf(stderr, "No se puede abrir el fichero de datos %s\n", filename);
+            SaleFase(fase, 0, 0);
+            return ERROR_OPEN_DAT_FILE;
+        }
+        // escribir cabecera + archivo
+        n = EscribeFicheroTar(f_mytar, f_dat, &my_tardat, &stattest);
+
+        // escribir final
+        CierraFuente(f_dat);
+        SaleFase(fase, 0, 0);
+    }
+    // -g: the names of the snapshot that are gone
+    if (Snapshot.activo)
+        BorradosSnapshot(&Snapshot, f_mytar, filename, &stattest);
+    return EscritorTar.error ? ERROR_GENERATE_TAR_FILE : 0;
+}
+
+// Write the end of archive blocks and the padding to 10KB and close the
+// writer. *tamanoEscrito: size of the tar file.
+int CierraFinTar(int f_mytar, unsigned long long *tamanoEscrito)
+{
+    int ret, tam, fase;
+
+    tam = WriteEndTarArchive(f_mytar);
+
+    // size of the tar file: offset of the writer
+    *tamanoEscrito = EscritorTar.pos;
+
+    // completar final
+
+    tam = WriteCompleteTarSize(*tamanoEscrito, f_mytar);
+    TRAZA(2, "------BBBBBBBBBBBB --> %d \n", tam);
+
+    *tamanoEscrito += (unsigned long)tam;
+    // comprobar tamaÃ±o
+    ret = VerifyCompleteTarSize(*tamanoEscrito);
+    fase = EntraFase(FASE_DATOS); // the rest of the buffer
+    if (CierraEscritorTar(&EscritorTar) != 0)
+        ret = ERROR_GENERATE_TAR_FILE;
+    SaleFase(fase, 0, 0);
+    return ret;
+}
+
+// Print the results of -d and -g after adding to the tar file
+void ImprimeResumenInsercion(void)
+{
+    if (Deduplicar)
+        printf("Deduplicacion: %lu enlaces, %llu bytes ahorrados (%lu ficheros olvidados, %lu colisiones)\n",
+               TablaDedup.enlaces, TablaDedup.ahorrados, TablaDedup.descartados, TablaDedup.distintos);
+    free(TablaDedup.entradas);
+    TablaDedup.entradas = NULL;
+    if (Snapshot.activo)
+        printf("Incremental: %lu cambiados, %lu sin cambios, %lu borrados\n",
+               Snapshot.cambiados, Snapshot.iguales, Snapshot.borrados);
+    if (TRAZA_ACTIVA(2))
+        ImprimeCacheNombres(stdout);
+}
+
+unsigned long inserta_fichero(int f_mytar, unsigned long long tamano, char *filename)
+{
+    unsigned long long tamanoEscrito;
+    int ret;
+
+    if ((ret = AbreFinTar(f_mytar, tamano)) != 0)
+        return ret;
+    if ((ret = AniadeRutaTar(f_mytar, filename)) != 0)
+    {
+        CierraEscritorTar(&EscritorTar);
+        return ret;
+    }
+    if ((ret = CierraFinTar(f_mytar, &tamanoEscrito)) != 0)
+    {
+        // (a write error is already reported)
+        if (ret != ERROR_GENERATE_TAR_FILE)
+            fprintf(stderr, "Error al generar el fichero tar %d. Tamanio erroneo %llu\n", f_mytar, tamanoEscrito);
+        close(f_mytar);
+        return ret;
+    }
+
+    printf("OK: Generado el fichero tar %d (size=%llu) con el contenido de %s. \n", f_mytar, tamanoEscrito, filename);
+    ImprimeResumenInsercion();
+
+    close(f_mytar);
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------
+// (1.0) Build my_tardat structure with FileName stat info (See man 2 stat)
+int BuilTarHeader(char *FileName, struct c_header_gnu_tar *pTarHeader)
+{
+    struct stat stat_file;
+
+    if (lstat(FileName, &stat_file) == -1)
+        return HEADER_ERR;
+    return ConstruyeCabeceraTar(FileName, &stat_file, AT_FDCWD, FileName, pTarHeader);
+}
+
+// ------------------------------------------------------------------------
+// (1.1) Build my_tardat structure with the stat info already read by the
+// caller. The link of a symbolic link is read with readlinkat(dirfd, LinkPath)
+int ConstruyeCabeceraTar(const char *FileName, const struct stat *pStat, int dirfd, const char *LinkPath, struct c_header_gnu_tar *pTarHeader)
+{
+    const struct stat stat_file = *pStat;
+    unsigned int Checksum;
+    int fase = EntraFase(FASE_CABECERA);
+
+    bzero(pTarHeader, sizeof(struct c_header_gnu_tar));
+
+    if (strlen(FileName) >= sizeof(pTarHeader->name))
+    {
+        fprintf(stderr, "Nombre demasiado largo (max %lu): %s\n", sizeof(pTarHeader->name) - 1, FileName);
+        SaleFase(fase, 0, 0);
+        return HEADER_ERR;
+    }
+    // the checksum is the sum of the bytes of the fields, computed while they
+    // are filled (see s_mytarcodec.h)
+    Checksum = CopiaCampo(pTarHeader->name, sizeof(pTarHeader->name), FileName);
+    Checksum += CodificaOctal(pTarHeader->mode, 7, stat_file.st_mode & 07777);    // Only  the least significant 12 bits
+    TRAZA(2, "st_mode del archivo %s %07o\n", FileName, stat_file.st_mode & 07777);
+    Checksum += CodificaNumero(pTarHeader->uid, sizeof(pTarHeader->uid), stat_file.st_uid);
+    Checksum += CodificaNumero(pTarHeader->gid, sizeof(pTarHeader->gid), stat_file.st_gid);
+    // only regular files have data (GNU tar skips the size of a symbolic link)
+    // (8 GiB or more: base-256, see s_mytarcodec.h)
+    Checksum += CodificaNumero(pTarHeader->size, sizeof(pTarHeader->size), S_ISREG(stat_file.st_mode) ? stat_file.st_size : 0);
+    Checksum += CodificaNumero(pTarHeader->mtime, sizeof(pTarHeader->mtime), stat_file.st_mtime);
+    Checksum += 8 * ' '; // the checksum field, blank spaces while it is computed
+
+    pTarHeader->typeflag[0] = mode_tar(stat_file.st_mode);
+    Checksum += (unsigned char)pTarHeader->typeflag[0];
+
+    //  linkname
+    if (S_ISLNK(stat_file.st_mode))
+    {
+        CuentaLlamadas(1);
+        if (readlinkat(dirfd, LinkPath, pTarHeader->linkname, 100) > 0)
+            Checksum += SumaCampo(pTarHeader->linkname, sizeof(pTarHeader->linkname));
+    }
+
+    Checksum += CopiaCampo(pTarHeader->magic, 6, "ustar "); // "ustar" followed by a space (without null char)
+    Checksum += CopiaCampo(pTarHeader->version, 2, " ");     //   space character followed by a null char.
+    pthread_mutex_lock(&MutexNombres); // the caches and getpwuid/getgrgid are not reentrant
+    getUserName(stat_file.st_uid, pTarHeader->uname);
+    getGroupName(stat_file.st_gid, pTarHeader->gname);
+    pthread_mutex_unlock(&MutexNombres);
+    Checksum += SumaCampo(pTarHeader->uname, sizeof(pTarHeader->uname));
+    Checksum += SumaCampo(pTarHeader->gname, sizeof(pTarHeader->gname));
+    //  devmayor (not used)
+    //  devminor (not used)
+    Checksum += CodificaNumero(pTarHeader->atime, sizeof(pTarHeader->atime), stat_file.st_atime);
+    Checksum += CodificaNumero(pTarHeader->ctime, sizeof(pTarHeader->ctime), stat_file.st_ctime);
+    //  offset (not used)
+    //  longnames (not used)
+    //  unused (not used)
+    //  sparse, isextended, realsize (see EscribeDispersoTar)
+    //  pad (not used)
+
+    // checksum (the last)
+    CodificaOctal(pTarHeader->checksum, 6, Checksum); // six octal digits followed by a null and a space character
+    pTarHeader->checksum[7] = ' ';
+
+    SaleFase(fase, 0, 1);
+    return HEADER_OK;
+}
+
+// ----------------------------------------------------------------
+// Copy tam bytes from fd_in to fd_out (current file positions) without
+// a user space buffer: copy_file_range, or sendfile if the kernel or the
+// file systems do not support it. Return the bytes copied; the caller
+// copies the rest (if any) with a buffer.
+unsigned long long CopiaDatosDirecta(int fd_in, int fd_out, unsigned long long tam)
+{
+    unsigned long long copiados = 0;
+    size_t trozo;
+    ssize_t n;
+    int metodo = 0; // 0: copy_file_range, 1: sendfile
+
+    while (copiados < tam)
+    {
+        trozo = (tam - copiados > 0x40000000ULL) ? 0x40000000 : (size_t)(tam - copiados);
+        CuentaLlamadas(1);
+        if (metodo == 0)
+            n = copy_file_range(fd_in, NULL, fd_out, NULL, trozo, 0);
+        else
+            n = sendfile(fd_out, fd_in, NULL, trozo);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && metodo == 0 && copiados == 0 &&
+            (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+        {
+            metodo = 1;
+            continue;
+        }
+        if (n <= 0) // error or end of file: continue with the buffer
+            break;
+        copiados += n;
+    }
+    TRAZA(2, "Copia directa (%s): %llu de %llu bytes\n", metodo == 0 ? "copy_file_range" : "sendfile", copiados, tam);
+    return copiados;
+}
+
+// ----------------------------------------------------------------
+// Sparse files. The map of data regions is read with SEEK_DATA/SEEK_HOLE
+// (only if the file has less blocks than its size) and the member is
+// written as GNU type 'S': only the data regions are stored.
+int AniadeEntradaDispersa(struct mapa_disperso *mapa, unsigned long long offset, unsigned long long tam)
+{
+    struct entrada_dispersa *entradas;
+
+    if (mapa->num == mapa->cap)
+    {
+        mapa->cap = (mapa->cap == 0) ? 16 : 2 * mapa->cap;
+        if ((entradas = realloc(mapa->entradas, mapa->cap * sizeof(struct entrada_dispersa))) == NULL)
+            return -1;
+        mapa->entradas = entradas;
+    }
+    mapa->entradas[mapa->num].offset = offset;
+    mapa->entradas[mapa->num].tam = tam;
+    mapa->num++;
+    mapa->datos += tam;
+    return 0;
+}
+
+void LiberaMapaDisperso(struct mapa_disperso *mapa)
+{
+    free(mapa->entradas);
+    bzero(mapa, sizeof(struct mapa_disperso));
+}
+
+// Read the map of fd. Return 0 if the file has holes (and the map is
+// useful), -1 if it has to be written as a regular file.
+int LeeMapaDisperso(int fd, const struct stat *st, struct mapa_disperso *mapa)
+{
+    off_t datos, hueco, offset = 0;
+
+    bzero(mapa, sizeof(struct mapa_disperso));
+    if (!S_ISREG(st->st_mode) || (unsigned long long)st->st_blocks * 512 >= (unsigned long long)st->st_size)
+        return -1;
+    while (offset < st->st_size)
+    {
+        if ((datos = lseek(fd, offset, SEEK_DATA)) == -1)
+        {
+            if (errno == ENXIO) // only a hole up to the end
+                break;
+            LiberaMapaDisperso(mapa); // SEEK_DATA not supported
+            return -1;
+        }
+        if ((hueco = lseek(fd, datos, SEEK_HOLE)) == -1 || hueco > st->st_size)
+            hueco = st->st_size;
+        if (hueco > datos && AniadeEntradaDispersa(mapa, datos, hueco - datos) != 0)
+        {
+            LiberaMapaDisperso(mapa);
+            return -1;
+        }
+        offset = hueco;
+    }
+    // (as GNU tar) the last entry gives the size of the file
+    if (AniadeEntradaDispersa(mapa, st->st_size, 0) != 0 || mapa->datos >= (unsigned long long)st->st_size)
+    {
+        LiberaMapaDisperso(mapa);
+        return -1;
+    }
+    mapa->real = st->st_size;
+    lseek(fd, 0, SEEK_SET);
+    return 0;
+}
+
+// Write a sparse file: header 'S' with the first entries of the map,
+// extended headers with the rest, and the data regions
+unsigned long long EscribeDispersoTar(int f_mytar, int f_dat, struct c_header_gnu_tar *pTarHeader, const struct mapa_disperso *mapa)
+{
+    struct c_sparse_gnu_tar extension;
+    unsigned long long pendientes, escritos = 0;
+    unsigned long i, j, libre;
+    char *espacio;
+    ssize_t n;
+    int fase;
+
+    pTarHeader->typeflag[0] = 'S';
+    CodificaNumero(pTarHeader->size, sizeof(pTarHeader->size), mapa->datos);
+    CodificaNumero(pTarHeader->realsize, sizeof(pTarHeader->realsize), mapa->real);
+    for (i = 0; i < mapa->num && i < SPARSE_HEADER_ENTRIES; i++)
+    {
+        CodificaNumero(pTarHeader->sparse[i].offset, sizeof(pTarHeader->sparse[i].offset), mapa->entradas[i].offset);
+        CodificaNumero(pTarHeader->sparse[i].numbytes, sizeof(pTarHeader->sparse[i].numbytes), mapa->entradas[i].tam);
+    }
+    pTarHeader->isextended[0] = (mapa->num > SPARSE_HEADER_ENTRIES);
+    ActualizaChecksum(pTarHeader);
+    writeHeader(f_mytar, pTarHeader);
+    while (i < mapa->num)
+    {
+        bzero(&extension, sizeof(extension));
+        for (j = 0; j < SPARSE_EXT_ENTRIES && i < mapa->num; j++, i++)
+        {
+            CodificaNumero(extension.sparse[j].offset, sizeof(extension.sparse[j].offset), mapa->entradas[i].offset);
+            CodificaNumero(extension.sparse[j].numbytes, sizeof(extension.sparse[j].numbytes), mapa->entradas[i].tam);
+        }
+        extension.isextended[0] = (i < mapa->num);
+        EscribeEscritorTar(&EscritorTar, &extension, sizeof(extension));
+    }
+
+    // the data regions, read straight into the buffer of the writer
+    fase = EntraFase(FASE_DATOS);
+    for (i = 0; i < mapa->num; i++)
+    {
+        CuentaLlamadas(1);
+        if (lseek(f_dat, mapa->entradas[i].offset, SEEK_SET) == -1)
+            break;
+        for (pendientes = mapa->entradas[i].tam; pendientes > 0; pendientes -= n)
+        {
+            if ((espacio = EspacioEscritorTar(&EscritorTar, &libre)) == NULL)
+                break;
+            CuentaLlamadas(1);
+            if ((n = read(f_dat, espacio, (pendientes < libre) ? pendientes : libre)) <= 0)
+                break;
+            AvanzaEscritorTar(&EscritorTar, n);
+            escritos += n;
+        }
+        // a file that shrinks while it is read: the map is kept with zeros
+        if (pendientes > 0)
+        {
+            EscribeCerosEscritorTar(&EscritorTar, pendientes);
+            escritos += pendientes;
+        }
+    }
+    SaleFase(fase, escritos, 1);
+    RellenaBloqueTar(escritos);
+    TRAZA(2, "disperso: %llu bytes de datos de %llu, %lu regiones\n", mapa->datos, mapa->real, mapa->num);
+    return escritos;
+}
+
+// ----------------------------------------------------------------
+// Deduplication (-d). The contents of every regular file are hashed (64
+// bits) while they are written; if an earlier member has the same hash
+// and size, and the same bytes (compared with the file of that member),
+// the member just written is discarded and a hard link to the earlier one
+// (typeflag '1', linkname, no data) is written instead, as GNU tar does
+// with the hard links of a tree. At most DEDUP_TABLE_ENTRIES files are
+// remembered: when the DEDUP_WAYS entries of a slot are used, one of them
+// is replaced.
+#define DEDUP_MULT1 0x9E3779B97F4A7C15ULL
+#define DEDUP_MULT2 0xC2B2AE3D27D4EB4FULL
+
+static inline unsigned long long MezclaHashDedup(unsigned long long h, unsigned long long w)
+{
+    h ^= w * DEDUP_MULT2;
+    h = (h << 31) | (h >> 33);
+    return h * DEDUP_MULT1;
+}
+
+void IniciaHashDedup(struct hash_dedup *hash)
+{
+    bzero(hash, sizeof(struct hash_dedup));
+    hash->h = DEDUP_MULT1;
+}
+
+void ActualizaHashDedup(struct hash_dedup *hash, const char *datos, unsigned long n)
+{
+    unsigned long long h = hash->h, w;
+    unsigned long i = 0;
+
+    hash->tam += n;
+    // complete the word of the previous call
+    while (hash->numResto > 0 && hash->numResto < 8 && i < n)
+        hash->resto[hash->numResto++] = datos[i++];
+    if (hash->numResto == 8)
+    {
+        memcpy(&w, hash->resto, 8);
+        h = MezclaHashDedup(h, w);
+        hash->numResto = 0;
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        memcpy(&w, datos + i, 8);
+        h = MezclaHashDedup(h, w);
+    }
+    while (i < n)
+        hash->resto[hash->numResto++] = datos[i++];
+    hash->h = h;
+}
+
+unsigned long long FinHashDedup(struct hash_dedup *hash)
+{
+    unsigned long long h = hash->h, w = 0;
+
+    if (hash->numResto > 0)
+    {
+        memcpy(&w, hash->resto, hash->numResto);
+        h = MezclaHashDedup(h, w);
+    }
+    h = MezclaHashDedup(h, hash->tam);
+    h ^= h >> 33;
+    h *= DEDUP_MULT2;
+    h ^= h >> 29;
+    return h;
+}
+
+// Hash the tam bytes of f_dat before they are written (pread: the offset
+// of f_dat is not changed)
+int HashFicheroDedup(int f_dat, unsigned long long tam, struct hash_dedup *hash)
+{
+    unsigned long long offset = 0;
+    char *buffer;
+    ssize_t n;
+
+    if ((buffer = malloc(GETDENTS_BUFFER_SIZE)) == NULL)
+        return -1;
+    IniciaHashDedup(hash);
+    while (offset < tam && (n = pread(f_dat, buffer, GETDENTS_BUFFER_SIZE, offset)) > 0)
+    {
+        ActualizaHashDedup(hash, buffer, n);
+        offset += n;
+    }
+    free(buffer);
+    return 0;
+}
+
+// Return the first entry of slot of hash (DEDUP_WAYS entries)
+struct entrada_dedup *RanuraDedup(struct tabla_dedup *tabla, unsigned long long hash)
+{
+    if (tabla->entradas == NULL &&
+        (tabla->entradas = calloc(DEDUP_TABLE_ENTRIES, sizeof(struct entrada_dedup))) == NULL)
+        return NULL;
+    return &tabla->entradas[(hash % (DEDUP_TABLE_ENTRIES / DEDUP_WAYS)) * DEDUP_WAYS];
+}
+
+void AniadeDedup(struct tabla_dedup *tabla, unsigned long long hash, unsigned long long tam, const char *name)
+{
+    struct entrada_dedup *ranura, *entrada = NULL;
+    int i;
+
+    if ((ranura = RanuraDedup(tabla, hash)) == NULL)
+        return;
+    for (i = 0; i < DEDUP_WAYS && entrada == NULL; i++)
+        if (!ranura[i].usado)
+            entrada = &ranura[i];
+    if (entrada == NULL)
+    {
+        entrada = &ranura[tabla->reemplazo++ % DEDUP_WAYS];
+        tabla->descartados++;
+    }
+    entrada->hash = hash;
+    entrada->tam = tam;
+    memcpy(entrada->name, name, sizeof(entrada->name));
+    entrada->usado = 1;
+}
+
+// Compare tam bytes of f_dat (or of datos if f_dat is -1) with the file
+// named name. pread: the offset of f_dat is not changed.
+int MismoContenido(int f_dat, const char *datos, const char *name, unsigned long long tam)
+{
+    char nombre[101], *buffer;
+    unsigned long long offset = 0;
+    ssize_t n;
+    int fd, iguales = 1;
+
+    memcpy(nombre, name, 100);
+    nombre[100] = '\0';
+    if ((fd = open(nombre, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1)
+        return 0;
+    if ((buffer = malloc(2 * GETDENTS_BUFFER_SIZE)) == NULL)
+    {
+        close(fd);
+        return 0;
+    }
+    while (iguales && offset < tam)
+    {
+        n = (tam - offset < GETDENTS_BUFFER_SIZE) ? (ssize_t)(tam - offset) : GETDENTS_BUFFER_SIZE;
+        if ((n = pread(fd, buffer, n, offset)) <= 0 ||
+            (f_dat != -1 && pread(f_dat, buffer + GETDENTS_BUFFER_SIZE, n, offset) != n))
+            iguales = 0;
+        else if (memcmp(buffer, (f_dat != -1) ? buffer + GETDENTS_BUFFER_SIZE : datos + offset, n) != 0)
+            iguales = 0;
+        offset += n;
+    }
+    free(buffer);
+    close(fd);
+    return iguales;
+}
+
+// The member of pTarHeader (its header at inicio, its data already written
+// or in datos) has been hashed: if it is a copy of an earlier member, write
+// a hard link instead of it and return 1. Otherwise remember it and return 0.
+int EnlazaDuplicado(int f_mytar, struct c_header_gnu_tar *pTarHeader, int f_dat, const char *datos,
+                    struct hash_dedup *hash, unsigned long long inicio)
+{
+    struct entrada_dedup *ranura;
+    unsigned long long h, tam, ahorro;
+    int i;
+
+    tam = DecodificaNumero(pTarHeader->size, sizeof(pTarHeader->size));
+    if (hash->tam != tam) // the file has changed while it was read
+        return 0;
+    h = FinHashDedup(hash);
+    if ((ranura = RanuraDedup(&TablaDedup, h)) == NULL)
+        return 0;
+    for (i = 0; i < DEDUP_WAYS; i++)
+    {
+        if (!ranura[i].usado || ranura[i].hash != h || ranura[i].tam != tam)
+            continue;
+        if (!MismoContenido(f_dat, datos, ranura[i].name, tam))
+        {
+            TablaDedup.distintos++;
+            continue;
+        }
+        if (EscritorTar.pos > inicio)
+        {
+            if (RetrocedeEscritorTar(&EscritorTar, inicio) != 0)
+                return 0;
+            // the entry of the discarded header is replaced by the link
+            // (same name and offset)
+            if (IndiceTar.activo && IndiceTar.num > 0)
+                IndiceTar.num--;
+        }
+        ahorro = TamanioDatosTar(pTarHeader);
+        pTarHeader->typeflag[0] = '1';
+        CodificaNumero(pTarHeader->size, sizeof(pTarHeader->size), 0);
+        memcpy(pTarHeader->linkname, ranura[i].name, sizeof(pTarHeader->linkname));
+        ActualizaChecksum(pTarHeader);
+        writeHeader(f_mytar, pTarHeader);
+        TablaDedup.enlaces++;
+        TablaDedup.ahorrados += ahorro;
+        TRAZA(1, "duplicado: %.100s -> %.100s\n", pTarHeader->name, pTarHeader->linkname);
+        return 1;
+    }
+    AniadeDedup(&TablaDedup, h, tam, pTarHeader->name);
+    return 0;
+}
+
+// Write the header and the data of the regular file f_dat (as a sparse
+// member if it has holes, as a hard link if it is a copy of an earlier
+// member with -d)
+unsigned long long EscribeFicheroTar(int f_mytar, int f_dat, struct c_header_gnu_tar *pTarHeader, const struct stat *pStat)
+{
+    struct mapa_disperso mapa;
+    struct hash_dedup hash;
+    unsigned long long inicio = EscritorTar.pos;
+    unsigned long long n, tam = DecodificaNumero(pTarHeader->size, sizeof(pTarHeader->size));
+
+    AvisaFuente(f_dat);
+    if (LeeMapaDisperso(f_dat, pStat, &mapa) == 0)
+    {
+        n = EscribeDispersoTar(f_mytar, f_dat, pTarHeader, &mapa);
+        LiberaMapaDisperso(&mapa);
+        return n;
+    }
+    if (Deduplicar && EscritorTar.compresor != NULL && (unsigned long long)pStat->st_size > EscritorTar.tam)
+    {
+        // compressed frames can not be discarded: a big file is hashed
+        // before it is written
+        if (HashFicheroDedup(f_dat, pStat->st_size, &hash) == 0 &&
+            EnlazaDuplicado(f_mytar, pTarHeader, f_dat, NULL, &hash, inicio))
+            return 0;
+        writeHeader(f_mytar, pTarHeader);
+        return WriteFileDataBlocks(f_dat, f_mytar, tam);
+    }
+    writeHeader(f_mytar, pTarHeader);
+    if (!Deduplicar || pStat->st_size == 0)
+        return WriteFileDataBlocks(f_dat, f_mytar, tam);
+    IniciaHashDedup(&hash);
+    n = EscribeDatosFichero(f_dat, tam, &hash);
+    if (EnlazaDuplicado(f_mytar, pTarHeader, f_dat, NULL, &hash, inicio))
+        return 0;
+    return n;
+}
+
+// Complete the last block of a member of tam bytes with zeros. Return
+// the zeros written.
+unsigned long RellenaBloqueTar(unsigned long long tam)
+{
+    unsigned long n = 0;
+    int fase;
+
+    if (tam % DATAFILE_BLOCK_SIZE != 0)
+    {
+        fase = EntraFase(FASE_RELLENO);
+        n = DATAFILE_BLOCK_SIZE - (tam % DATAFILE_BLOCK_SIZE);
+        EscribeCerosEscritorTar(&EscritorTar, n);
+        SaleFase(fase, n, 0);
+    }
+    return n;
+}
+
+// ----------------------------------------------------------------
+// (1.2) write the data file (blocks of 512 bytes)
+unsigned long long WriteFileDataBlocks(int fd_DataFile, int fd_TarFile, unsigned long long tam)
+{
+    return EscribeDatosFichero(fd_DataFile, tam, NULL);
+}
+
+// Write the tam bytes (size in the header) of fd_DataFile in the tar file:
+// a file that grows is cut and one that shrinks is completed with zeros.
+// With hash (-d) the data is hashed as it is read, so it always goes
+// through the buffer.
+unsigned long long EscribeDatosFichero(int fd_DataFile, unsigned long long tam, struct hash_dedup *hash)
+{
+    unsigned long long NumWriteBytes, soltado = 0, ceros;
+    unsigned long libre, trozo;
+    char *espacio;
+    struct stat sb;
+    int n, fase = EntraFase(FASE_DATOS);
+
+    // write the data file (blocks of 512 bytes), read straight into the
+    // buffer of the writer
+    NumWriteBytes = 0;
+    // big regular files go from fd_DataFile to the tar file in the kernel
+    // (small ones are grouped in the buffer with the rest of the members)
+    CuentaLlamadas(1); // fstat
+    if (CopiaDirecta && hash == NULL && fstat(fd_DataFile, &sb) == 0 && S_ISREG(sb.st_mode) &&
+        tam >= EscritorTar.tam && VaciaEscritorTar(&EscritorTar) == 0)
+    {
+        NumWriteBytes = CopiaDatosDirecta(fd_DataFile, EscritorTar.fd, tam);
+        EscritorTar.pos += NumWriteBytes;
+    }
+    espacio = EspacioEscritorTar(&EscritorTar, &libre);
+    while (NumWriteBytes < tam && espacio != NULL &&
+           (n = read(fd_DataFile, espacio, (tam - NumWriteBytes < libre) ? tam - NumWriteBytes : libre)) > 0)
+    {
+        CuentaLlamadas(1);
+        if (hash != NULL)
+            ActualizaHashDedup(hash, espacio, n);
+        AvanzaEscritorTar(&EscritorTar, n);
+        NumWriteBytes = NumWriteBytes + n;
+        TRAZA(3, "Datos Escritos: --%d -\n", n);
+        // --io: the pages of the file already copied are dropped (a big
+        // file would fill the page cache before it is closed)
+        if (PoliticaIO != IO_NORMAL && NumWriteBytes - soltado >= EscritorTar.tam)
+        {
+            CuentaLlamadas(1);
+            posix_fadvise(fd_DataFile, soltado, NumWriteBytes - soltado, POSIX_FADV_DONTNEED);
+            soltado = NumWriteBytes;
+        }
+        espacio = EspacioEscritorTar(&EscritorTar, &libre);
+    }
+    if (NumWriteBytes < tam)
+    {
+        CuentaLlamadas(1); // the read of the end of file
+        TRAZA(1, "fichero acortado: %llu bytes de %llu, completado con ceros\n", NumWriteBytes, tam);
+        for (ceros = NumWriteBytes; hash != NULL && ceros < tam; ceros += trozo)
+        {
+            trozo = (tam - ceros < sizeof(BloqueCeros)) ? tam - ceros : sizeof(BloqueCeros);
+            ActualizaHashDedup(hash, BloqueCeros, trozo);
+        }
+        EscribeCerosEscritorTar(&EscritorTar, tam - NumWriteBytes);
+        NumWriteBytes = tam;
+    }
+    SaleFase(fase, NumWriteBytes, 1);
+    // complete the last block with zeros
+    NumWriteBytes += RellenaBloqueTar(NumWriteBytes);
+
+    TRAZA(2, "Total :Escritos %llu \n", NumWriteBytes);
+    return NumWriteBytes;
+}
+
+// ----------------------------------------------------------------
+// (2.1)Write end tar archive entry (2x512 bytes with zeros)
+unsigned long WriteEndTarArchive(int fd_TarFile)
+{
+    unsigned long NumWriteBytes;
+    int fase = EntraFase(FASE_RELLENO);
+
+    // write end tar archive entry (2x512 bytes with zeros)
+    NumWriteBytes = 0;
+    IndiceTar.fin = EscritorTar.pos;
+    EscribeCerosEscritorTar(&EscritorTar, END_TAR_ARCHIVE_ENTRY_SIZE);
+    NumWriteBytes += END_TAR_ARCHIVE_ENTRY_SIZE;
+
+    TRAZA(2, " Escritos (End block) total %ld\n", NumWriteBytes);
+    SaleFase(fase, NumWriteBytes, 0);
+
+    return NumWriteBytes;
+}
+
+// ----------------------------------------------------------------
+// (2.2) complete Tar file to  multiple of 10KB size block
+unsigned long WriteCompleteTarSize(unsigned long long TarActualSize, int fd_TarFile)
+{
+    unsigned long long NumWriteBytes;
+    unsigned long offset = 0;
+    int fase = EntraFase(FASE_RELLENO);
+
+    NumWriteBytes = TarActualSize;
+    // complete to  multiple of 10KB size blocks
+    TRAZA(2, "TAR_FILE_BLOCK_SIZE=%ld  TarFileSize=%llu\n", TAR_FILE_BLOCK_SIZE, NumWriteBytes);
+    if (NumWriteBytes % TAR_FILE_BLOCK_SIZE != 0)
+    {
+        offset = TAR_FILE_BLOCK_SIZE - (NumWriteBytes % TAR_FILE_BLOCK_SIZE);
+        TRAZA(2, "DIFF: %ld \n", offset);
+        EscribeCerosEscritorTar(&EscritorTar, offset);
+        NumWriteBytes += offset;
+    }
+
+    TRAZA(2, "OK: Generado el EndTarBlocks del archivo tar %llu bytes \n", NumWriteBytes);
+    SaleFase(fase, offset, 0);
+    return offset;
+}
+
+// Verify Tar file zize to  multiple of 10KB size blocks
+int VerifyCompleteTarSize(unsigned long long TarActualSize)
+{
+
+    // Verify
+    if ((TarActualSize % TAR_FILE_BLOCK_SIZE) != 0)
+    {
+        fprintf(stderr, "Error al generar el fichero tar. Tamanio erroneo %llu\n", TarActualSize);
+        return ERROR_GENERATE_TAR_FILE2;
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------
+// Member index (name -> header offset, size, typeflag)
+// Hash of a member name (FNV-1a, at most 100 chars as in the header)
+unsigned long HashNombre(const char *name)
+{
+    unsigned long hash = 14695981039346656037UL;
+    int i;
+
+    for (i = 0; i < 100 && name[i] != '\0'; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+// Insert the entry num (0..) in the hash table. The first member with
+// a name is kept, as the linear scan of extrae_fichero does.
+void IndiceInsertaTabla(struct indice_tar *indice, unsigned long num)
+{
+    unsigned long pos, mask = indice->tam_tabla - 1;
+
+    pos = HashNombre(indice->entradas[num].name) & mask;
+    while (indice->tabla[pos] != 0)
+    {
+        if (strncmp(indice->entradas[indice->tabla[pos] - 1].name, indice->entradas[num].name, 100) == 0)
+            return;
+        pos = (pos + 1) & mask;
+    }
+    indice->tabla[pos] = num + 1;
+}
+
+// Rebuild the hash table with (at least) twice the number of entries
+int IndiceReconstruyeTabla(struct indice_tar *indice)
+{
+    unsigned long i, tam = 64;
+
+    while (tam < 2 * indice->num)
+        tam *= 2;
+    free(indice->tabla);
+    if ((indice->tabla = calloc(tam, sizeof(unsigned long))) == NULL)
+        return -1;
+    indice->tam_tabla = tam;
+    for (i = 0; i < indice->num; i++)
+        IndiceInsertaTabla(indice, i);
+    return 0;
+}
+
+// Add the header stored at offset to the index
+int IndiceAniade(struct indice_tar *indice, unsigned long long offset, const struct c_header_gnu_tar *pheaderData)
+{
+    struct c_index_tar_entry *entrada;
+    unsigned long tamanio = 0;
+
+    if (indice->num == indice->cap)
+    {
+        indice->cap = (indice->cap == 0) ? 256 : 2 * indice->cap;
+        if ((entrada = realloc(indice->entradas, indice->cap * sizeof(struct c_index_tar_entry))) == NULL)
+            return -1;
+        indice->entradas = entrada;
+    }
+    entrada = &indice->entradas[indice->num];
+    bzero(entrada, sizeof(struct c_index_tar_entry));
+    tamanio = DecodificaNumero(pheaderData->size, sizeof(pheaderData->size));
+    entrada->offset = offset;
+    entrada->size = tamanio;
+    entrada->typeflag = pheaderData->typeflag[0];
+    strncpy(entrada->name, pheaderData->name, sizeof(entrada->name));
+    indice->num++;
+
+    if (2 * indice->num > indice->tam_tabla)
+        return IndiceReconstruyeTabla(indice);
+    IndiceInsertaTabla(indice, indice->num - 1);
+    return 0;
+}
+
+// Return the entry of name or NULL
+struct c_index_tar_entry *IndiceBusca(struct indice_tar *indice, const char *name)
+{
+    unsigned long pos, mask;
+
+    if (indice->tam_tabla == 0)
+        return NULL;
+    mask = indice->tam_tabla - 1;
+    pos = HashNombre(name) & mask;
+    while (indice->tabla[pos] != 0)
+    {
+        if (strncmp(indice->entradas[indice->tabla[pos] - 1].name, name, 100) == 0)
+            return &indice->entradas[indice->tabla[pos] - 1];
+        pos = (pos + 1) & mask;
+    }
+    return NULL;
+}
+
+void LiberaIndiceTar(struct indice_tar *indice)
+{
+    free(indice->entradas);
+    free(indice->tabla);
+    bzero(indice, sizeof(struct indice_tar));
+}
+
+// Name of the sidecar index file of TarFileName
+void NombreIndiceTar(char *TarFileName, char *IndexFileName, size_t size)
+{
+    snprintf(IndexFileName, size, "%s%s", TarFileName, INDEX_FILE_SUFFIX);
+}
+
+int ExisteIndiceTar(char *TarFileName)
+{
+    char IndexFileName[PATH_MAX];
+
+    NombreIndiceTar(TarFileName, IndexFileName, sizeof(IndexFileName));
+    return access(IndexFileName, F_OK) == 0;
+}
+
+// Write the index of TarFileName (in a temporary file + rename, so a
+// reader never sees a half written index)
+int GuardaIndiceTar(char *TarFileName, struct indice_tar *indice)
+{
+    char IndexFileName[PATH_MAX], TmpFileName[PATH_MAX + sizeof(".tmp")];
+    struct c_index_tar_header cabecera;
+    size_t tam;
+    int fd;
+
+    NombreIndiceTar(TarFileName, IndexFileName, sizeof(IndexFileName));
+    snprintf(TmpFileName, sizeof(TmpFileName), "%s.tmp", IndexFileName);
+    if ((fd = open(TmpFileName, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1)
+    {
+        fprintf(stderr, "No se puede crear el indice %s\n", IndexFileName);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    bzero(&cabecera, sizeof(cabecera));
+    memcpy(cabecera.magic, INDEX_MAGIC, sizeof(cabecera.magic));
+    cabecera.version = INDEX_VERSION;
+    cabecera.num = indice->num;
+    cabecera.fin = indice->fin;
+    tam = indice->num * sizeof(struct c_index_tar_entry);
+    if ((write(fd, &cabecera, sizeof(cabecera)) != sizeof(cabecera)) ||
+        (tam != 0 && write(fd, indice->entradas, tam) != (ssize_t)tam))
+    {
+        fprintf(stderr, "No se puede escribir el indice %s\n", IndexFileName);
+        close(fd);
+        unlink(TmpFileName);
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    close(fd);
+    if (rename(TmpFileName, IndexFileName) == -1)
+    {
+        unlink(TmpFileName);
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    return 0;
+}
+
+// Load the index of TarFileName. Return 0 if there is a valid index.
+int CargaIndiceTar(char *TarFileName, struct indice_tar *indice)
+{
+    char IndexFileName[PATH_MAX];
+    struct c_index_tar_header cabecera;
+    struct stat sb;
+    size_t tam;
+    int fd;
+
+    NombreIndiceTar(TarFileName, IndexFileName, sizeof(IndexFileName));
+    if ((fd = open(IndexFileName, O_RDONLY)) == -1)
+        return -1;
+    if ((read(fd, &cabecera, sizeof(cabecera)) != sizeof(cabecera)) ||
+        (memcmp(cabecera.magic, INDEX_MAGIC, sizeof(cabecera.magic)) != 0) ||
+        (cabecera.version != INDEX_VERSION) || (fstat(fd, &sb) == -1) ||
+        (cabecera.num != (sb.st_size - sizeof(cabecera)) / sizeof(struct c_index_tar_entry)))
+    {
+        fprintf(stderr, "Formato erroneo del indice %s\n", IndexFileName);
+        close(fd);
+        return -1;
+    }
+    tam = cabecera.num * sizeof(struct c_index_tar_entry);
+    indice->num = indice->cap = cabecera.num;
+    indice->fin = cabecera.fin;
+    if (((indice->entradas = malloc(tam + 1)) == NULL) ||
+        (tam != 0 && read(fd, indice->entradas, tam) != (ssize_t)tam) ||
+        (IndiceReconstruyeTabla(indice) != 0))
+    {
+        close(fd);
+        LiberaIndiceTar(indice);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+// The member whose header is at offset has been removed with its len
+// bytes: drop its entry and move the entries after it
+int IndiceQuita(struct indice_tar *indice, unsigned long long offset, unsigned long long len)
+{
+    unsigned long i, j;
+
+    for (i = j = 0; i < indice->num; i++)
+    {
+        if (indice->entradas[i].offset == offset)
+            continue;
+        if (indice->entradas[i].offset > offset)
+            indice->entradas[i].offset -= len;
+        indice->entradas[j++] = indice->entradas[i];
+    }
+    indice->num = j;
+    indice->fin -= len;
+    return IndiceReconstruyeTabla(indice);
+}
+
+// ----------------------------------------------------------------
+// Delete (--delete) and replace (--replace) of a member in place. The
+// member (its header, the extended headers of a sparse member and its
+// data) is the range [ini, ini + len) of the tar file, and the archive
+// ends at fin. The bytes after it are moved back len bytes:
+//  - with fallocate(FALLOC_FL_COLLAPSE_RANGE), if len is a multiple of
+//    the block of the file system: the blocks of the member are removed
+//    from the file without moving any data. The range removed starts at
+//    the block of ini, so the (less than a block) bytes before ini in that
+//    block are written again.
+//  - otherwise, a single forward pass moves [ini + len, fin) to ini with
+//    reads and writes of FactorBloqueo blocks.
+// Then the file is cut at the new end and the end of archive blocks and
+// the padding to the 10KB record are written again (WriteEndTarArchive,
+// WriteCompleteTarSize). A replaced member is written before them, at the
+// end of the archive (as tar -r).
+int QuitaRangoTar(int f_mytar, unsigned long long ini, unsigned long long len, unsigned long long fin)
+{
+    unsigned long long origen = ini + len, destino = ini, inicio;
+    unsigned long tamBuff = FactorBloqueo * DATAFILE_BLOCK_SIZE, cabeza;
+    char *buff;
+    struct stat sb;
+    ssize_t n;
+    int fase = EntraFase(FASE_DATOS);
+
+    CuentaLlamadas(1);
+    if (fstat(f_mytar, &sb) == 0 && sb.st_blksize > 0 && len % sb.st_blksize == 0)
+    {
+        inicio = ini - ini % sb.st_blksize;
+        cabeza = ini - inicio;
+        if ((buff = malloc(cabeza + 1)) != NULL && pread(f_mytar, buff, cabeza, inicio) == (ssize_t)cabeza)
+        {
+            CuentaLlamadas(2);
+            if (fallocate(f_mytar, FALLOC_FL_COLLAPSE_RANGE, (off_t)inicio, (off_t)len) == 0)
+            {
+                TRAZA(1, "collapse range: %llu bytes en %llu\n", len, inicio);
+                n = (cabeza == 0) ? 0 : pwrite(f_mytar, buff, cabeza, inicio);
+                free(buff);
+                SaleFase(fase, cabeza, 0);
+                return (n == (ssize_t)cabeza) ? 0 : -1;
+            }
+            TRAZA(1, "sin collapse range (%s), se compacta el tar\n", strerror(errno));
+        }
+        free(buff);
+    }
+    if (posix_memalign((void **)&buff, BUFFER_ALIGNMENT, tamBuff) != 0)
+    {
+        SaleFase(fase, 0, 0);
+        return -1;
+    }
+    while (origen < fin)
+    {
+        CuentaLlamadas(1);
+        if ((n = pread(f_mytar, buff, (fin - origen < tamBuff) ? fin - origen : tamBuff, origen)) <= 0 ||
+            EscribeTodoOffset(f_mytar, buff, n, destino) != 0)
+            break;
+        origen += n;
+        destino += n;
+    }
+    free(buff);
+    SaleFase(fase, fin - ini - len, 0);
+    return (origen == fin) ? 0 : -1;
+}
+
+// Delete from f_mytar the first member named name, or replace it with
+// f_dat (stored with the name name) if f_dat is not NULL
+int modifica_tar(char *f_mytar, char *name, char *f_dat)
+{
+    const struct c_header_gnu_tar *pCabecera;
+    struct c_header_gnu_tar cabecera, nueva;
+    struct c_index_tar_entry *entrada;
+    struct lector_tar lector;
+    struct stat sb, stattest;
+    char nombre[sizeof(cabecera.name) + 1];
+    unsigned long long ini = 0, len = 0, fin = 0, tamano, tamanoEscrito, inicio;
+    long ext;
+    int fd_TarFile, f_dat_fd = -1, encontrado = 0, ret = 0, fase;
+
+    if ((fd_TarFile = open(f_mytar, O_RDWR)) == -1 || fstat(fd_TarFile, &sb) == -1)
+    {
+        fprintf(stderr, "No se puede abrir el fichero tar %s\n", f_mytar);
+        if (fd_TarFile != -1)
+            close(fd_TarFile);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    tamano = sb.st_size;
+    if (EsTarComprimido(fd_TarFile))
+    {
+        fprintf(stderr, "No se puede modificar un tar comprimido (-z)\n");
+        close(fd_TarFile);
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    // the new member is read before the old one is removed
+    if (f_dat != NULL)
+    {
+        if ((StatEntrada(AT_FDCWD, f_dat, &stattest) == -1) ||
+            (ConstruyeCabeceraTar(name, &stattest, AT_FDCWD, f_dat, &nueva) != HEADER_OK) ||
+            (S_ISREG(stattest.st_mode) && (f_dat_fd = open(f_dat, O_RDONLY)) == -1))
+        {
+            fprintf(stderr, "No se puede abrir el fichero de datos %s\n", f_dat);
+            close(fd_TarFile);
+            return ERROR_OPEN_DAT_FILE;
+        }
+    }
+
+    // the member: from the index if it is up to date, or with the headers
+    if (IndiceTar.num > 0 && (entrada = IndiceBusca(&IndiceTar, name)) != NULL &&
+        FinIndiceTar(fd_TarFile, tamano, &fin) == 0 &&
+        pread(fd_TarFile, &cabecera, sizeof(cabecera), entrada->offset) == sizeof(cabecera) &&
+        CabeceraValida(&cabecera) && strncmp(cabecera.name, name, sizeof(cabecera.name)) == 0 &&
+        (ext = ExtensionesDispersasTar(fd_TarFile, entrada->offset, &cabecera)) >= 0)
+    {
+        ini = entrada->offset;
+        len = (1 + ext) * sizeof(cabecera) + TamanioDatosTar(&cabecera);
+        encontrado = 1;
+    }
+    else
+    {
+        if (IndiceTar.activo) // rebuilt with the headers
+        {
+            LiberaIndiceTar(&IndiceTar);
+            IndiceTar.activo = 1;
+        }
+        AbreLectorTar(&lector, fd_TarFile, ModoLector);
+        while ((inicio = lector.pos, pCabecera = SiguienteCabeceraTar(&lector)) != NULL &&
+               strcmp(pCabecera->magic, "ustar  ") == 0)
+        {
+            snprintf(nombre, sizeof(nombre), "%.*s", (int)sizeof(pCabecera->name), pCabecera->name);
+            if (IndiceTar.activo)
+                IndiceAniade(&IndiceTar, inicio, pCabecera);
+            SaltaDatosTar(&lector, TamanioDatosTar(pCabecera));
+            if (!encontrado && strcmp(nombre, name) == 0)
+            {
+                ini = inicio;
+                len = lector.pos - inicio;
+                encontrado = 1;
+            }
+            fin = lector.pos;
+        }
+        CierraLectorTar(&lector);
+    }
+    if (!encontrado)
+    {
+        fprintf(stderr, "No se encuentra en el tar: %s\n", name);
+        if (f_dat_fd != -1)
+            close(f_dat_fd);
+        close(fd_TarFile);
+        return ERROR_MEMBER_NOT_FOUND;
+    }
+    TRAZA(1, "%s: offset %llu, %llu bytes, fin del tar en %llu\n", name, ini, len, fin);
+
+    // the member out, and the tar file cut at its new end
+    if (QuitaRangoTar(fd_TarFile, ini, len, fin) != 0 || ftruncate(fd_TarFile, (off_t)(fin - len)) == -1)
+    {
+        fprintf(stderr, "Error al quitar %s del fichero tar %s\n", name, f_mytar);
+        if (f_dat_fd != -1)
+            close(f_dat_fd);
+        close(fd_TarFile);
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    if (IndiceTar.activo)
+        IndiceQuita(&IndiceTar, ini, len);
+    fin -= len;
+    lseek(fd_TarFile, (off_t)fin, SEEK_SET);
+    if (AbreEscritorTar(&EscritorTar, fd_TarFile, fin) != 0)
+    {
+        close(fd_TarFile);
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    if (f_dat_fd != -1)
+    {
+        fase = EntraFase(FASE_DATOS);
+        EscribeFicheroTar(fd_TarFile, f_dat_fd, &nueva, &stattest);
+        CierraFuente(f_dat_fd);
+        SaleFase(fase, 0, 0);
+    }
+    else if (f_dat != NULL)
+        writeHeader(fd_TarFile, &nueva); // directory or symbolic link
+    WriteEndTarArchive(fd_TarFile);
+    tamanoEscrito = EscritorTar.pos;
+    tamanoEscrito += WriteCompleteTarSize(tamanoEscrito, fd_TarFile);
+    ret = VerifyCompleteTarSize(tamanoEscrito);
+    fase = EntraFase(FASE_DATOS);
+    if (CierraEscritorTar(&EscritorTar) != 0)
+        ret = ERROR_GENERATE_TAR_FILE;
+    SaleFase(fase, 0, 0);
+    close(fd_TarFile);
+    if (ret != 0)
+        return ret;
+    printf("OK: %s %s en el fichero tar %s (size=%llu, antes %llu)\n", name,
+           (f_dat != NULL) ? "reemplazado" : "borrado", f_mytar, tamanoEscrito, tamano);
+    return 0;
+}
+
+int borra_fichero(char *f_mytar, char *name)
+{
+    return modifica_tar(f_mytar, name, NULL);
+}
+
+int reemplaza_fichero(char *f_mytar, char *name, char *f_dat)
+{
+    return modifica_tar(f_mytar, name, f_dat);
+}
+
+// ----------------------------------------------------------------
+// Incremental archive (-g snapshot). The snapshot of the previous run
+// (device, inode, mtime and size of every name) is mapped and searched in
+// place (binary search of the hash of the name). A name with the same
+// values is not written again; directories are always written (only
+// their header). The names of the previous snapshot under the archived
+// tree that are not found are written, one per line, in the member
+// SNAPSHOT_DELETED_NAME of that tree. The snapshot of this run replaces
+// the previous one (the names outside the tree are kept).
+int CargaSnapshot(char *fichero, struct snapshot_tar *snap)
+{
+    const struct c_snapshot_header *cabecera;
+    struct stat sb;
+    int fd;
+
+    snap->activo = 1;
+    if ((fd = open(fichero, O_RDONLY)) == -1)
+        return (errno == ENOENT) ? 0 : -1; // first run: everything is new
+    if (fstat(fd, &sb) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    if (sb.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+    snap->tamMapa = sb.st_size;
+    snap->mapa = mmap(NULL, snap->tamMapa, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (snap->mapa == MAP_FAILED)
+    {
+        snap->mapa = NULL;
+        return -1;
+    }
+    cabecera = (const struct c_snapshot_header *)snap->mapa;
+    if ((snap->tamMapa < sizeof(struct c_snapshot_header)) ||
+        (memcmp(cabecera->magic, SNAPSHOT_MAGIC, sizeof(cabecera->magic)) != 0) ||
+        (cabecera->version != SNAPSHOT_VERSION) ||
+        (cabecera->num > (snap->tamMapa - sizeof(struct c_snapshot_header)) / sizeof(struct c_snapshot_entry)) ||
+        (sizeof(struct c_snapshot_header) + cabecera->num * sizeof(struct c_snapshot_entry) + cabecera->nombres != snap->tamMapa))
+    {
+        fprintf(stderr, "Formato erroneo del snapshot %s\n", fichero);
+        return -1;
+    }
+    snap->anteriores = (const struct c_snapshot_entry *)(cabecera + 1);
+    snap->numAnteriores = cabecera->num;
+    snap->nombresAnteriores = (const char *)(snap->anteriores + cabecera->num);
+    if ((snap->vistos = calloc(snap->numAnteriores / 8 + 1, 1)) == NULL)
+        return -1;
+    madvise((void *)snap->mapa, snap->tamMapa, MADV_RANDOM);
+    return 0;
+}
+
+// Name of entry (of the previous snapshot) or NULL if it is not valid
+const char *NombreSnapshot(const struct snapshot_tar *snap, const struct c_snapshot_entry *entrada)
+{
+    unsigned long long tam = snap->tamMapa - (snap->nombresAnteriores - snap->mapa);
+
+    if (entrada->nombre > tam || entrada->longitud > tam - entrada->nombre)
+        return NULL;
+    return snap->nombresAnteriores + entrada->nombre;
+}
+
+// Position of ruta in the previous snapshot or -1
+long long BuscaSnapshot(const struct snapshot_tar *snap, const char *ruta)
+{
+    unsigned long long h = HashNombre(ruta), izq = 0, der = snap->numAnteriores, mitad;
+    size_t lon = strlen(ruta);
+    const char *nombre;
+
+    // first entry with hash >= h
+    while (izq < der)
+    {
+        mitad = izq + (der - izq) / 2;
+        if (snap->anteriores[mitad].hash < h)
+            izq = mitad + 1;
+        else
+            der = mitad;
+    }
+    for (; izq < snap->numAnteriores && snap->anteriores[izq].hash == h; izq++)
+    {
+        nombre = NombreSnapshot(snap, &snap->anteriores[izq]);
+        if (nombre != NULL && snap->anteriores[izq].longitud == lon && memcmp(nombre, ruta, lon) == 0)
+            return izq;
+    }
+    return -1;
+}
+
+int AniadeSnapshot(struct snapshot_tar *snap, const char *nombre, size_t lon, const struct c_snapshot_entry *valores)
+{
+    struct c_snapshot_entry *entradas;
+    char *nombres;
+
+    if (snap->num == snap->cap)
+    {
+        snap->cap = (snap->cap == 0) ? 1024 : 2 * snap->cap;
+        if ((entradas = realloc(snap->entradas, snap->cap * sizeof(struct c_snapshot_entry))) == NULL)
+            return -1;
+        snap->entradas = entradas;
+    }
+    while (snap->tamNombres + lon > snap->capNombres)
+    {
+        snap->capNombres = (snap->capNombres == 0) ? 64 * 1024 : 2 * snap->capNombres;
+        if ((nombres = realloc(snap->nombres, snap->capNombres)) == NULL)
+            return -1;
+        snap->nombres = nombres;
+    }
+    snap->entradas[snap->num] = *valores;
+    snap->entradas[snap->num].nombre = snap->tamNombres;
+    snap->entradas[snap->num].longitud = lon;
+    snap->num++;
+    memcpy(snap->nombres + snap->tamNombres, nombre, lon);
+    snap->tamNombres += lon;
+    return 0;
+}
+
+// Record ruta in the snapshot of this run and return 1 if it has to be
+// written (new, changed or a directory) or 0 if it is unchanged. May be
+// called by the workers of -j.
+int CambiadoSnapshot(struct snapshot_tar *snap, const char *ruta, const struct stat *st)
+{
+    struct c_snapshot_entry valores;
+    const struct c_snapshot_entry *anterior;
+    long long i;
+    int cambiado = 1;
+
+    if (!snap->activo)
+        return 1;
+    bzero(&valores, sizeof(valores));
+    valores.hash = HashNombre(ruta);
+    valores.dev = st->st_dev;
+    valores.ino = st->st_ino;
+    valores.mtime = (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    valores.size = st->st_size;
+    pthread_mutex_lock(&snap->mutex);
+    if ((i = BuscaSnapshot(snap, ruta)) != -1)
+    {
+        snap->vistos[i / 8] |= 1 << (i % 8);
+        anterior = &snap->anteriores[i];
+        cambiado = S_ISDIR(st->st_mode) || anterior->dev != valores.dev || anterior->ino != valores.ino ||
+                   anterior->mtime != valores.mtime || anterior->size != valores.size;
+    }
+    AniadeSnapshot(snap, ruta, strlen(ruta), &valores);
+    if (!S_ISDIR(st->st_mode))
+    {
+        if (cambiado)
+            snap->cambiados++;
+        else
+            snap->iguales++;
+    }
+    pthread_mutex_unlock(&snap->mutex);
+    return cambiado;
+}
+
+// The names of the previous snapshot not found in this run: the ones
+// under raiz are written in the member raiz/SNAPSHOT_DELETED_NAME (if raiz
+// is a directory), the rest are kept in the snapshot
+int BorradosSnapshot(struct snapshot_tar *snap, int f_mytar, const char *raiz, const struct stat *stRaiz)
+{
+    struct c_header_gnu_tar cabecera;
+    char ruta[sizeof(cabecera.name) + 1], *lista = NULL, *nueva;
+    unsigned long long i, tam = 0, cap = 0;
+    size_t lon = strlen(raiz);
+    const char *nombre;
+    struct stat st;
+    int ret = 0;
+
+    // "raiz/..." ("raiz..." if raiz ends with /)
+    while (lon > 1 && raiz[lon - 1] == '/')
+        lon--;
+    for (i = 0; i < snap->numAnteriores; i++)
+    {
+        if ((snap->vistos[i / 8] & (1 << (i % 8))) || (nombre = NombreSnapshot(snap, &snap->anteriores[i])) == NULL)
+            continue;
+        if (snap->anteriores[i].longitud <= lon || memcmp(nombre, raiz, lon) != 0 || nombre[lon] != '/')
+        {
+            AniadeSnapshot(snap, nombre, snap->anteriores[i].longitud, &snap->anteriores[i]);
+            continue;
+        }
+        while (tam + snap->anteriores[i].longitud + 1 > cap)
+        {
+            cap = (cap == 0) ? 4096 : 2 * cap;
+            if ((nueva = realloc(lista, cap)) == NULL)
+            {
+                free(lista);
+                return ERROR_GENERATE_TAR_FILE;
+            }
+            lista = nueva;
+        }
+        memcpy(lista + tam, nombre, snap->anteriores[i].longitud);
+        tam += snap->anteriores[i].longitud;
+        lista[tam++] = '\n';
+        snap->borrados++;
+    }
+    if (tam > 0 && S_ISDIR(stRaiz->st_mode) &&
+        snprintf(ruta, sizeof(ruta), "%.*s/%s", (int)lon, raiz, SNAPSHOT_DELETED_NAME) < (int)sizeof(cabecera.name))
+    {
+        // a regular file with the owner and dates of raiz
+        st = *stRaiz;
+        st.st_mode = S_IFREG | 0644;
+        st.st_size = tam;
+        if (ConstruyeCabeceraTar(ruta, &st, AT_FDCWD, ruta, &cabecera) == HEADER_OK)
+        {
+            writeHeader(f_mytar, &cabecera);
+            EscribeEscritorTar(&EscritorTar, lista, tam);
+            if (tam % DATAFILE_BLOCK_SIZE != 0)
+                EscribeCerosEscritorTar(&EscritorTar, DATAFILE_BLOCK_SIZE - (tam % DATAFILE_BLOCK_SIZE));
+        }
+        else
+            ret = ERROR_GENERATE_TAR_FILE;
+    }
+    free(lista);
+    return ret;
+}
+
+// Order of the entries of a snapshot: hash, name
+static const char *NombresOrdenSnapshot;
+
+int ComparaSnapshot(const void *a, const void *b)
+{
+    const struct c_snapshot_entry *x = a, *y = b;
+    unsigned int lon = (x->longitud < y->longitud) ? x->longitud : y->longitud;
+    int c;
+
+    if (x->hash != y->hash)
+        return (x->hash < y->hash) ? -1 : 1;
+    if ((c = memcmp(NombresOrdenSnapshot + x->nombre, NombresOrdenSnapshot + y->nombre, lon)) != 0)
+        return c;
+    return (int)x->longitud - (int)y->longitud;
+}
+
+int GuardaSnapshot(char *fichero, struct snapshot_tar *snap)
+{
+    char TmpFileName[PATH_MAX];
+    struct c_snapshot_header cabecera;
+    size_t tam;
+    int fd;
+
+    NombresOrdenSnapshot = snap->nombres;
+    if (snap->num > 0)
+        qsort(snap->entradas, snap->num, sizeof(struct c_snapshot_entry), ComparaSnapshot);
+    if ((size_t)snprintf(TmpFileName, sizeof(TmpFileName), "%s.tmp", fichero) >= sizeof(TmpFileName) ||
+        (fd = open(TmpFileName, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1)
+    {
+        fprintf(stderr, "No se puede crear el snapshot %s\n", fichero);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    bzero(&cabecera, sizeof(cabecera));
+    memcpy(cabecera.magic, SNAPSHOT_MAGIC, sizeof(cabecera.magic));
+    cabecera.version = SNAPSHOT_VERSION;
+    cabecera.num = snap->num;
+    cabecera.nombres = snap->tamNombres;
+    tam = snap->num * sizeof(struct c_snapshot_entry);
+    if ((write(fd, &cabecera, sizeof(cabecera)) != sizeof(cabecera)) ||
+        (tam != 0 && EscribeTodo(fd, (const char *)snap->entradas, tam) != 0) ||
+        (snap->tamNombres != 0 && EscribeTodo(fd, snap->nombres, snap->tamNombres) != 0))
+    {
+        fprintf(stderr, "No se puede escribir el snapshot %s\n", fichero);
+        close(fd);
+        unlink(TmpFileName);
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    close(fd);
+    if (rename(TmpFileName, fichero) == -1)
+    {
+        unlink(TmpFileName);
+        return ERROR_GENERATE_TAR_FILE;
+    }
+    return 0;
+}
+
+void LiberaSnapshot(struct snapshot_tar *snap)
+{
+    if (snap->mapa != NULL)
+        munmap((void *)snap->mapa, snap->tamMapa);
+    free(snap->vistos);
+    free(snap->entradas);
+    free(snap->nombres);
+    snap->mapa = NULL;
+    snap->vistos = NULL;
+    snap->entradas = NULL;
+    snap->nombres = NULL;
 }
 
 // ----------------------------------------------------------------
-// (2.2) complete Tar file to  multiple of 10KB size block
-unsigned long WriteCompleteTarSize(unsigned long TarActualSize, int fd_TarFile)
+// Create the directories of the path of f_dat that do not exist
+int CreaRutaPadre(const char *f_dat)
 {
-    unsigned long NumWriteBytes;
-    unsigned long Module, offset = 0;
-    int n;
-    char *buffer;
+    char ruta[PATH_MAX];
+    char *p;
+
+    snprintf(ruta, sizeof(ruta), "%s", f_dat);
+    for (p = strchr(ruta + 1, '/'); p != NULL; p = strchr(p + 1, '/'))
+    {
+        *p = '\0';
+        CuentaLlamadas(1);
+        if (mkdir(ruta, 00755) == -1 && errno != EEXIST)
+            return -1;
+        TRAZA(2, "directorio %s creado\n", ruta);
+        *p = '/';
+    }
+    return 0;
+}
+
+// ----------------------------------------------------------------
+// Restore the owner of f_dat (only root can do it): the user and group
+// names of the header if they exist in this system, if not the uid and gid
+void RestauraPropietario(const struct c_header_gnu_tar *pheaderData, const char *f_dat)
+{
+    char uname[sizeof(pheaderData->uname) + 1], gname[sizeof(pheaderData->gname) + 1];
+    uid_t uid;
+    gid_t gid;
+
+    if (geteuid() != 0)
+        return;
+    snprintf(uname, sizeof(uname), "%.*s", (int)sizeof(pheaderData->uname), pheaderData->uname);
+    snprintf(gname, sizeof(gname), "%.*s", (int)sizeof(pheaderData->gname), pheaderData->gname);
+    pthread_mutex_lock(&MutexNombres);
+    uid = getUserId(uname, DecodificaNumero(pheaderData->uid, sizeof(pheaderData->uid)));
+    gid = getGroupId(gname, DecodificaNumero(pheaderData->gid, sizeof(pheaderData->gid)));
+    pthread_mutex_unlock(&MutexNombres);
+    CuentaLlamadas(1);
+    if (lchown(f_dat, uid, gid) == -1)
+        fprintf(stderr, "No se puede cambiar el propietario de %s\n", f_dat);
+}
+
+// ----------------------------------------------------------------
+// Extract the member described by cabeceraTar. The reader must be at
+// the first data block of the member.
+int extrae_miembro(struct lector_tar *lector, const struct c_header_gnu_tar *cabeceraTar, char *f_dat)
+{
+    int fase = EntraFase(FASE_EXTRACCION), ret;
+
+    ret = CreaMiembro(lector, cabeceraTar, f_dat);
+    SaleFase(fase, DecodificaNumero(cabeceraTar->size, sizeof(cabeceraTar->size)), ret == 0);
+    return ret;
+}
+
+int CreaMiembro(struct lector_tar *lector, const struct c_header_gnu_tar *cabeceraTar, char *f_dat)
+{
+    struct c_header_gnu_tar copia = *cabeceraTar; // the header may be mapped read only
+    struct c_header_gnu_tar *pheaderData = &copia;
+    char destino[sizeof(copia.linkname) + 1];
+    int fd_DatFile, permisos, ret = 0;
+    unsigned long i;
+    unsigned long long tam;
+
+    permisos = DecodificaNumero(pheaderData->mode, sizeof(pheaderData->mode));
+    TRAZA(2, "permisos=%d\n", permisos);
+    TRAZA(1, "detectada ruta=%.100s\n", pheaderData->name);
+    if (CreaRutaPadre(f_dat) != 0)
+    {
+        fprintf(stderr, "No se puede crear el Directorio al extraer %s\n", f_dat);
+        return ERROR_OPEN_DAT_FILE;
+    }
+    TRAZA(2, "typeflag=%.1s\n", pheaderData->typeflag);
+    if (strcmp(pheaderData->typeflag, "0") == 0) // IS NORMAL FILE
+    {
+        tam = DecodificaNumero(pheaderData->size, sizeof(pheaderData->size));
+        TRAZA(2, "[[[[ FILE ]]]] %s\n", f_dat);
+        // create file to extract
+        CuentaLlamadas(3); // open, close, chmod
+        if ((fd_DatFile = open(f_dat, O_CREAT | O_WRONLY | O_TRUNC, 0600)) == -1)
+        {
+            fprintf(stderr, "No se puede crear el fichero al extraer %s\n", f_dat);
+            return ERROR_OPEN_TAR_FILE;
+        }
+        // copy only the size of the file (not the zeros of the last block)
+        if (CopiaDatosLector(lector, fd_DatFile, tam) != 0)
+        {
+            fprintf(stderr, "Error al copiar los datos al extraer %s\n", f_dat);
+            ret = ERROR_OPEN_TAR_FILE;
+        }
+        close(fd_DatFile);
+        RestauraPropietario(pheaderData, f_dat);
+        chmod(f_dat, permisos);
+    }
+    else if (pheaderData->typeflag[0] == 'S') // IS SPARSE FILE
+    {
+        TRAZA(2, "[[[[ SPARSE FILE ]]]] %s\n", f_dat);
+        CuentaLlamadas(4 + lector->disperso.num); // open, lseek of each region, ftruncate, close, chmod
+        if ((fd_DatFile = open(f_dat, O_CREAT | O_WRONLY | O_TRUNC, 0600)) == -1)
+        {
+            fprintf(stderr, "No se puede crear el fichero al extraer %s\n", f_dat);
+            return ERROR_OPEN_TAR_FILE;
+        }
+        // only the data regions are written: the holes are left by lseek
+        // and by ftruncate (a hole at the end)
+        for (i = 0; i < lector->disperso.num; i++)
+        {
+            if (lseek(fd_DatFile, lector->disperso.entradas[i].offset, SEEK_SET) == -1 ||
+                CopiaDatosLector(lector, fd_DatFile, lector->disperso.entradas[i].tam) != 0)
+            {
+                fprintf(stderr, "Error al copiar los datos al extraer %s\n", f_dat);
+                ret = ERROR_OPEN_TAR_FILE;
+                break;
+            }
+        }
+        if (ret == 0 && ftruncate(fd_DatFile, lector->disperso.real) == -1)
+        {
+            fprintf(stderr, "Error al copiar los datos al extraer %s\n", f_dat);
+            ret = ERROR_OPEN_TAR_FILE;
+        }
+        close(fd_DatFile);
+        RestauraPropietario(pheaderData, f_dat);
+        chmod(f_dat, permisos);
+    }
+    else if (pheaderData->typeflag[0] == '1') // IS HARD LINK
+    {
+        TRAZA(2, "[[[[ HARD LINK ]]]] linkname=%.100s\n", pheaderData->linkname);
+        memcpy(destino, pheaderData->linkname, sizeof(pheaderData->linkname));
+        destino[sizeof(pheaderData->linkname)] = '\0';
+        unlink(f_dat);
+        CuentaLlamadas(2);
+        if (link(destino, f_dat) == -1)
+        {
+            fprintf(stderr, "No se puede crear el enlace al extraer %s (%.100s)\n", f_dat, pheaderData->linkname);
+            return ERROR_OPEN_DAT_FILE;
+        }
+    }
+    else if (strcmp(pheaderData->typeflag, "5") == 0) // IS DIRECTORY
+    {
+        TRAZA(2, "[[[[ DIRECTORY ]]]]\n");
+        CuentaLlamadas(1);
+
+        if (opendir(f_dat) == NULL)
+        {
+            TRAZA(2, "NO EXISTE EL DIRECTORIO, SE GENERA \n");
+            CuentaLlamadas(2); // mkdir, chmod
+            if (fd_DatFile = mkdir(f_dat, 0644) == -1)
+            {
+                fprintf(stderr, "No se puede crear el Directorio al extraer %s\n", f_dat);
+                return ERROR_OPEN_DAT_FILE;
+            }
+            RestauraPropietario(pheaderData, f_dat);
+            chmod(f_dat, permisos);
+        }
+        else
+        {
+            TRAZA(2, "YA EXISTE EL DIRECTORIO \n");
+        }
+    }
+    else
+    {
+        if (strstr(pheaderData->typeflag, "2") != NULL)
+        {
+            TRAZA(2, "[[[[ SYM LINK ]]]] linkname=%.100s\n", pheaderData->linkname);
+            CuentaLlamadas(1);
+            if (symlink(pheaderData->linkname, f_dat) == -1)
+            {
+                fprintf(stderr, "No se puede crear el enlace simbolico al extraer %s\n", f_dat);
+                return ERROR_OPEN_DAT_FILE;
+            }
+            // (chmod would change the mode of the target of the link)
+            RestauraPropietario(pheaderData, f_dat);
+        }
+    }
+
+    // lseek(fd_TarFile, bytesJump - atoi(pheaderData.size), 1); // jump block
+    return ret;
+}
+
+// ----------------------------------------------------------------
+// Extraction of small regular files with io_uring (-u): the member of
+// pheaderData (the reader at its data) is added to the batch. Return -1 if
+// it has to be extracted by extrae_miembro (after VaciaExtraccionUring).
+int EncolaExtraccionUring(struct lote_uring *lote, struct lector_tar *lector, const struct c_header_gnu_tar *pheaderData, char *f_dat)
+{
+    struct op_uring *op;
+    unsigned long long tam;
+    unsigned int i;
+    int ret = 0;
+
+    if (!lote->activo || pheaderData->typeflag[0] != '0' || strlen(f_dat) >= sizeof(op->nombre) ||
+        (tam = DecodificaNumero(pheaderData->size, sizeof(pheaderData->size))) > URING_MAX_FILE)
+        return -1;
+    // the same name twice in a batch: the second one after the first one
+    for (i = 0; i < lote->num; i++)
+        if (strcmp(lote->ops[i].nombre, f_dat) == 0)
+            break;
+    if (lote->num == URING_DEPTH || i < lote->num)
+        ret = VaciaExtraccionUring(lote);
+    if (CreaRutaPadre(f_dat) != 0)
+    {
+        fprintf(stderr, "No se puede crear el Directorio al extraer %s\n", f_dat);
+        return ERROR_OPEN_DAT_FILE;
+    }
+    op = &lote->ops[lote->num];
+    op->cabecera = *pheaderData;
+    strcpy(op->nombre, f_dat);
+    op->tam = tam;
+    // the data stays in the mapped tar file; otherwise it is read
+    if (lector->modo == LECTOR_MMAP && lector->pos + tam <= lector->tam)
+        op->datos = lector->mapa + lector->pos;
+    else if (LeeDatosLector(lector, op->buffer, tam) == 0)
+        op->datos = op->buffer;
+    else
+    {
+        fprintf(stderr, "Error al copiar los datos al extraer %s\n", f_dat);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    // O_EXCL: an existing file is extracted again by the synchronous path
+    EncolaOpUring(lote, lote->num, AT_FDCWD, O_WRONLY | O_CREAT | O_EXCL,
+                  DecodificaNumero(pheaderData->mode, sizeof(pheaderData->mode)) & 07777, IORING_OP_WRITE, (void *)op->datos);
+    lote->num++;
+    return ret;
+}
+
+// Run the batch and finish its files in order (owner, mode, and the files
+// that already existed)
+int VaciaExtraccionUring(struct lote_uring *lote)
+{
+    struct op_uring *op;
+    unsigned long long bytes = 0;
+    unsigned int i;
+    int fd_DatFile, permisos, ret = 0, fase;
+
+    if (lote->num == 0)
+        return 0;
+    fase = EntraFase(FASE_EXTRACCION);
+    if (EsperaAnilloTar(&lote->anillo, ResultadoUring, lote) != 0)
+        fprintf(stderr, "Error de io_uring al extraer\n");
+    for (i = 0; i < lote->num; i++)
+    {
+        op = &lote->ops[i];
+        permisos = DecodificaNumero(op->cabecera.mode, sizeof(op->cabecera.mode));
+        TRAZA(1, "[[[[ FILE io_uring ]]]] %s\n", op->nombre);
+        lote->ficheros++;
+        bytes += op->tam;
+        if (op->resAbre < 0)
+        {
+            lote->sincronos++;
+            CuentaLlamadas(2);
+            if ((fd_DatFile = open(op->nombre, O_CREAT | O_WRONLY | O_TRUNC, 0600)) == -1)
+            {
+                fprintf(stderr, "No se puede crear el fichero al extraer %s\n", op->nombre);
+                ret = ERROR_OPEN_TAR_FILE;
+                continue;
+            }
+            op->resDatos = (EscribeTodo(fd_DatFile, op->datos, op->tam) == 0) ? (int)op->tam : -EIO;
+            close(fd_DatFile);
+            op->resAbre = -EEXIST; // the mode of an existing file is not set by open
+        }
+        if (op->resDatos != (int)op->tam)
+            fprintf(stderr, "Error al copiar los datos al extraer %s\n", op->nombre);
+        RestauraPropietario(&op->cabecera, op->nombre);
+        // the mode of open is masked by umask (and lchown clears setuid)
+        if ((permisos & lote->mascara & 07777) != 0 || geteuid() == 0 || op->resAbre < 0)
+        {
+            CuentaLlamadas(1);
+            chmod(op->nombre, permisos);
+        }
+    }
+    SaleFase(fase, bytes, lote->num);
+    lote->num = 0;
+    return ret;
+}
+
+// ----------------------------------------------------------------
+// Extract f_dat using the member index of f_mytar (if any).
+// Return 1 if the index can not be used (no index, stale entry or
+// member not in the index) and a linear scan is needed.
+int extrae_fichero_indice(struct lector_tar *lector, char *f_mytar, char *f_dat)
+{
+    struct indice_tar indice;
+    struct c_index_tar_entry *entrada;
+    const struct c_header_gnu_tar *pheaderData;
+    int ret = 1;
+
+    bzero(&indice, sizeof(indice));
+    if (CargaIndiceTar(f_mytar, &indice) != 0)
+        return 1;
+
+    entrada = IndiceBusca(&indice, f_dat);
+    if (entrada != NULL)
+    {
+        TRAZA(1, "indice: %s en offset %llu\n", f_dat, entrada->offset);
+        // the index is only a hint, check the header stored in the tar file
+        SituaLectorTar(lector, entrada->offset);
+        if (((pheaderData = SiguienteCabeceraTar(lector)) != NULL) &&
+            (strcmp(pheaderData->magic, "ustar  ") == 0) &&
+            (strncmp(pheaderData->name, entrada->name, sizeof(pheaderData->name)) == 0))
+        {
+            ret = extrae_miembro(lector, pheaderData, f_dat);
+        }
+        else
+        {
+            fprintf(stderr, "Indice desactualizado %s%s, se recorre el tar\n", f_mytar, INDEX_FILE_SUFFIX);
+        }
+    }
+    LiberaIndiceTar(&indice);
+    if (ret == 1)
+        SituaLectorTar(lector, 0);
+    return ret;
+}
+
+// ----------------------------------------------------------------
+// Members to extract: names (in a hash set) and glob patterns
+struct seleccion_tar
+{
+    char **nombres;              // names and patterns (as given)
+    char *encontrado;            // the name (pattern) matched a member
+    unsigned long num, cap;
+    unsigned long *tabla;        // hash set of the names (position + 1, 0 = free)
+    unsigned long tam_tabla;
+    unsigned long literales;     // names (not patterns) not repeated
+    unsigned long encontrados;   // names found
+    int patrones;                // number of patterns
+};
+
+// The name has wildcards of fnmatch
+int EsPatron(const char *nombre)
+{
+    return strpbrk(nombre, "*?[") != NULL;
+}
+
+// Add a name (or pattern) to the selection
+int SeleccionAniade(struct seleccion_tar *sel, const char *nombre)
+{
+    char **nombres, *encontrado;
+
+    if (sel->num == sel->cap)
+    {
+        sel->cap = (sel->cap == 0) ? 64 : 2 * sel->cap;
+        if ((nombres = realloc(sel->nombres, sel->cap * sizeof(char *))) == NULL)
+            return -1;
+        sel->nombres = nombres;
+        if ((encontrado = realloc(sel->encontrado, sel->cap)) == NULL)
+            return -1;
+        sel->encontrado = encontrado;
+    }
+    if ((sel->nombres[sel->num] = strdup(nombre)) == NULL)
+        return -1;
+    sel->encontrado[sel->num] = 0;
+    sel->num++;
+    return 0;
+}
+
+// Add the names of the file lista (one per line)
+int SeleccionLeeLista(struct seleccion_tar *sel, const char *lista)
+{
+    char linea[PATH_MAX + 2];
+    size_t len;
+    FILE *f;
+
+    if ((f = fopen(lista, "r")) == NULL)
+    {
+        fprintf(stderr, "No se puede abrir la lista %s\n", lista);
+        return -1;
+    }
+    while (fgets(linea, sizeof(linea), f) != NULL)
+    {
+        len = strlen(linea);
+        while (len > 0 && (linea[len - 1] == '\n' || linea[len - 1] == '\r'))
+            linea[--len] = '\0';
+        if (len > 0 && SeleccionAniade(sel, linea) != 0)
+        {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// Build the hash set of names, when all the names are added
+int SeleccionConstruye(struct seleccion_tar *sel)
+{
+    unsigned long i, pos, mask, tam = 64;
+
+    while (tam < 2 * sel->num)
+        tam *= 2;
+    if ((sel->tabla = calloc(tam, sizeof(unsigned long))) == NULL)
+        return -1;
+    sel->tam_tabla = tam;
+    mask = tam - 1;
+    for (i = 0; i < sel->num; i++)
+    {
+        if (EsPatron(sel->nombres[i]))
+        {
+            sel->patrones++;
+            continue;
+        }
+        pos = HashNombre(sel->nombres[i]) & mask;
+        while (sel->tabla[pos] != 0 && strcmp(sel->nombres[sel->tabla[pos] - 1], sel->nombres[i]) != 0)
+            pos = (pos + 1) & mask;
+        if (sel->tabla[pos] != 0)
+        {
+            sel->encontrado[i] = 1; // repeated, reported with the first one
+            continue;
+        }
+        sel->tabla[pos] = i + 1;
+        sel->literales++;
+    }
+    return 0;
+}
+
+// Return 1 if name is selected (and mark the names and patterns found)
+int SeleccionBusca(struct seleccion_tar *sel, const char *name)
+{
+    unsigned long i, pos, mask = sel->tam_tabla - 1;
+    int ret = 0;
+
+    pos = HashNombre(name) & mask;
+    while (sel->tabla[pos] != 0)
+    {
+        i = sel->tabla[pos] - 1;
+        if (strcmp(sel->nombres[i], name) == 0)
+        {
+            // the first member with the name (as the index)
+            if (sel->encontrado[i])
+                return 0;
+            sel->encontrado[i] = 1;
+            sel->encontrados++;
+            return 1;
+        }
+        pos = (pos + 1) & mask;
+    }
+    for (i = 0; sel->patrones > 0 && i < sel->num; i++)
+    {
+        if (EsPatron(sel->nombres[i]) && fnmatch(sel->nombres[i], name, 0) == 0)
+        {
+            sel->encontrado[i] = 1;
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+// Print the names (and patterns) not found. Return how many.
+unsigned long SeleccionNoEncontrados(struct seleccion_tar *sel)
+{
+    unsigned long i, n = 0;
+
+    for (i = 0; i < sel->num; i++)
+    {
+        if (!sel->encontrado[i])
+        {
+            fprintf(stderr, "No se encuentra en el tar: %s\n", sel->nombres[i]);
+            n++;
+        }
+    }
+    return n;
+}
+
+void LiberaSeleccion(struct seleccion_tar *sel)
+{
+    unsigned long i;
+
+    for (i = 0; i < sel->num; i++)
+        free(sel->nombres[i]);
+    free(sel->nombres);
+    free(sel->encontrado);
+    free(sel->tabla);
+    bzero(sel, sizeof(struct seleccion_tar));
+}
+
+// ----------------------------------------------------------------
+// Open f_mytar to read it. "-" is the standard input (if it is a pipe it
+// is read as a stream, see LECTOR_FLUJO).
+int AbreTarLectura(const char *f_mytar)
+{
+    if (strcmp(f_mytar, "-") == 0)
+        return dup(STDIN_FILENO);
+    return open(f_mytar, O_RDONLY);
+}
+
+// ----------------------------------------------------------------
+// Extract all the members of f_mytar selected in sel, in one pass
+int extrae_ficheros(char *f_mytar, struct seleccion_tar *sel)
+{
+    const struct c_header_gnu_tar *pheaderData;
+    struct lector_tar lector;
+    unsigned long long datos, tamDatos;
+    char name[sizeof(pheaderData->name) + 1];
+    int fd_TarFile, ret = 0, r;
+    TRAZA(2, "EXTRAER \n");
+
+    if ((fd_TarFile = AbreTarLectura(f_mytar)) == -1)
+    {
+        fprintf(stderr, "No se puede abrir el fichero tar %s\n", f_mytar);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    if (AbreLectorTar(&lector, fd_TarFile, ModoLector) != 0)
+    {
+        close(fd_TarFile);
+        return ERROR_OPEN_TAR_FILE;
+    }
+
+    // only one name: straight to its header with the index
+    if (sel->num == 1 && sel->patrones == 0 && lector.modo != LECTOR_FLUJO)
+    {
+        if ((ret = extrae_fichero_indice(&lector, f_mytar, sel->nombres[0])) != 1)
+        {
+            CierraLectorTar(&lector);
+            close(fd_TarFile);
+            return ret;
+        }
+        ret = 0;
+    }
+
+    while ((pheaderData = SiguienteCabeceraTar(&lector)) != NULL)
+    {
+        if (strcmp(pheaderData->magic, "ustar  ") == 0)
+        {
+            snprintf(name, sizeof(name), "%.*s", (int)sizeof(pheaderData->name), pheaderData->name);
+            TRAZA(1, "esta=%s\n", name);
+            tamDatos = TamanioDatosTar(pheaderData);
+            datos = lector.pos;
+            // extract the member if its name is selected
+            if (SeleccionBusca(sel, name))
+            {
+                // small regular files in batches (-u); the batch is done
+                // before any other member
+                if ((r = EncolaExtraccionUring(&LoteUring, &lector, pheaderData, name)) == -1)
+                {
+                    if ((r = VaciaExtraccionUring(&LoteUring)) != 0)
+                        ret = r;
+                    r = extrae_miembro(&lector, pheaderData, name);
+                }
+                if (r != 0)
+                    ret = r;
+                // the data may be read (or not) by extrae_miembro
+                SituaLectorTar(&lector, datos + tamDatos);
+                // all the names found and no patterns: the rest is not read
+                if (sel->patrones == 0 && sel->encontrados == sel->literales)
+                    break;
+            }
+            else
+            {
+                TRAZA(2, "salta\n");
+                SaltaDatosTar(&lector, tamDatos);
+            }
+        }
+    }
+    if ((r = VaciaExtraccionUring(&LoteUring)) != 0)
+        ret = r;
+    CierraLectorTar(&lector);
+    close(fd_TarFile);
+    if (SeleccionNoEncontrados(sel) != 0 && ret == 0)
+        ret = ERROR_MEMBER_NOT_FOUND;
+    return ret;
+}
+
+// ----------------------------------------------------------------
+// Extract f_dat of f_mytar
+int extrae_fichero(char *f_mytar, char *f_dat)
+{
+    struct seleccion_tar sel;
+    int ret;
+
+    bzero(&sel, sizeof(sel));
+    if (SeleccionAniade(&sel, f_dat) != 0 || SeleccionConstruye(&sel) != 0)
+    {
+        LiberaSeleccion(&sel);
+        return ERROR_OPEN_DAT_FILE;
+    }
+    ret = extrae_ficheros(f_mytar, &sel);
+    LiberaSeleccion(&sel);
+    return ret;
+}
+
+// ----------------------------------------------------------------
+// Extraction of the whole tar file (-x) with Hilos worker threads. The
+// reader (the caller) walks the headers in order: it creates the
+// directories (each one once, the parents before the children) and gives
+// the files and symbolic links to the workers, that copy their data from
+// its offset in the tar file (copy_file_range/pread, or the mapping with
+// -m) and restore owner and mode. The hard links are made when the
+// workers have finished (their targets must exist), and the modes of the
+// new directories at the end (a read only directory would not let the
+// workers create its files). A name that is already in flight waits for
+// the workers (the last member wins, as in tar).
+#define COLA_EXTRACCION 256 // jobs in flight
+
+#define TRABAJO_LIBRE (0)
+#define TRABAJO_PENDIENTE (1)
+
+struct trabajo_extraccion
+{
+    struct c_header_gnu_tar cabecera;
+    char name[sizeof(((struct c_header_gnu_tar *)0)->name) + 1];
+    unsigned long long datos;      // offset of the data in the tar file
+    struct mapa_disperso disperso; // sparse member ('S'): its map
+    int estado;                    // TRABAJO_LIBRE or TRABAJO_PENDIENTE
+};
+
+struct extraccion_tar
+{
+    int fd;                          // tar file
+    const char *mapa;                // -m: the tar file mapped
+    unsigned long long tam;          // -m: size of mapa
+    struct trabajo_extraccion *cola; // COLA_EXTRACCION jobs (job i in i % COLA_EXTRACCION)
+    unsigned long num;               // jobs given by the reader
+    unsigned long siguiente;         // next job for a worker
+    unsigned long hechos;            // jobs finished
+    int fin;
+    int ret;                         // first error of the workers
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+// Set of names (open addressing, HashNombre)
+struct conjunto_nombres
+{
+    char **tabla;
+    unsigned long tam, num;
+};
+
+// Add nombre to the set. Return 1 if it was already in it, -1 on error.
+int ConjuntoAniade(struct conjunto_nombres *conj, const char *nombre)
+{
+    char **tabla, **viejo;
+    unsigned long i, pos, tam;
+
+    if (2 * (conj->num + 1) > conj->tam)
+    {
+        tam = (conj->tam == 0) ? 1024 : 2 * conj->tam;
+        if ((tabla = calloc(tam, sizeof(char *))) == NULL)
+            return -1;
+        for (i = 0; i < conj->tam; i++)
+        {
+            if (conj->tabla[i] == NULL)
+                continue;
+            for (pos = HashNombre(conj->tabla[i]) & (tam - 1); tabla[pos] != NULL; pos = (pos + 1) & (tam - 1))
+                ;
+            tabla[pos] = conj->tabla[i];
+        }
+        viejo = conj->tabla;
+        conj->tabla = tabla;
+        conj->tam = tam;
+        free(viejo);
+    }
+    for (pos = HashNombre(nombre) & (conj->tam - 1); conj->tabla[pos] != NULL; pos = (pos + 1) & (conj->tam - 1))
+        if (strcmp(conj->tabla[pos], nombre) == 0)
+            return 1;
+    if ((conj->tabla[pos] = strdup(nombre)) == NULL)
+        return -1;
+    conj->num++;
+    return 0;
+}
+
+void LiberaConjunto(struct conjunto_nombres *conj)
+{
+    unsigned long i;
 
-    NumWriteBytes = TarActualSize;
-    unsigned long reference = 10240;
-    // complete to  multiple of 10KB size blocks
-    printf("TAR_FILE_BLOCK_SIZE=%ld  TarFileSize=%ld\n", TAR_FILE_BLOCK_SIZE, NumWriteBytes); // Traza
-    unsigned long k = 10240;
-    int mod_k = NumWriteBytes % k;
-    int diff = 0;
-    printf("\nBytes % k = %d \n", mod_k);
-    printf("DATA BLOCK ::: %i \n", FileDataBlock);
+    for (i = 0; i < conj->tam; i++)
+        free(conj->tabla[i]);
+    free(conj->tabla);
+    bzero(conj, sizeof(struct conjunto_nombres));
+}
+
+// Create the directories of ruta (the last component too if completo)
+// that have not been created yet. Return 1 if the last one is created.
+int CreaDirectoriosExtraccion(struct conjunto_nombres *dirs, const char *ruta, int completo)
+{
+    char camino[PATH_MAX];
+    char *p;
+    int creado = 0, ultimo, fase;
 
-    if (mod_k != 0)
+    snprintf(camino, sizeof(camino), "%s", ruta);
+    for (p = strchr(camino + 1, '/');; p = strchr(p + 1, '/'))
     {
+        ultimo = (p == NULL || p[1] == '\0');
+        if (ultimo && !completo)
+            break;
+        if (p != NULL)
+            *p = '\0';
+        if (ConjuntoAniade(dirs, camino) == 0)
+        {
+            fase = EntraFase(FASE_EXTRACCION);
+            creado = (mkdir(camino, 00755) == 0);
+            CuentaLlamadas(1);
+            SaleFase(fase, 0, creado);
+            if (!creado && errno != EEXIST)
+            {
+                fprintf(stderr, "No se puede crear el Directorio al extraer %s\n", camino);
+                return -1;
+            }
+            TRAZA(2, "directorio %s creado\n", camino);
+        }
+        if (ultimo)
+            break;
+        *p = '/';
+    }
+    return creado;
+}
+
+// Copy tam bytes of the tar file at offset to fd_DatFile (buff: a buffer
+// of FactorBloqueo blocks). The offset of the tar file is not used, so the
+// workers copy at the same time.
+int CopiaDatosOffset(struct extraccion_tar *ext, unsigned long long offset, unsigned long long tam, int fd_DatFile, char *buff)
+{
+    unsigned long tamBuff = FactorBloqueo * DATAFILE_BLOCK_SIZE;
+    loff_t off = offset;
+    ssize_t n;
 
-        diff = k - mod_k;
+    if (ext->mapa != NULL)
+    {
+        if (offset + tam > ext->tam)
+            return -1;
+        return EscribeTodo(fd_DatFile, ext->mapa + offset, tam);
+    }
+    while (CopiaDirecta && tam > 0)
+    {
+        CuentaLlamadas(1);
+        if ((n = copy_file_range(ext->fd, &off, fd_DatFile, NULL, (tam < 0x40000000ULL) ? tam : 0x40000000, 0)) <= 0)
+            break;
+        tam -= n;
+    }
+    while (tam > 0)
+    {
+        CuentaLlamadas(1);
+        if ((n = pread(ext->fd, buff, (tam < tamBuff) ? tam : tamBuff, off)) <= 0 ||
+            EscribeTodo(fd_DatFile, buff, n) != 0)
+            return -1;
+        off += n;
+        tam -= n;
+    }
+    return 0;
+}
 
-        printf("DIFF: %i \n", diff);
+// Extract the file or symbolic link of a job
+int ExtraeTrabajo(struct extraccion_tar *ext, struct trabajo_extraccion *trabajo, char *buff)
+{
+    struct c_header_gnu_tar *pheaderData = &trabajo->cabecera;
+    unsigned long long offset = trabajo->datos;
+    int fd_DatFile, permisos, ret = 0;
+    unsigned long i;
 
-        bzero(FileDataBlock, sizeof(FileDataBlock));
-        while (diff > DATAFILE_BLOCK_SIZE)
+    permisos = DecodificaNumero(pheaderData->mode, sizeof(pheaderData->mode));
+    if (pheaderData->typeflag[0] == '2')
+    {
+        CuentaLlamadas(1);
+        if (symlink(pheaderData->linkname, trabajo->name) == -1)
         {
-            printf("DIFF: %ld \n", diff);
-            write(fd_TarFile, FileDataBlock, sizeof(FileDataBlock));
-            NumWriteBytes += sizeof(FileDataBlock);
-            // k=k-sizeof(FileDataBlock);
-            diff = diff - sizeof(FileDataBlock);
-            offset += (unsigned long)sizeof(FileDataBlock);
+            fprintf(stderr, "No se puede crear el enlace simbolico al extraer %s\n", trabajo->name);
+            return ERROR_OPEN_DAT_FILE;
         }
-        printf("FIN --> %ld \n", NumWriteBytes);
-        int size = diff * sizeof(char);
-        buffer = (char *)malloc(size);
-        bzero(buffer, size);
-        NumWriteBytes += write(fd_TarFile, buffer, size);
-        free(buffer);
-        offset += (unsigned long)size;
-        printf("FIN --> %ld \n", NumWriteBytes);
+        RestauraPropietario(pheaderData, trabajo->name);
+        return 0;
+    }
+    CuentaLlamadas(3); // open, close, chmod
+    if ((fd_DatFile = open(trabajo->name, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+    {
+        fprintf(stderr, "No se puede crear el fichero al extraer %s\n", trabajo->name);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    if (pheaderData->typeflag[0] == 'S')
+    {
+        // the data regions one after another; the holes are left by lseek
+        CuentaLlamadas(1 + trabajo->disperso.num); // lseek of each region, ftruncate
+        for (i = 0; i < trabajo->disperso.num && ret == 0; i++)
+        {
+            if (lseek(fd_DatFile, trabajo->disperso.entradas[i].offset, SEEK_SET) == -1 ||
+                CopiaDatosOffset(ext, offset, trabajo->disperso.entradas[i].tam, fd_DatFile, buff) != 0)
+                ret = -1;
+            offset += trabajo->disperso.entradas[i].tam;
+        }
+        if (ret == 0 && ftruncate(fd_DatFile, trabajo->disperso.real) == -1)
+            ret = -1;
     }
+    else
+        ret = CopiaDatosOffset(ext, offset, DecodificaNumero(pheaderData->size, sizeof(pheaderData->size)), fd_DatFile, buff);
+    if (ret != 0)
+        fprintf(stderr, "Error al copiar los datos al extraer %s\n", trabajo->name);
+    close(fd_DatFile);
+    RestauraPropietario(pheaderData, trabajo->name);
+    chmod(trabajo->name, permisos);
+    return (ret != 0) ? ERROR_OPEN_TAR_FILE : 0;
+}
 
-    printf("OK: Generado el EndTarBlocks del archivo tar %ld bytes \n", NumWriteBytes); // Tr
-    return offset;
+void *TrabajadorExtraccion(void *arg)
+{
+    struct extraccion_tar *ext = arg;
+    struct trabajo_extraccion *trabajo;
+    char *buff;
+    unsigned long i;
+    int r, fase;
+
+    if (posix_memalign((void **)&buff, BUFFER_ALIGNMENT, FactorBloqueo * DATAFILE_BLOCK_SIZE) != 0)
+        buff = NULL;
+    pthread_mutex_lock(&ext->mutex);
+    while (1)
+    {
+        while (!ext->fin && ext->siguiente >= ext->num)
+            pthread_cond_wait(&ext->cond, &ext->mutex);
+        if (ext->siguiente >= ext->num)
+            break;
+        i = ext->siguiente++;
+        trabajo = &ext->cola[i % COLA_EXTRACCION];
+        pthread_mutex_unlock(&ext->mutex);
+
+        fase = EntraFase(FASE_EXTRACCION);
+        r = (buff != NULL) ? ExtraeTrabajo(ext, trabajo, buff) : ERROR_OPEN_TAR_FILE;
+        SaleFase(fase, DecodificaNumero(trabajo->cabecera.size, sizeof(trabajo->cabecera.size)), r == 0);
+        LiberaMapaDisperso(&trabajo->disperso);
+
+        pthread_mutex_lock(&ext->mutex);
+        if (r != 0 && ext->ret == 0)
+            ext->ret = r;
+        trabajo->estado = TRABAJO_LIBRE;
+        ext->hechos++;
+        pthread_cond_broadcast(&ext->cond);
+    }
+    pthread_mutex_unlock(&ext->mutex);
+    free(buff);
+    return NULL;
 }
 
-// Verify Tar file zize to  multiple of 10KB size blocks
-int VerifyCompleteTarSize(unsigned long TarActualSize)
+// Wait until the workers have finished all the jobs
+void EsperaExtraccion(struct extraccion_tar *ext)
 {
+    pthread_mutex_lock(&ext->mutex);
+    while (ext->hechos < ext->num)
+        pthread_cond_wait(&ext->cond, &ext->mutex);
+    pthread_mutex_unlock(&ext->mutex);
+}
 
-    // Verify
-    if ((TarActualSize % TAR_FILE_BLOCK_SIZE) != 0)
+// Directory created by extrae_todo (its mode is set at the end) or hard
+// link (made at the end)
+struct pendiente_extraccion
+{
+    struct c_header_gnu_tar cabecera;
+    char name[sizeof(((struct c_header_gnu_tar *)0)->name) + 1];
+};
+
+int AniadePendiente(struct pendiente_extraccion **lista, unsigned long *num, unsigned long *cap,
+                    const struct c_header_gnu_tar *pheaderData, const char *name)
+{
+    struct pendiente_extraccion *nueva;
+
+    if (*num == *cap)
     {
-        fprintf(stderr, "Error al generar el fichero tar. Tamanio erroneo %ld\n", TarActualSize);
-        return ERROR_GENERATE_TAR_FILE2;
+        *cap = (*cap == 0) ? 64 : 2 * *cap;
+        if ((nueva = realloc(*lista, *cap * sizeof(struct pendiente_extraccion))) == NULL)
+            return -1;
+        *lista = nueva;
     }
+    (*lista)[*num].cabecera = *pheaderData;
+    strcpy((*lista)[*num].name, name);
+    (*num)++;
     return 0;
 }
 
-int extrae_fichero(char *f_mytar, char *f_dat)
+int extrae_todo(char *f_mytar)
 {
-    struct c_header_gnu_tar pheaderData;
-    int fd_DatFile, fd_TarFile, fileSize, permisos;
-    long tamanio, tam;
-    unsigned long n;
-    char buff[512];
-    int type;
-    char *nombre = malloc(100);
-    char *buffer = malloc(100);
-    char *buffer2 = malloc(100);
-    char name[100];
-    int ruta = 1;
-    tamanio = 0;
-    printf("EXTRAER \n");
-
-    if ((fd_TarFile = open(f_mytar, O_RDONLY)) == -1)
-    {
-        fprintf(stderr, "No se puede abrir el fichero tar %s\n", f_dat);
+    const struct c_header_gnu_tar *pheaderData;
+    struct extraccion_tar ext;
+    struct lector_tar lector;
+    struct trabajo_extraccion *trabajo;
+    struct conjunto_nombres dirs, ficheros;
+    struct pendiente_extraccion *directorios = NULL, *enlaces = NULL;
+    unsigned long numDirs = 0, capDirs = 0, numEnlaces = 0, capEnlaces = 0, i;
+    unsigned long long datos, tamDatos;
+    char name[sizeof(pheaderData->name) + 1];
+    pthread_t *hilos;
+    unsigned int h, creados = 0;
+    int fd_TarFile, ret = 0, r, fase;
+
+    if ((fd_TarFile = AbreTarLectura(f_mytar)) == -1)
+    {
+        fprintf(stderr, "No se puede abrir el fichero tar %s\n", f_mytar);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    if (AbreLectorTar(&lector, fd_TarFile, ModoLector) != 0)
+    {
+        close(fd_TarFile);
         return ERROR_OPEN_TAR_FILE;
     }
+    bzero(&ext, sizeof(ext));
+    bzero(&dirs, sizeof(dirs));
+    bzero(&ficheros, sizeof(ficheros));
+    ext.fd = fd_TarFile;
+    if (lector.modo == LECTOR_MMAP)
+    {
+        ext.mapa = lector.mapa;
+        ext.tam = lector.tam;
+    }
+    pthread_mutex_init(&ext.mutex, NULL);
+    pthread_cond_init(&ext.cond, NULL);
+    ext.cola = calloc(COLA_EXTRACCION, sizeof(struct trabajo_extraccion));
+    hilos = calloc(Hilos, sizeof(pthread_t));
+    // a compressed tar file or a stream is extracted by the reader (the
+    // data is in its frames or in the pipe, not at an offset of the file)
+    for (h = 0; ext.cola != NULL && hilos != NULL && lector.modo != LECTOR_GZIP && lector.modo != LECTOR_FLUJO && h < Hilos; h++)
+    {
+        if (pthread_create(&hilos[h], NULL, TrabajadorExtraccion, &ext) != 0)
+            break;
+        creados++;
+    }
 
-    while ((n = read(fd_TarFile, &pheaderData, sizeof(struct c_header_gnu_tar))) > 0)
+    while (ret == 0 && (pheaderData = SiguienteCabeceraTar(&lector)) != NULL)
     {
-        if (strcmp(pheaderData.magic, "ustar  ") == 0)
+        if (strcmp(pheaderData->magic, "ustar  ") != 0)
+            continue;
+        snprintf(name, sizeof(name), "%.*s", (int)sizeof(pheaderData->name), pheaderData->name);
+        TRAZA(1, "extrae=%s\n", name);
+        tamDatos = TamanioDatosTar(pheaderData);
+        datos = lector.pos;
+        if (pheaderData->typeflag[0] == '5') // directory: created by the reader
         {
-            // bytesJump = ((atoi(pheaderData.size) / 512) + 1) * 512;
-            // printf("%s --> %i Bytes [ Datos de %i Bytes ] (%i) \n", pheaderData.name, atoi(pheaderData.size), bytesJump, atoi(pheaderData.mode));
-            printf("salto=%lo\n", tamanio);
-            sscanf(pheaderData.size, "%011lo", &tamanio);
-            printf("salto=%lo\n", tamanio);
-            // lseek(fd_TarFile, bytesJump, 1);
-            printf("buscado=%s\n", f_dat);
-            printf("esta=%s\n", pheaderData.name);
-            printf("es igual=%i\n", strcmp(pheaderData.name, f_dat));
-            // if the selected file name is equal to the argument file name, extract file
-            if (strcmp(pheaderData.name, f_dat) == 0)
-            {
-                printf("%s\n", name);
-                strcpy(name, pheaderData.name);
-                printf("%s\n", name);
-                nombre = pheaderData.name;
-                permisos = strtol(pheaderData.mode, NULL, 8);
-                printf("permisos=%d\n", permisos);
-                printf("detectada ruta=%s\n", name);
-                buffer2 = name;
-                while (ruta)
-                {
-                    buffer = strtok(nombre, "/");
-                    if (strcmp(buffer, buffer2) != 0)
-                    {
-                        printf("ruta a aniadir=%s\n", buffer);
-                        printf("ruta a comparar=%s\n", buffer2);
-                        if (opendir(buffer) == NULL)
-                        {
-                            if (mkdir(buffer, permisos) == -1)
-                            {
-                                fprintf(stderr, "No se puede crear el Directorio al extraer %s\n", f_dat);
-                                return ERROR_OPEN_DAT_FILE;
-                            }
-                            printf("directorio %s creado\n", buffer);
-                            chmod(buffer, 00755);
-                            buffer2 = buffer;
-                        }
-                        printf("directorio %s creado\n", buffer);
-                        buffer2 = buffer;
-                        printf("ruta a comparar=%s\n", buffer2);
-                    }
-                    else
-                    {
-                        printf("finalizada creación de ruta\n");
-                        ruta = 0;
-                    }
-                }
-                printf("typeflag=%s\n", pheaderData.typeflag);
-                bzero(buff, sizeof(buff));
-                if (strcmp(pheaderData.typeflag, "0") == 0) // IS NORMAL FILE
-                {
-                    printf("en generar fichero\n");
-                    sscanf(pheaderData.size, "%011lo", &tam);
-                    printf("[[[[ FILE ]]]]\n");
-                    printf("fichero=%s\n", f_dat);
-                    // create file to extract
-                    if ((fd_DatFile = open(f_dat, O_CREAT | O_RDWR | O_TRUNC)) == -1)
-                    {
-                        fprintf(stderr, "No se puede crear el fichero al extraer %s\n", f_dat);
-                        return ERROR_OPEN_TAR_FILE;
-                    }
-                    while (tam > 0)
-                    {
-                        n = read(fd_TarFile, buff, sizeof(buff));
-                        tam = tam - sizeof(buff);
-                        n = write(fd_DatFile, buff, sizeof(buff));
-                    }
-
-                    // n = read(fd_TarFile, , atoi(pheaderData.size)); // read data to insert in the new file
-                    // n = write(fd_DatFile, &buff, sizeof(buff));          // write data in the new file
-                    close(fd_DatFile);
-                    chmod(f_dat, permisos);
-                }
-                else if (strcmp(pheaderData.typeflag, "5") == 0) // IS DIRECTORY
-                {
-                    printf("[[[[ DIRECTORY ]]]]\n");
-
-                    if (opendir(f_dat) == NULL)
-                    {
-                        printf("NO EXISTE EL DIRECTORIO, SE GENERA \n");
-                        if (fd_DatFile = mkdir(f_dat, 0644) == -1)
-                        {
-                            fprintf(stderr, "No se puede crear el Directorio al extraer %s\n", f_dat);
-                            return ERROR_OPEN_DAT_FILE;
-                        }
-                        chmod(f_dat, permisos);
-                    }
-                    else
-                    {
-                        printf("YA EXISTE EL DIRECTORIO \n");
-                    }
-                }
-                else
-                {
-                    if (strstr(pheaderData.typeflag, "2") != NULL)
-                    {
-                        printf("[[[[ SYM LINK ]]]]\n");
-                        printf("linkname=%s\n", pheaderData.linkname);
-                        if (symlink(pheaderData.linkname, f_dat) == -1)
-                        {
-                            fprintf(stderr, "No se puede crear el enlace simbolico al extraer %s\n", f_dat);
-                            return ERROR_OPEN_DAT_FILE;
-                        }
-                        chmod(f_dat, permisos);
-                    }
-                }
-
-                // lseek(fd_TarFile, bytesJump - atoi(pheaderData.size), 1); // jump block
-                close(fd_TarFile);
-                return 0;
-            }
+            if ((r = CreaDirectoriosExtraccion(&dirs, name, 1)) == -1)
+                ret = ERROR_OPEN_DAT_FILE;
+            else if (r == 1 && AniadePendiente(&directorios, &numDirs, &capDirs, pheaderData, name) != 0)
+                ret = ERROR_OPEN_DAT_FILE;
+        }
+        else if (pheaderData->typeflag[0] == '1') // hard link: at the end
+        {
+            if (CreaDirectoriosExtraccion(&dirs, name, 0) == -1 ||
+                AniadePendiente(&enlaces, &numEnlaces, &capEnlaces, pheaderData, name) != 0)
+                ret = ERROR_OPEN_DAT_FILE;
+        }
+        else if (pheaderData->typeflag[0] == '0' || pheaderData->typeflag[0] == 'S' || pheaderData->typeflag[0] == '2')
+        {
+            if (CreaDirectoriosExtraccion(&dirs, name, 0) == -1)
+                ret = ERROR_OPEN_DAT_FILE;
+            else if (creados == 0)
+                ret = extrae_miembro(&lector, pheaderData, name);
             else
             {
-                printf("es dir=%i\n", (strcmp(pheaderData.typeflag, "5")));
-                printf("es sim link=%i\n", (strcmp(pheaderData.typeflag, "2")));
-                if ((strcmp(pheaderData.typeflag, "5") != 0) && (strcmp(pheaderData.typeflag, "2") != 0))
-                {
-                    if (tamanio % 512 != 0)
-                    {
-                        tamanio += (512 - (tamanio % 512));
-                    }
-                    printf("salta\n");
-                    lseek(fd_TarFile, tamanio, 1);
-                }
+                // the same name twice: after the first one
+                if (ConjuntoAniade(&ficheros, name) != 0)
+                    EsperaExtraccion(&ext);
+                trabajo = &ext.cola[ext.num % COLA_EXTRACCION];
+                pthread_mutex_lock(&ext.mutex);
+                while (trabajo->estado != TRABAJO_LIBRE)
+                    pthread_cond_wait(&ext.cond, &ext.mutex);
+                pthread_mutex_unlock(&ext.mutex);
+                trabajo->cabecera = *pheaderData;
+                strcpy(trabajo->name, name);
+                trabajo->datos = datos;
+                bzero(&trabajo->disperso, sizeof(trabajo->disperso));
+                for (i = 0; pheaderData->typeflag[0] == 'S' && i < lector.disperso.num; i++)
+                    AniadeEntradaDispersa(&trabajo->disperso, lector.disperso.entradas[i].offset, lector.disperso.entradas[i].tam);
+                trabajo->disperso.real = lector.disperso.real;
+                trabajo->estado = TRABAJO_PENDIENTE;
+                pthread_mutex_lock(&ext.mutex);
+                ext.num++;
+                pthread_cond_broadcast(&ext.cond);
+                pthread_mutex_unlock(&ext.mutex);
             }
         }
+        SituaLectorTar(&lector, datos + tamDatos);
+    }
+
+    pthread_mutex_lock(&ext.mutex);
+    ext.fin = 1;
+    pthread_cond_broadcast(&ext.cond);
+    pthread_mutex_unlock(&ext.mutex);
+    for (h = 0; h < creados; h++)
+        pthread_join(hilos[h], NULL);
+    if (ret == 0)
+        ret = ext.ret;
+
+    // hard links (their targets exist now) and modes of the directories,
+    // the children before the parents
+    fase = EntraFase(FASE_EXTRACCION);
+    CuentaLlamadas(2 * numEnlaces + numDirs);
+    for (i = 0; i < numEnlaces; i++)
+    {
+        snprintf(name, sizeof(name), "%.*s", (int)sizeof(enlaces[i].cabecera.linkname), enlaces[i].cabecera.linkname);
+        unlink(enlaces[i].name);
+        if (link(name, enlaces[i].name) == -1)
+        {
+            fprintf(stderr, "No se puede crear el enlace al extraer %s (%s)\n", enlaces[i].name, name);
+            ret = ERROR_OPEN_DAT_FILE;
+        }
+    }
+    for (i = numDirs; i > 0; i--)
+    {
+        RestauraPropietario(&directorios[i - 1].cabecera, directorios[i - 1].name);
+        chmod(directorios[i - 1].name, DecodificaNumero(directorios[i - 1].cabecera.mode, sizeof(directorios[i - 1].cabecera.mode)));
+    }
+    SaleFase(fase, 0, numEnlaces);
+
+    free(directorios);
+    free(enlaces);
+    LiberaConjunto(&dirs);
+    LiberaConjunto(&ficheros);
+    free(ext.cola);
+    free(hilos);
+    pthread_mutex_destroy(&ext.mutex);
+    pthread_cond_destroy(&ext.cond);
+    CierraLectorTar(&lector);
+    close(fd_TarFile);
+    return ret;
+}
+
+// ----------------------------------------------------------------
+// Print a header as tar -tv: type and permissions, owner, size, mtime, name
+void ImprimeCabecera(const struct c_header_gnu_tar *pheaderData, FILE *salida)
+{
+    static const char tipos[] = "-hlcbdp-";
+    char permisos[11], fecha[32];
+    unsigned long modo, tam = 0;
+    time_t mtime;
+    struct tm tm;
+    int i;
+
+    modo = DecodificaNumero(pheaderData->mode, sizeof(pheaderData->mode));
+    permisos[0] = (pheaderData->typeflag[0] >= '0' && pheaderData->typeflag[0] <= '7') ? tipos[pheaderData->typeflag[0] - '0'] : '?';
+    if (pheaderData->typeflag[0] == 'S') // sparse file
+        permisos[0] = '-';
+    for (i = 0; i < 9; i++)
+        permisos[1 + i] = (modo & (0400 >> i)) ? "rwxrwxrwx"[i] : '-';
+    // setuid, setgid and sticky bits in place of x
+    if (modo & 04000)
+        permisos[3] = (modo & 0100) ? 's' : 'S';
+    if (modo & 02000)
+        permisos[6] = (modo & 010) ? 's' : 'S';
+    if (modo & 01000)
+        permisos[9] = (modo & 01) ? 't' : 'T';
+    permisos[10] = '\0';
+    if (pheaderData->typeflag[0] == 'S')
+        tam = DecodificaNumero(pheaderData->realsize, sizeof(pheaderData->realsize));
+    else if (pheaderData->typeflag[0] != '5' && pheaderData->typeflag[0] != '2')
+        tam = DecodificaNumero(pheaderData->size, sizeof(pheaderData->size));
+    mtime = DecodificaNumero(pheaderData->mtime, sizeof(pheaderData->mtime));
+    strftime(fecha, sizeof(fecha), "%Y-%m-%d %H:%M", localtime_r(&mtime, &tm));
+    fprintf(salida, "%s %.32s/%.32s %9lu %s %.100s", permisos, pheaderData->uname, pheaderData->gname, tam, fecha, pheaderData->name);
+    if (pheaderData->typeflag[0] == '2')
+        fprintf(salida, " -> %.100s", pheaderData->linkname);
+    else if (pheaderData->typeflag[0] == '1')
+        fprintf(salida, " link to %.100s", pheaderData->linkname);
+    fputc('\n', salida);
+}
+
+// ----------------------------------------------------------------
+// List the members of a compressed tar file (-z), read by frames
+int ListaTarComprimido(int fd_TarFile, char *f_mytar)
+{
+    const struct c_header_gnu_tar *pheaderData;
+    struct lector_tar lector;
+    unsigned long long inicio;
+    int ret = 0;
+
+    if (AbreLectorTar(&lector, fd_TarFile, LECTOR_READ) != 0)
+        return ERROR_OPEN_TAR_FILE;
+    while ((inicio = lector.pos, pheaderData = SiguienteCabeceraTar(&lector)) != NULL)
+    {
+        if (CabeceraCeros(pheaderData))
+            break; // end of archive blocks
+        if (!CabeceraValida(pheaderData))
+        {
+            fprintf(stderr, "Cabecera erronea en el offset %llu de %s\n", inicio, f_mytar);
+            ret = ERROR_BAD_HEADER;
+            break;
+        }
+        ImprimeCabecera(pheaderData, stdout);
+        SaltaDatosTar(&lector, TamanioDatosTar(pheaderData));
+    }
+    CierraLectorTar(&lector);
+    return ret;
+}
+
+// ----------------------------------------------------------------
+// List the members of f_mytar reading only the headers (the data is
+// skipped), with the reader of mytarlib.c: every header is validated
+// (magic and checksum) before its size is used.
+int lista_tar(char *f_mytar)
+{
+    const struct c_header_gnu_tar *pheaderData;
+    struct lector_mytar lector;
+    int fd_TarFile, ret;
+
+    if ((fd_TarFile = AbreTarLectura(f_mytar)) == -1)
+    {
+        fprintf(stderr, "No se puede abrir el fichero tar %s\n", f_mytar);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    if (EsTarComprimido(fd_TarFile))
+    {
+        ret = ListaTarComprimido(fd_TarFile, f_mytar);
+        close(fd_TarFile);
+        return ret;
+    }
+    // a file is mapped: the headers are read in place, without a syscall
+    // per member
+    if (AbreLectorMytar(&lector, fd_TarFile, FactorBloqueo) != 0)
+    {
+        close(fd_TarFile);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    while ((pheaderData = SiguienteCabeceraMytar(&lector)) != NULL)
+        ImprimeCabecera(pheaderData, stdout);
+    if ((ret = lector.error) == ERROR_BAD_HEADER)
+        fprintf(stderr, "Cabecera erronea en el offset %llu de %s\n", lector.pos - DATAFILE_BLOCK_SIZE, f_mytar);
+    else if (ret != 0)
+        fprintf(stderr, "Error al leer el fichero tar %s\n", f_mytar);
+    CierraLectorMytar(&lector);
+    close(fd_TarFile);
+    return ret;
+}
+
+// ----------------------------------------------------------------
+// Batch mode (--batch): the orders of f_ordenes ("-": the standard
+// input), one per line, run on the same tar file:
+//     add fichero       as targ10 fichero archivo.tar
+//     extract nombre    as targ10 -e nombre archivo.tar
+//     list              as targ10 -t archivo.tar
+// Empty lines and lines starting with # are skipped. The tar file is
+// opened and its end found once, the member table (IndiceTar) is kept in
+// memory, and the end of archive blocks and the padding to 10KB are
+// written once, after the last order.
+
+// Extract name, found in the member table. It is read with a second fd
+// (the offset of the writer is not moved), opened by the first extract,
+// after the members added so far are written.
+int ExtraeMiembroLote(struct lector_tar *lector, int *fd_Lectura, char *f_mytar, char *name)
+{
+    const struct c_header_gnu_tar *pheaderData;
+    struct c_index_tar_entry *entrada;
+
+    if (VaciaEscritorTar(&EscritorTar) != 0)
+        return ERROR_GENERATE_TAR_FILE;
+    if ((entrada = IndiceBusca(&IndiceTar, name)) == NULL)
+    {
+        fprintf(stderr, "No se encuentra en el tar: %s\n", name);
+        return ERROR_MEMBER_NOT_FOUND;
+    }
+    // read(), not mmap: the tar file grows with the next orders
+    if (*fd_Lectura == -1)
+    {
+        if ((*fd_Lectura = open(f_mytar, O_RDONLY)) == -1 || AbreLectorTar(lector, *fd_Lectura, LECTOR_READ) != 0)
+        {
+            fprintf(stderr, "No se puede abrir el fichero tar %s\n", f_mytar);
+            if (*fd_Lectura != -1)
+                close(*fd_Lectura);
+            *fd_Lectura = -1;
+            return ERROR_OPEN_TAR_FILE;
+        }
+    }
+    SituaLectorTar(lector, entrada->offset);
+    if ((pheaderData = SiguienteCabeceraTar(lector)) == NULL || !CabeceraValida(pheaderData))
+    {
+        fprintf(stderr, "Cabecera erronea en el offset %llu de %s\n", entrada->offset, f_mytar);
+        return ERROR_BAD_HEADER;
+    }
+    return extrae_miembro(lector, pheaderData, name);
+}
+
+// List the members of the member table (their headers are read again,
+// after the members added so far are written)
+int ListaMiembrosLote(int f_mytar, char *TarFileName)
+{
+    struct c_header_gnu_tar cabecera;
+    unsigned long i;
+
+    if (VaciaEscritorTar(&EscritorTar) != 0)
+        return ERROR_GENERATE_TAR_FILE;
+    for (i = 0; i < IndiceTar.num; i++)
+    {
+        if (pread(f_mytar, &cabecera, sizeof(cabecera), IndiceTar.entradas[i].offset) != sizeof(cabecera) ||
+            !CabeceraValida(&cabecera))
+        {
+            fprintf(stderr, "Cabecera erronea en el offset %llu de %s\n", IndiceTar.entradas[i].offset, TarFileName);
+            return ERROR_BAD_HEADER;
+        }
+        ImprimeCabecera(&cabecera, stdout);
     }
-    free(nombre);
-    free(buffer);
-    free(buffer2);
     return 0;
 }
 
-int main(int argc, char *argv[])
+int procesa_lote(char *f_mytar, char *f_ordenes)
 {
-    char FileName[256];
-    char TarFileName[256];
-    unsigned long TarFileSize, n, offset;
-    ssize_t Symlink_Size;
+    char linea[PATH_MAX + 16];
+    char *orden, *arg;
+    struct lector_tar lector;
+    struct stat sb;
+    unsigned long long tamanoEscrito;
+    unsigned long numLinea = 0, ordenes = 0;
+    int fd_TarFile, fd_Lectura = -1, ret = 0, r;
+    size_t len;
+    FILE *f;
 
-    struct c_header_gnu_tar my_tardat;
-    char FileDataBlock[DATAFILE_BLOCK_SIZE];
+    f = (strcmp(f_ordenes, "-") == 0) ? stdin : fopen(f_ordenes, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "No se pueden leer las ordenes %s\n", f_ordenes);
+        return ERROR_OPEN_DAT_FILE;
+    }
+    if ((fd_TarFile = open(f_mytar, O_RDWR | O_CREAT, 0600)) == -1 || fstat(fd_TarFile, &sb) == -1)
+    {
+        fprintf(stderr, "No se puede abrir el fichero tar %s\n", f_mytar);
+        if (f != stdin)
+            fclose(f);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    // the member table: from the index, or built while the end is found
+    IndiceTar.activo = 1;
+    if ((ret = AbreFinTar(fd_TarFile, sb.st_size)) != 0)
+    {
+        close(fd_TarFile);
+        if (f != stdin)
+            fclose(f);
+        return ret;
+    }
 
-    int i, ret, Tam, tamano_cuerpo, leidos;
+    while (fgets(linea, sizeof(linea), f) != NULL)
+    {
+        numLinea++;
+        len = strlen(linea);
+        while (len > 0 && (linea[len - 1] == '\n' || linea[len - 1] == '\r'))
+            linea[--len] = '\0';
+        orden = linea + strspn(linea, " \t");
+        if (*orden == '\0' || *orden == '#')
+            continue;
+        // the argument is the rest of the line (a name may have spaces)
+        arg = orden + strcspn(orden, " \t");
+        if (*arg != '\0')
+        {
+            *arg++ = '\0';
+            arg += strspn(arg, " \t");
+        }
+        TRAZA(1, "orden %lu: %s %s\n", numLinea, orden, arg);
+        if (strcmp(orden, "add") == 0 && *arg != '\0')
+            r = AniadeRutaTar(fd_TarFile, arg);
+        else if (strcmp(orden, "extract") == 0 && *arg != '\0')
+            r = ExtraeMiembroLote(&lector, &fd_Lectura, f_mytar, arg);
+        else if (strcmp(orden, "list") == 0 && *arg == '\0')
+            r = ListaMiembrosLote(fd_TarFile, f_mytar);
+        else
+        {
+            fprintf(stderr, "Orden erronea en la linea %lu de %s: %s\n", numLinea, f_ordenes, orden);
+            r = 1;
+        }
+        ordenes++;
+        // the first error is returned, the next orders are run anyway
+        // unless the tar file can not be written
+        if (r != 0 && ret == 0)
+            ret = r;
+        if (r == ERROR_GENERATE_TAR_FILE)
+            break;
+    }
+    if (f != stdin)
+        fclose(f);
+    if (fd_Lectura != -1)
+    {
+        CierraLectorTar(&lector);
+        close(fd_Lectura);
+    }
 
-    int fd_DatFile, fd_TarFile;
-    char *buffer;
+    if ((r = CierraFinTar(fd_TarFile, &tamanoEscrito)) != 0)
+    {
+        // (a write error is already reported)
+        if (r != ERROR_GENERATE_TAR_FILE)
+            fprintf(stderr, "Error al generar el fichero tar %s. Tamanio erroneo %llu\n", f_mytar, tamanoEscrito);
+        close(fd_TarFile);
+        return (ret != 0) ? ret : r;
+    }
+    printf("OK: %lu ordenes en el fichero tar %s (size=%llu, %lu elementos)\n", ordenes, f_mytar, tamanoEscrito, IndiceTar.num);
+    ImprimeResumenInsercion();
+    close(fd_TarFile);
+    return ret;
+}
+
+// ----------------------------------------------------------------
+// Print the counters of --stats (text or JSON) in salida
+void ImprimeEstadisticas(FILE *salida)
+{
+    const struct contador_fase *contador;
+    double total, segundos, porSegundo, mbPorSegundo;
+    int i;
+
+    if (!Estadisticas.activo)
+        return;
+    total = (RelojNs() - Estadisticas.inicio) / 1e9;
+    if (Estadisticas.json)
+        fprintf(salida, "{\"segundos\": %.6f, \"fases\": {", total);
+    else
+        fprintf(salida, "Estadisticas (%.6f s)\n%-10s %10s %14s %10s %10s %12s %10s\n", total,
+                "fase", "segundos", "bytes", "llamadas", "ficheros", "ficheros/s", "MB/s");
+    for (i = 0; i < NUM_FASES; i++)
+    {
+        contador = &Estadisticas.fases[i];
+        segundos = contador->ns / 1e9;
+        porSegundo = (segundos > 0) ? contador->ficheros / segundos : 0;
+        mbPorSegundo = (segundos > 0) ? contador->bytes / segundos / 1e6 : 0;
+        if (Estadisticas.json)
+            fprintf(salida, "%s\"%s\": {\"segundos\": %.6f, \"bytes\": %llu, \"llamadas\": %llu, \"ficheros\": %llu, "
+                            "\"ficheros_por_segundo\": %.1f, \"mb_por_segundo\": %.1f}",
+                    (i > 0) ? ", " : "", NombreFase[i], segundos, contador->bytes, contador->llamadas, contador->ficheros,
+                    porSegundo, mbPorSegundo);
+        else
+            fprintf(salida, "%-10s %10.6f %14llu %10llu %10llu %12.1f %10.1f\n", NombreFase[i], segundos,
+                    contador->bytes, contador->llamadas, contador->ficheros, porSegundo, mbPorSegundo);
+    }
+    if (Estadisticas.json)
+        fprintf(salida, "}}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int fd_TarFile, ret, flujo;
+    int arg = 1;
+    char *FicheroSnapshot = NULL;
+
+    // options
+    while (arg < argc)
+    {
+        if (strcmp(argv[arg], "-i") == 0)
+        {
+            IndiceTar.activo = 1; // build (or update) the member index
+        }
+        else if (strcmp(argv[arg], "-z") == 0)
+        {
+            Comprimir = 1;   // gzip frames compressed in parallel
+            CopiaDirecta = 0; // all the data goes through the compressor
+        }
+        else if (strcmp(argv[arg], "-m") == 0)
+        {
+            ModoLector = LECTOR_MMAP; // read the tar file with mmap
+        }
+        else if (strcmp(argv[arg], "-d") == 0)
+        {
+            Deduplicar = 1; // identical files as hard links
+        }
+        else if (strcmp(argv[arg], "-u") == 0)
+        {
+            UsarUring = 1; // small files in batches with io_uring
+        }
+        else if (argv[arg][0] == '-' && argv[arg][1] == 'v' && strspn(argv[arg] + 1, "v") == strlen(argv[arg] + 1))
+        {
+#ifdef TRAZAS
+            NivelTraza += strlen(argv[arg]) - 1; // -v, -vv, -vvv
+#endif
+        }
+        else if (strcmp(argv[arg], "--stats") == 0 || strcmp(argv[arg], "--stats=texto") == 0 ||
+                 strcmp(argv[arg], "--stats=json") == 0)
+        {
+            Estadisticas.activo = 1; // counters of each phase
+            Estadisticas.json = (strcmp(argv[arg], "--stats=json") == 0);
+        }
+        else if (strncmp(argv[arg], "--io=", 5) == 0)
+        {
+            // I/O policy of the tar file and of the files added
+            if (strcmp(argv[arg] + 5, "normal") == 0)
+                PoliticaIO = IO_NORMAL;
+            else if (strcmp(argv[arg] + 5, "nocache") == 0 || strcmp(argv[arg] + 5, "directo") == 0)
+            {
+                PoliticaIO = (argv[arg][5] == 'n') ? IO_NOCACHE : IO_DIRECTO;
+                // all the data through the buffer: the pages of the sources
+                // are dropped every buffer (see EscribeDatosFichero)
+                CopiaDirecta = 0;
+            }
+            else
+            {
+                fprintf(stderr, "Politica de E/S erronea %s (normal, nocache o directo)\n", argv[arg] + 5);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "-g") == 0 && arg + 1 < argc)
+        {
+            FicheroSnapshot = argv[++arg]; // incremental archive
+        }
+        else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc)
+        {
+            // worker threads to read the files of a directory
+            Hilos = strtoul(argv[++arg], NULL, 10);
+            if (Hilos == 0)
+            {
+                fprintf(stderr, "Numero de hilos erroneo %s\n", argv[arg]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc)
+        {
+            // blocking factor: blocks of 512 bytes per write, multiple of
+            // the 10KB tar record
+            FactorBloqueo = strtoul(argv[++arg], NULL, 10);
+            if (FactorBloqueo == 0 || (FactorBloqueo * DATAFILE_BLOCK_SIZE) % TAR_FILE_BLOCK_SIZE != 0)
+            {
+                fprintf(stderr, "Factor de bloqueo erroneo %s (multiplo de %lu)\n", argv[arg], TAR_FILE_BLOCK_SIZE / DATAFILE_BLOCK_SIZE);
+                return 1;
+            }
+        }
+        else
+            break;
+        arg++;
+    }
+    argc -= arg - 1;
+    argv += arg - 1;
+    Estadisticas.inicio = RelojNs();
+    if (UsarUring)
+        AbreLoteUring(&LoteUring);
 
-    int numHeaders = 0;
-    int puntero = 0;
+    if (argc == 3 && strcmp(argv[1], "-t") == 0)
+    {
+        ret = lista_tar(argv[2]);
+        ImprimeEstadisticas(stderr);
+        return ret;
+    }
+    if (argc == 3 && strcmp(argv[1], "-x") == 0)
+    {
+        ret = extrae_todo(argv[2]);
+        ImprimeEstadisticas(stderr);
+        return ret;
+    }
+    if (argc >= 4 && strcmp(argv[1], "-e") == 0)
+    {
+        // -e [-T lista] fichero... Tarfile.tar: names, patterns and lists
+        struct seleccion_tar sel;
+
+        bzero(&sel, sizeof(sel));
+        for (arg = 2; arg < argc - 1; arg++)
+        {
+            if (strcmp(argv[arg], "-T") == 0 && arg + 1 < argc - 1)
+                ret = SeleccionLeeLista(&sel, argv[++arg]);
+            else
+                ret = SeleccionAniade(&sel, argv[arg]);
+            if (ret != 0)
+            {
+                LiberaSeleccion(&sel);
+                return ERROR_OPEN_DAT_FILE;
+            }
+        }
+        if (sel.num == 0 || SeleccionConstruye(&sel) != 0)
+        {
+            fprintf(stderr, "No hay ficheros que extraer\n");
+            LiberaSeleccion(&sel);
+            return 1;
+        }
+        ret = extrae_ficheros(argv[argc - 1], &sel);
+        LiberaSeleccion(&sel);
+        CierraLoteUring(&LoteUring);
+        ImprimeEstadisticas(stderr);
+        return ret;
+    }
+    if ((argc == 4 && strcmp(argv[1], "--delete") == 0) || (argc == 5 && strcmp(argv[1], "--replace") == 0))
+    {
+        // --delete nombre Tarfile.tar, --replace nombre fichero Tarfile.tar
+        if (ExisteIndiceTar(argv[argc - 1]))
+        {
+            IndiceTar.activo = 1;
+            if (CargaIndiceTar(argv[argc - 1], &IndiceTar) != 0)
+            {
+                LiberaIndiceTar(&IndiceTar);
+                IndiceTar.activo = 1;
+            }
+        }
+        if (argc == 4)
+            ret = borra_fichero(argv[3], argv[2]);
+        else
+            ret = reemplaza_fichero(argv[4], argv[2], argv[3]);
+        if (ret == 0 && IndiceTar.activo)
+            GuardaIndiceTar(argv[argc - 1], &IndiceTar);
+        LiberaIndiceTar(&IndiceTar);
+        ImprimeEstadisticas(stderr);
+        return ret;
+    }
+    if (argc == 4 && strcmp(argv[1], "--batch") == 0)
+    {
+        // --batch ordenes Tarfile.tar: the index is saved if it exists or
+        // with -i (the member table is in memory anyway)
+        int guardaIndice;
 
-    if (argc != 3 && argc != 4)
+        if (Comprimir || strcmp(argv[3], "-") == 0)
+        {
+            fprintf(stderr, "--batch necesita un fichero tar sin comprimir (ni -z ni -)\n");
+            return 1;
+        }
+        if (ExisteIndiceTar(argv[3]))
+        {
+            IndiceTar.activo = 1;
+            if (CargaIndiceTar(argv[3], &IndiceTar) != 0)
+            {
+                LiberaIndiceTar(&IndiceTar);
+                IndiceTar.activo = 1;
+            }
+        }
+        guardaIndice = IndiceTar.activo;
+        if (FicheroSnapshot != NULL && CargaSnapshot(FicheroSnapshot, &Snapshot) != 0)
+        {
+            fprintf(stderr, "No se puede leer el snapshot %s\n", FicheroSnapshot);
+            LiberaSnapshot(&Snapshot);
+            LiberaIndiceTar(&IndiceTar);
+            return ERROR_OPEN_TAR_FILE;
+        }
+        ret = procesa_lote(argv[3], argv[2]);
+        if (ret != ERROR_GENERATE_TAR_FILE && ret != ERROR_GENERATE_TAR_FILE2)
+        {
+            if (guardaIndice)
+                GuardaIndiceTar(argv[3], &IndiceTar);
+            if (FicheroSnapshot != NULL && GuardaSnapshot(FicheroSnapshot, &Snapshot) != 0 && ret == 0)
+                ret = ERROR_OPEN_TAR_FILE;
+        }
+        LiberaSnapshot(&Snapshot);
+        LiberaIndiceTar(&IndiceTar);
+        CierraLoteUring(&LoteUring);
+        ImprimeEstadisticas(stderr);
+        return ret;
+    }
+    if (argc != 3)
     {
-        fprintf(stderr, "Uso: %s fichero  Tarfile.tar\n", argv[0]);
-        fprintf(stderr, "Uso: %s -e fichero  Tarfile.tar\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-i] [-z] [-d] [-u] [-g snapshot] [-m] [-j hilos] [-b factor] [-v] [--stats[=json]] [--io=politica] fichero  Tarfile.tar|-\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-m] [-u] [-j hilos] [-b factor] [-v] [--stats[=json]] -e [-T lista] fichero... Tarfile.tar|-\n", argv[0]);
+        fprintf(stderr, "Uso: %s [--stats[=json]] -t Tarfile.tar|-\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-i] [-b factor] [-v] [--stats[=json]] --delete nombre Tarfile.tar\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-i] [-b factor] [-v] [--stats[=json]] --replace nombre fichero Tarfile.tar\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-m] [-j hilos] [-b factor] [-v] [--stats[=json]] -x Tarfile.tar|-\n", argv[0]);
+        fprintf(stderr, "Uso: %s [-i] [-d] [-u] [-g snapshot] [-m] [-j hilos] [-b factor] [-v] [--stats[=json]] [--io=politica] --batch ordenes|- Tarfile.tar\n", argv[0]);
         return 1;
     }
-    if (argc == 4 && (strcmp(argv[1], "-e") != 0))
+    flujo = (strcmp(argv[2], "-") == 0);
+    if (flujo && IndiceTar.activo)
     {
-        fprintf(stderr, "Uso: %s -e fichero  Tarfile.tar\n", argv[0]);
+        fprintf(stderr, "El indice (-i) no se puede crear al escribir en la salida estandar\n");
         return 1;
     }
-    if (strcmp(argv[1], "-e") == 0)
+    // an existing index is always kept up to date (and gives the end of
+    // the archive to append)
+    if (!flujo && ExisteIndiceTar(argv[2]))
+    {
+        IndiceTar.activo = 1;
+        if (CargaIndiceTar(argv[2], &IndiceTar) != 0)
+        {
+            LiberaIndiceTar(&IndiceTar);
+            IndiceTar.activo = 1;
+        }
+    }
+    if (FicheroSnapshot != NULL && CargaSnapshot(FicheroSnapshot, &Snapshot) != 0)
+    {
+        fprintf(stderr, "No se puede leer el snapshot %s\n", FicheroSnapshot);
+        LiberaSnapshot(&Snapshot);
+        LiberaIndiceTar(&IndiceTar);
+        return ERROR_OPEN_TAR_FILE;
+    }
+    if (flujo)
     {
-        return extrae_fichero(argv[3], argv[2]);
+        // a new tar file to the standard output (a pipe): it is written
+        // forwards only, and what is printed to stdout goes to stderr
+        fflush(stdout);
+        if ((fd_TarFile = dup(STDOUT_FILENO)) == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+        {
+            fprintf(stderr, "No se puede escribir el tar en la salida estandar\n");
+            return ERROR_OPEN_TAR_FILE;
+        }
+        AgrandaTuberia(fd_TarFile, FactorBloqueo * DATAFILE_BLOCK_SIZE);
+        ret = inserta_fichero(fd_TarFile, 0, argv[1]);
     }
     else if ((fd_TarFile = open(argv[2], O_RDWR, 0600)) == -1) // tar
     {
         if ((fd_TarFile = open(argv[2], O_RDWR | O_CREAT, 0600)) == -1)
         {
             fprintf(stderr, "No se puede abrir el fichero tar %s\n", argv[2]);
-            close(fd_DatFile);
             return ERROR_OPEN_TAR_FILE;
         }
-        inserta_fichero(fd_TarFile, 0, argv[1]);
-        return 0;
+        ret = inserta_fichero(fd_TarFile, 0, argv[1]);
     }
     else
     {
         struct stat sb;
         stat(argv[2], &sb);
-        inserta_fichero(fd_TarFile, sb.st_size, argv[1]);
-        return 0;
+        ret = inserta_fichero(fd_TarFile, sb.st_size, argv[1]);
     }
+    if (ret == 0 && IndiceTar.activo)
+        GuardaIndiceTar(argv[2], &IndiceTar);
+    if (ret == 0 && FicheroSnapshot != NULL)
+        ret = GuardaSnapshot(FicheroSnapshot, &Snapshot);
+    LiberaSnapshot(&Snapshot);
+    LiberaIndiceTar(&IndiceTar);
+    CierraLoteUring(&LoteUring);
+    ImprimeEstadisticas(stderr);
+    return ret;
 }
@@ -0,0 +1,327 @@
+/* *
+ * * @file mytarlib.c
+ * * @author ISO-2-G10
+ * * @date 16/10/2026
+ * * @brief Reentrant reader of gnu tar files
+ * * @details See s_mytarlib.h. All the state of an archive is in its
+ * *          lector_mytar; the only static data is the routine that sums a
+ * *          header, chosen once for the CPU.
+ * *
+ * */
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "s_mytarlib.h"
+#include "s_mytarcodec.h"
+
+// ----------------------------------------------------------------
+// Sum of the 512 bytes of a header (as unsigned chars), for the checksum.
+// SSE2 and AVX2 versions with psadbw (sum of 8 bytes in a 64 bit lane);
+// the version of the CPU is chosen once (pthread_once).
+static unsigned long SumaCabeceraEscalar(const unsigned char *p)
+{
+    unsigned long suma = 0;
+    int i;
+
+    for (i = 0; i < FILE_HEADER_SIZE; i++)
+        suma += p[i];
+    return suma;
+}
+
+#if defined(__x86_64__)
+static unsigned long SumaCabeceraSSE2(const unsigned char *p)
+{
+    __m128i suma = _mm_setzero_si128(), cero = _mm_setzero_si128();
+    int i;
+
+    for (i = 0; i < FILE_HEADER_SIZE; i += 16)
+        suma = _mm_add_epi64(suma, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(p + i)), cero));
+    return _mm_cvtsi128_si64(suma) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(suma, suma));
+}
+
+__attribute__((target("avx2"))) static unsigned long SumaCabeceraAVX2(const unsigned char *p)
+{
+    __m256i suma = _mm256_setzero_si256(), cero = _mm256_setzero_si256();
+    __m128i s;
+    int i;
+
+    for (i = 0; i < FILE_HEADER_SIZE; i += 32)
+        suma = _mm256_add_epi64(suma, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(p + i)), cero));
+    s = _mm_add_epi64(_mm256_castsi256_si128(suma), _mm256_extracti128_si256(suma, 1));
+    return _mm_cvtsi128_si64(s) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(s, s));
+}
+#endif
+
+static unsigned long (*SumaCabeceraCPU)(const unsigned char *p) = SumaCabeceraEscalar;
+static pthread_once_t EleccionSuma = PTHREAD_ONCE_INIT;
+
+static void EligeSumaCabecera(void)
+{
+#if defined(__x86_64__)
+    SumaCabeceraCPU = SumaCabeceraSSE2; // always in x86-64
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        SumaCabeceraCPU = SumaCabeceraAVX2;
+#endif
+}
+
+static unsigned long SumaCabecera(const unsigned char *p)
+{
+    pthread_once(&EleccionSuma, EligeSumaCabecera);
+    return SumaCabeceraCPU(p);
+}
+
+// ----------------------------------------------------------------
+// Check the magic and the checksum of a header (GNU tar accepts the sum
+// of the bytes as unsigned or as signed chars)
+int CabeceraValida(const struct c_header_gnu_tar *pheaderData)
+{
+    const unsigned char *p = (const unsigned char *)pheaderData;
+    const int inicio = offsetof(struct c_header_gnu_tar, checksum), fin = inicio + sizeof(pheaderData->checksum);
+    unsigned long long chksum;
+    unsigned long suma;
+    long sumaConSigno;
+    int i;
+
+    if (strcmp(pheaderData->magic, "ustar  ") != 0)
+        return 0;
+    if (LeeOctal(pheaderData->checksum, sizeof(pheaderData->checksum), &chksum) == 0)
+        return 0;
+    // the checksum field is summed as spaces
+    suma = SumaCabecera(p);
+    for (i = inicio; i < fin; i++)
+        suma += ' ' - p[i];
+    if (chksum == suma)
+        return 1;
+    // (old tars) signed chars: the bytes >= 128 count 256 less
+    sumaConSigno = suma;
+    for (i = 0; i < FILE_HEADER_SIZE; i++)
+        if (p[i] >= 128 && (i < inicio || i >= fin))
+            sumaConSigno -= 256;
+    return (long)chksum == sumaConSigno;
+}
+
+// Return 1 if the header is a block of zeros (end of archive)
+int CabeceraCeros(const struct c_header_gnu_tar *pheaderData)
+{
+    return pheaderData->name[0] == '\0' && SumaCabecera((const unsigned char *)pheaderData) == 0;
+}
+
+// Recompute the checksum of a header changed after it was built
+void ActualizaChecksum(struct c_header_gnu_tar *pTarHeader)
+{
+    memset(pTarHeader->checksum, ' ', sizeof(pTarHeader->checksum));
+    CodificaOctal(pTarHeader->checksum, 6, SumaCabecera((const unsigned char *)pTarHeader));
+    pTarHeader->checksum[7] = ' ';
+}
+
+// ----------------------------------------------------------------
+// Reader
+int AbreLectorMytar(struct lector_mytar *lector, int fd_TarFile, unsigned long factorBloqueo)
+{
+    struct stat sb;
+    void *mapa;
+
+    bzero(lector, sizeof(struct lector_mytar));
+    lector->fd = fd_TarFile;
+    if (fstat(fd_TarFile, &sb) == 0 && S_ISREG(sb.st_mode) && lseek(fd_TarFile, 0, SEEK_CUR) == 0)
+    {
+        if (sb.st_size == 0)
+            return 0; // no members
+        if ((mapa = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd_TarFile, 0)) != MAP_FAILED)
+        {
+            madvise(mapa, sb.st_size, MADV_SEQUENTIAL);
+            lector->mapa = mapa;
+            lector->tamMapa = sb.st_size;
+            return 0;
+        }
+    }
+    // (a pipe, or a file that can not be mapped) read in blocks
+    if (factorBloqueo == 0)
+        factorBloqueo = DEFAULT_BLOCKING_FACTOR;
+    lector->tamBuffer = factorBloqueo * DATAFILE_BLOCK_SIZE;
+    if (posix_memalign((void **)&lector->buffer, BUFFER_ALIGNMENT, lector->tamBuffer) != 0)
+    {
+        lector->buffer = NULL;
+        lector->error = ERROR_OPEN_TAR_FILE;
+        return ERROR_OPEN_TAR_FILE;
+    }
+    return 0;
+}
+
+// Read until there are n bytes in the buffer (or the end of the file).
+// Return the bytes in the buffer.
+static unsigned long LlenaLectorMytar(struct lector_mytar *lector, unsigned long n)
+{
+    ssize_t leidos;
+
+    if (lector->fin - lector->inicio >= n)
+        return lector->fin - lector->inicio;
+    // the pending bytes to the start of the buffer
+    memmove(lector->buffer, lector->buffer + lector->inicio, lector->fin - lector->inicio);
+    lector->fin -= lector->inicio;
+    lector->inicio = 0;
+    while (lector->fin < n)
+    {
+        if ((leidos = read(lector->fd, lector->buffer + lector->fin, lector->tamBuffer - lector->fin)) <= 0)
+        {
+            if (leidos == -1 && errno == EINTR)
+                continue;
+            if (leidos == -1)
+                lector->error = ERROR_OPEN_TAR_FILE;
+            break;
+        }
+        lector->fin += leidos;
+    }
+    return lector->fin;
+}
+
+// Skip n bytes of the tar file. Return -1 (and lector->error) if the file
+// ends before.
+static int SaltaMytar(struct lector_mytar *lector, unsigned long long n)
+{
+    unsigned long tam;
+
+    if (lector->mapa != NULL || lector->buffer == NULL)
+    {
+        lector->pos += n;
+        if (lector->pos <= lector->tamMapa)
+            return 0;
+        lector->error = ERROR_OPEN_TAR_FILE;
+        return -1;
+    }
+    while (n > 0)
+    {
+        if (LlenaLectorMytar(lector, 1) == 0)
+        {
+            lector->error = ERROR_OPEN_TAR_FILE;
+            return -1;
+        }
+        tam = lector->fin - lector->inicio;
+        if (n < tam)
+            tam = n;
+        lector->inicio += tam;
+        lector->pos += tam;
+        n -= tam;
+    }
+    return 0;
+}
+
+// Return the next block of 512 bytes (NULL at the end of the file)
+static const char *BloqueMytar(struct lector_mytar *lector, void *copia)
+{
+    const char *bloque;
+
+    if (lector->mapa != NULL || lector->buffer == NULL)
+    {
+        if (lector->pos + DATAFILE_BLOCK_SIZE > lector->tamMapa)
+            return NULL;
+        bloque = lector->mapa + lector->pos;
+    }
+    else
+    {
+        if (LlenaLectorMytar(lector, DATAFILE_BLOCK_SIZE) < DATAFILE_BLOCK_SIZE)
+            return NULL;
+        memcpy(copia, lector->buffer + lector->inicio, DATAFILE_BLOCK_SIZE);
+        bloque = copia;
+        lector->inicio += DATAFILE_BLOCK_SIZE;
+    }
+    lector->pos += DATAFILE_BLOCK_SIZE;
+    return bloque;
+}
+
+// Return the next header, checked (NULL at the end of the archive, or
+// with lector->error if a header is not valid). The data of the member
+// before it that was not read is skipped.
+const struct c_header_gnu_tar *SiguienteCabeceraMytar(struct lector_mytar *lector)
+{
+    const struct c_header_gnu_tar *pheaderData;
+    struct c_sparse_gnu_tar extension;
+    const struct c_sparse_gnu_tar *pExtension;
+    int extendido;
+
+    if (lector->error != 0 || SaltaMytar(lector, lector->datos + lector->relleno) != 0)
+        return NULL;
+    lector->datos = lector->relleno = 0;
+    if ((pheaderData = (const struct c_header_gnu_tar *)BloqueMytar(lector, &lector->cabecera)) == NULL ||
+        CabeceraCeros(pheaderData))
+        return NULL;
+    if (!CabeceraValida(pheaderData))
+    {
+        lector->error = ERROR_BAD_HEADER;
+        return NULL;
+    }
+    // the extended headers of the map of a sparse member
+    for (extendido = (pheaderData->typeflag[0] == 'S') && pheaderData->isextended[0]; extendido;)
+    {
+        if ((pExtension = (const struct c_sparse_gnu_tar *)BloqueMytar(lector, &extension)) == NULL)
+        {
+            lector->error = ERROR_BAD_HEADER;
+            return NULL;
+        }
+        extendido = pExtension->isextended[0];
+    }
+    if (pheaderData->typeflag[0] != '5' && pheaderData->typeflag[0] != '2')
+        lector->datos = DecodificaNumero(pheaderData->size, sizeof(pheaderData->size));
+    if (lector->datos % DATAFILE_BLOCK_SIZE != 0)
+        lector->relleno = DATAFILE_BLOCK_SIZE - lector->datos % DATAFILE_BLOCK_SIZE;
+    return pheaderData;
+}
+
+// The next piece of the data of the current member, in *trozo (in the
+// mapping or in the buffer, valid until the next call). Return its size,
+// 0 at the end of the data, -1 if the file ends before.
+long DatosMytar(struct lector_mytar *lector, const char **trozo)
+{
+    unsigned long long tam = lector->datos;
+
+    if (tam == 0)
+        return 0;
+    if (tam > 0x40000000ULL)
+        tam = 0x40000000ULL;
+    if (lector->mapa != NULL || lector->buffer == NULL)
+    {
+        if (lector->pos + tam > lector->tamMapa)
+        {
+            lector->error = ERROR_BAD_HEADER;
+            return -1;
+        }
+        *trozo = lector->mapa + lector->pos;
+    }
+    else
+    {
+        if (LlenaLectorMytar(lector, 1) == 0)
+        {
+            lector->error = ERROR_BAD_HEADER;
+            return -1;
+        }
+        if (tam > lector->fin - lector->inicio)
+            tam = lector->fin - lector->inicio;
+        *trozo = lector->buffer + lector->inicio;
+        lector->inicio += tam;
+    }
+    lector->pos += tam;
+    lector->datos -= tam;
+    return (long)tam;
+}
+
+void CierraLectorMytar(struct lector_mytar *lector)
+{
+    if (lector->mapa != NULL)
+        munmap((void *)lector->mapa, lector->tamMapa);
+    lector->mapa = NULL;
+    free(lector->buffer);
+    lector->buffer = NULL;
+}
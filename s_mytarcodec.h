@@ -0,0 +1,156 @@
+/**
+* @file s_mytarcodec.h
+* @author   ISO-2-G10
+* @date     16/10/2026
+* @brief    Codec of the numeric fields of c_header_gnu_tar
+* @details  The numeric fields of a header (mode, uid, gid, size, mtime,
+*           atime, ctime, checksum) are octal numbers in ASCII, zero padded
+*           and followed by a null char. sprintf/sscanf parse a format
+*           string for every field; these routines write two digits per
+*           step from a table and read the digits with a table of values.
+*
+*           CodificaOctal returns the sum of the bytes it writes, so the
+*           checksum of a header can be computed while its fields are
+*           filled (see ConstruyeCabeceraTar) instead of summing the 512
+*           bytes at the end.
+*
+*           A value that does not fit in the octal digits of its field
+*           (a size of 8 GiB or more, an uid of 2^21 or more) is written
+*           as GNU tar does: base-256, big endian, with the high bit of the
+*           first byte set and no null char (CodificaNumero).
+*           DecodificaNumero reads both forms.
+*
+*           Check and micro-benchmark: bench/mide_cabeceras.c; round trip
+*           against GNU tar: bench/prueba_cabeceras.sh
+*/
+#ifndef S_MYTARCODEC_H
+#define S_MYTARCODEC_H
+
+// "00" "01" ... "77": the two octal digits of 6 bits
+static const char TablaOctal[64][2] = {
+        {'0','0'},{'0','1'},{'0','2'},{'0','3'},{'0','4'},{'0','5'},{'0','6'},{'0','7'},
+        {'1','0'},{'1','1'},{'1','2'},{'1','3'},{'1','4'},{'1','5'},{'1','6'},{'1','7'},
+        {'2','0'},{'2','1'},{'2','2'},{'2','3'},{'2','4'},{'2','5'},{'2','6'},{'2','7'},
+        {'3','0'},{'3','1'},{'3','2'},{'3','3'},{'3','4'},{'3','5'},{'3','6'},{'3','7'},
+        {'4','0'},{'4','1'},{'4','2'},{'4','3'},{'4','4'},{'4','5'},{'4','6'},{'4','7'},
+        {'5','0'},{'5','1'},{'5','2'},{'5','3'},{'5','4'},{'5','5'},{'5','6'},{'5','7'},
+        {'6','0'},{'6','1'},{'6','2'},{'6','3'},{'6','4'},{'6','5'},{'6','6'},{'6','7'},
+        {'7','0'},{'7','1'},{'7','2'},{'7','3'},{'7','4'},{'7','5'},{'7','6'},{'7','7'}};
+
+// value of an octal digit, 8 for any other char
+static const unsigned char ValorOctal[256] = {
+        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8, 8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8, 0,1,2,3,4,5,6,7,8,8,8,8,8,8,8,8,
+        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8, 8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8, 8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8, 8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8, 8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8, 8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
+        8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8, 8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8};
+
+// Write v in digitos octal digits (zero padded, the high digits that do
+// not fit are lost) followed by a null char, as sprintf("%0*lo").
+// Return the sum of the bytes written.
+static inline unsigned int CodificaOctal(char *campo, int digitos, unsigned long long v)
+{
+        unsigned int suma = digitos * '0';
+        int i = digitos;
+
+        campo[digitos] = '\0';
+        for (; i >= 2; i -= 2, v >>= 6)
+        {
+                campo[i - 2] = TablaOctal[v & 077][0];
+                campo[i - 1] = TablaOctal[v & 077][1];
+                suma += (v & 077) >> 3;
+                suma += v & 07;
+        }
+        if (i == 1)
+        {
+                campo[0] = '0' + (v & 07);
+                suma += v & 07;
+        }
+        return suma;
+}
+
+// Read the octal number of a field of tam bytes (leading spaces, then
+// digits up to the first other char). Return the number of digits.
+static inline int LeeOctal(const char *campo, int tam, unsigned long long *v)
+{
+        const unsigned char *p = (const unsigned char *)campo;
+        unsigned long long valor = 0;
+        int i = 0, inicio;
+
+        while (i < tam && p[i] == ' ')
+                i++;
+        for (inicio = i; i < tam && ValorOctal[p[i]] < 8; i++)
+                valor = (valor << 3) | ValorOctal[p[i]];
+        *v = valor;
+        return i - inicio;
+}
+
+// Write v in a numeric field of tam bytes: octal (tam - 1 digits and a
+// null char) if it fits, base-256 if not. Return the sum of the bytes
+// written.
+static inline unsigned int CodificaNumero(char *campo, int tam, unsigned long long v)
+{
+        unsigned int suma = 0x80;
+        int i;
+
+        if ((tam - 1) * 3 >= 64 || (v >> ((tam - 1) * 3)) == 0)
+                return CodificaOctal(campo, tam - 1, v);
+        campo[0] = (char)0x80;
+        for (i = tam - 1; i > 0; i--, v >>= 8)
+        {
+                campo[i] = (char)(v & 0xff);
+                suma += v & 0xff;
+        }
+        return suma;
+}
+
+// Read a numeric field of tam bytes (octal or base-256). Negative base-256
+// values (only valid for times) are read as 0.
+static inline unsigned long long DecodificaNumero(const char *campo, int tam)
+{
+        const unsigned char *p = (const unsigned char *)campo;
+        unsigned long long v;
+        int i;
+
+        if (p[0] & 0x80)
+        {
+                if (p[0] & 0x40)
+                        return 0;
+                for (v = p[0] & 0x3f, i = 1; i < tam; i++)
+                        v = (v << 8) | p[i];
+                return v;
+        }
+        LeeOctal(campo, tam, &v);
+        return v;
+}
+
+// Copy the string s (at most tam bytes, the field is already zeros) and
+// return the sum of its bytes
+static inline unsigned int CopiaCampo(char *campo, int tam, const char *s)
+{
+        unsigned int suma = 0;
+        int i;
+
+        for (i = 0; i < tam && s[i] != '\0'; i++)
+        {
+                campo[i] = s[i];
+                suma += (unsigned char)s[i];
+        }
+        return suma;
+}
+
+// Sum of the bytes of a field
+static inline unsigned int SumaCampo(const char *campo, int tam)
+{
+        unsigned int suma = 0;
+        int i;
+
+        for (i = 0; i < tam; i++)
+                suma += (unsigned char)campo[i];
+        return suma;
+}
+
+#endif
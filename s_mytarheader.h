@@ -49,16 +49,35 @@
 *           +++++++++++++++++++++++
 *
 */
+#ifndef S_MYTARHEADER_H
+#define S_MYTARHEADER_H
 
 #define ERROR_OPEN_DAT_FILE (2)
 #define ERROR_OPEN_TAR_FILE (3)
 #define ERROR_GENERATE_TAR_FILE (4)
 #define ERROR_GENERATE_TAR_FILE2 (5)
+#define ERROR_MEMBER_NOT_FOUND (6)
+#define ERROR_BAD_HEADER (7)
 
 #define FILE_HEADER_SIZE     512
 #define DATAFILE_BLOCK_SIZE  512
 #define END_TAR_ARCHIVE_ENTRY_SIZE  (512*2)
 #define TAR_FILE_BLOCK_SIZE  ((unsigned long) (DATAFILE_BLOCK_SIZE*20))
+#define DEFAULT_BLOCKING_FACTOR  (2000)   // blocks of 512 bytes per write (multiple of 20)
+#define BUFFER_ALIGNMENT     4096
+
+#define GETDENTS_BUFFER_SIZE (64*1024)         // directory entries read at once
+#define VENTANA_INGESTA      256                  // members in flight with -j
+#define PREFETCH_MAX_FILE    (1024*1024)          // bigger files are not prefetched
+#define PREFETCH_MAX_MEMORY  (64*1024*1024)       // prefetched bytes not written yet
+#define TAIL_SCAN_WINDOW     (1024*1024)          // bytes read from the end to append
+#define URING_DEPTH          (64)                 // files in flight with -u (io_uring)
+#define URING_MAX_FILE       (64*1024)            // bigger files use the synchronous path
+#define DEDUP_TABLE_ENTRIES  (16384)              // files remembered by -d (multiple of DEDUP_WAYS)
+#define DEDUP_WAYS           (4)                  // entries with the same hash slot
+
+#define SPARSE_HEADER_ENTRIES (4)   // entries of the sparse map in the header
+#define SPARSE_EXT_ENTRIES    (21)  // entries in each c_sparse_gnu_tar
 
 #define HEADER_OK (1)
 #define HEADER_ERR (2)
@@ -66,7 +85,7 @@
 
 struct c_header_gnu_tar {
         char name[100];             // file name
-        char mode[8];               // stored as an octal number in ASCII.
+        char mode[8];               // stored as an octal number in ASCII (or base-256, see s_mytarcodec.h).
         char uid[8];                // (idem)
         char gid[8];                // (idem)
         char size[12];              // (idem)
@@ -80,17 +99,152 @@ struct c_header_gnu_tar {
         char gname[32];             // group name
         char devmajor[8];           // not used (zeros)
         char devminor[8];           // not used (zeros)
-        char atime[12];             // stored as an octal number in ASCII.
-        char ctime[12];             // stored as an octal number in ASCII.
+        char atime[12];             // (idem mode)
+        char ctime[12];             // (idem mode)
         char offset[12];            // not used (zeros)
         char longnames[4];          // not used (zeros)
         char unused[1];             // not used (zeros)
         struct {
                 char offset[12];
                 char numbytes[12];
-        } sparse[4];                // not used (zeros)
-        char isextended[1];         // not used (zeros)
-        char realsize[12];          // not used (zeros)
+        } sparse[SPARSE_HEADER_ENTRIES]; // sparse files (typeflag 'S'): map
+        char isextended[1];         // sparse files: c_sparse_gnu_tar follows
+        char realsize[12];          // sparse files: size of the file
         char pad[17];               // zeros
 };
 
+/*
+*  Sparse files (typeflag 'S', GNU format)
+*
+*           +++++++++++++++++++++++
+*           + Header Record       +  size = bytes of data stored, realsize =
+*           +                     +  size of the file, sparse[4] = first
+*           +                     +  4 (offset, numbytes) of the map
+*           +---------------------+
+*           + c_sparse_gnu_tar    +  only if isextended: 21 more entries of
+*           + ...                 +  the map each (and isextended)
+*           +---------------------+
+*           +  Data of the map    +  the data regions one after another
+*           + 0... N blocks of    +  (holes are not stored)
+*           + of 512 bytes        +
+*           +++++++++++++++++++++++
+*
+*           The last entry of the map is (realsize, 0), so the size of a file
+*           ending with a hole is known.
+*/
+struct c_sparse_gnu_tar {
+        struct {
+                char offset[12];
+                char numbytes[12];
+        } sparse[SPARSE_EXT_ENTRIES];
+        char isextended[1];         // another c_sparse_gnu_tar follows
+        char pad[7];                // zeros
+};
+
+/*
+*  Member index (sidecar file "<tarfile>.idx")
+*
+*           +++++++++++++++++++++++
+*           + c_index_tar_header  +  magic, version, number of entries,
+*           +                     +  offset of the end of archive blocks
+*           +++++++++++++++++++++++
+*           + c_index_tar_entry 0 +  header offset, data size, typeflag, name
+*           +++++++++++++++++++++++
+*           +        ...          +
+*           +++++++++++++++++++++++
+*           + c_index_tar_entry   +
+*           +       N-1           +
+*           +++++++++++++++++++++++
+*
+*           The index is only a hint: every entry is validated against the header
+*           stored in the tar file before it is used.
+*/
+/*
+*  Compressed tar file (-z)
+*
+*           +++++++++++++++++++++++
+*           + gzip member 0       +  bytes [0, GZIP_FRAME_SIZE) of the tar
+*           +++++++++++++++++++++++
+*           + gzip member 1       +  bytes [GZIP_FRAME_SIZE, 2*GZIP_FRAME_SIZE)
+*           +++++++++++++++++++++++
+*           +        ...          +
+*           +++++++++++++++++++++++
+*
+*           Each member (frame) is an independent gzip stream, so the file is
+*           a valid .tar.gz. Its header has an extra field (GZIP_FRAME_SI1,
+*           GZIP_FRAME_SI2) with the size of the member and the size of the
+*           data (little endian, 4 bytes each): the table of frames is read
+*           without decompressing them.
+*/
+#define GZIP_FRAME_SIZE      (1024*1024)          // bytes of the tar per gzip member
+#define GZIP_FRAME_HEADER    24                   // gzip header + extra field
+#define GZIP_FRAME_TRAILER   8                    // crc32 + size
+#define GZIP_FRAME_SI1       'M'
+#define GZIP_FRAME_SI2       'T'
+
+#define INDEX_FILE_SUFFIX    ".idx"
+#define INDEX_MAGIC          "MYTARIDX"
+#define INDEX_VERSION        (1)
+
+struct c_index_tar_header {
+        char magic[8];              // INDEX_MAGIC (without null char)
+        unsigned int version;       // INDEX_VERSION
+        unsigned int reserved;      // zeros
+        unsigned long long num;     // number of entries
+        unsigned long long fin;     // offset of the end of archive entry
+};
+
+struct c_index_tar_entry {
+        unsigned long long offset;  // offset of the header record
+        unsigned long long size;    // size of the file data
+        char typeflag;              // typeflag of the header
+        char name[100];             // file name (same as the header)
+        char pad[11];               // zeros
+};
+
+/*
+*  Snapshot of an incremental archive (-g file)
+*
+*           +++++++++++++++++++++++
+*           + c_snapshot_header   +  magic, version, number of entries,
+*           +                     +  size of the names
+*           +++++++++++++++++++++++
+*           + c_snapshot_entry 0  +  hash of the name, device, inode,
+*           +                     +  mtime, size, offset of the name
+*           +++++++++++++++++++++++
+*           +        ...          +
+*           +++++++++++++++++++++++
+*           + c_snapshot_entry    +
+*           +       N-1           +
+*           +++++++++++++++++++++++
+*           + names               +  the names one after another (without
+*           +                     +  null chars)
+*           +++++++++++++++++++++++
+*
+*           The entries are sorted by (hash, name): the file is mapped and
+*           searched in place, without reading it or building a table.
+*/
+#define SNAPSHOT_MAGIC       "MYTARSNP"
+#define SNAPSHOT_VERSION     (1)
+#define SNAPSHOT_DELETED_NAME ".targ10-borrados"  // member with the deleted names
+
+struct c_snapshot_header {
+        char magic[8];              // SNAPSHOT_MAGIC (without null char)
+        unsigned int version;       // SNAPSHOT_VERSION
+        unsigned int reserved;      // zeros
+        unsigned long long num;     // number of entries
+        unsigned long long nombres; // bytes of the names
+};
+
+struct c_snapshot_entry {
+        unsigned long long hash;    // HashNombre of the name
+        unsigned long long dev;     // st_dev
+        unsigned long long ino;     // st_ino
+        long long mtime;            // st_mtim in nanoseconds
+        unsigned long long size;    // st_size
+        unsigned long long nombre;  // offset of the name in the names
+        unsigned int longitud;      // length of the name
+        unsigned int reserved;      // zeros
+};
+
+#endif
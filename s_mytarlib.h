@@ -0,0 +1,71 @@
+/**
+* @file s_mytarlib.h
+* @author   ISO-2-G10
+* @date     16/10/2026
+* @brief    Reentrant reader of gnu tar files (mytarlib.c)
+* @details  The state of an archive is in the struct given by the caller
+*           (lector_mytar), never in globals, so many archives can be read
+*           at the same time from different threads (one thread per
+*           struct). The functions do not print anything: they return 0 or
+*           one of the error codes of s_mytarheader.h. The fd of the tar
+*           file belongs to the caller (it is not closed). Tar files are
+*           written by targ10 only (its writer, escritor_tar).
+*
+*           Reader: SiguienteCabeceraMytar returns the headers in order
+*           (checked: magic and checksum) and DatosMytar the data of the
+*           current member in pieces, without copying them: a regular file
+*           is mapped and a piece is the data in the mapping; a pipe is read
+*           in blocks of the blocking factor and a piece is in that buffer
+*           (valid until the next call). The data not asked for is skipped.
+*           The data of a sparse member ('S') is its data regions one after
+*           another (the map is in the header and its extended headers,
+*           which are skipped).
+*
+*               struct lector_mytar l;
+*               const struct c_header_gnu_tar *h;
+*               const char *trozo;
+*               long n;
+*               AbreLectorMytar(&l, fd, DEFAULT_BLOCKING_FACTOR);
+*               while ((h = SiguienteCabeceraMytar(&l)) != NULL)
+*                   while ((n = DatosMytar(&l, &trozo)) > 0)
+*                       ... n bytes at trozo ...
+*               ret = l.error;
+*               CierraLectorMytar(&l);
+*
+*           Library:
+*               gcc -O2 -c -fPIC mytarlib.c && ar rcs libmytar.a mytarlib.o
+*
+*           Test against GNU tar (a reader consumer):
+*               bench/prueba_mytarlib.sh
+*/
+#ifndef S_MYTARLIB_H
+#define S_MYTARLIB_H
+
+#include <sys/types.h>
+#include "s_mytarheader.h"
+
+struct lector_mytar {
+        int fd;
+        const char *mapa;           // regular file: the tar file mapped
+        unsigned long long tamMapa;
+        char *buffer;               // pipe: bytes read and not consumed yet
+        unsigned long tamBuffer, inicio, fin;
+        unsigned long long pos;     // offset of the next byte of the tar file
+        unsigned long long datos;   // bytes of data of the current member not returned
+        unsigned long long relleno; // zeros of its last block
+        struct c_header_gnu_tar cabecera; // pipe: the current header
+        int error;                  // 0, or ERROR_BAD_HEADER / ERROR_OPEN_TAR_FILE
+};
+
+// Headers
+int CabeceraValida(const struct c_header_gnu_tar *pheaderData);
+int CabeceraCeros(const struct c_header_gnu_tar *pheaderData);
+void ActualizaChecksum(struct c_header_gnu_tar *pTarHeader);
+
+// Reader
+int AbreLectorMytar(struct lector_mytar *lector, int fd_TarFile, unsigned long factorBloqueo);
+const struct c_header_gnu_tar *SiguienteCabeceraMytar(struct lector_mytar *lector);
+long DatosMytar(struct lector_mytar *lector, const char **trozo);
+void CierraLectorMytar(struct lector_mytar *lector);
+
+#endif
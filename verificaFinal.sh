@@ -1,8 +1,41 @@
 ./targ10 seq.dat test.tar
 tar -tvf test.tar
+./targ10 -t test.tar
 ./targ10 pruebas test.tar
 tar -tvf test.tar
-./targ10 -e pruebas/f1.dat test.tar
-./targ10 -e pruebas/carpeta test.tar
-./targ10 -e pruebas/enlace test.tar
+./targ10 -t test.tar
+./targ10 -e pruebas/f1.dat pruebas/carpeta pruebas/enlace test.tar
+./targ10 --replace pruebas/f1.dat seq.dat test.tar
+./targ10 --delete seq.dat test.tar
+tar -tvf test.tar
 rm test.tar
+./targ10 pruebas - | cat | ./targ10 -t -
+mkdir flujo
+./targ10 pruebas - | cat | (cd flujo && ../targ10 -x -)
+diff -r flujo/pruebas pruebas && echo flujo OK
+rm -r flujo
+truncate -s 9G grande.dat
+printf final | dd of=grande.dat bs=1 seek=9663676411 conv=notrunc status=none
+./targ10 grande.dat grande.tar
+tar -tvf grande.tar
+./targ10 -t grande.tar
+mkdir grande && cd grande
+../targ10 -e grande.dat ../grande.tar
+cmp grande.dat ../grande.dat && tail -c 5 grande.dat && echo
+cd .. && rm -r grande grande.dat grande.tar
+printf 'add seq.dat\nadd pruebas\nlist\nextract pruebas/f1.dat\n' | ./targ10 --batch - lote.tar
+tar -tvf lote.tar
+rm lote.tar
+./targ10 --io=directo pruebas io.tar
+tar -tvf io.tar
+rm io.tar
+mkdir cola && cd cola
+yes 0123456789 | head -c 2097152 > a.dat && yes abc | head -c 10240 > b.dat
+tar -b 1 -cf T.tar a.dat b.dat
+../targ10 T.tar anexa.tar
+echo otro > otro.txt
+../targ10 otro.txt anexa.tar
+tar -tvf anexa.tar
+mkdir x && cd x && tar -xf ../anexa.tar
+cmp T.tar ../T.tar && cmp otro.txt ../otro.txt && echo cola OK
+cd ../.. && rm -r cola